@@ -0,0 +1,163 @@
+#include "bench_common.h"
+#include "fuse_example.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// splitmix64: tiny, fast and good enough to make workloads repeatable.
+void bench_rng_seed(BenchRng *rng, uint64_t seed) {
+    rng->state = seed;
+}
+
+uint64_t bench_rng_next(BenchRng *rng) {
+    uint64_t z = (rng->state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+uint64_t bench_rng_below(BenchRng *rng, uint64_t bound) {
+    return bound ? bench_rng_next(rng) % bound : 0;
+}
+
+uint64_t bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+void latency_init(LatencyRecorder *recorder) {
+    recorder->samples = NULL;
+    recorder->count = 0;
+    recorder->capacity = 0;
+}
+
+void latency_record(LatencyRecorder *recorder, uint64_t duration_ns) {
+    if (recorder->count == recorder->capacity) {
+        size_t new_capacity = recorder->capacity ? recorder->capacity * 2 : 4096;
+        uint64_t *new_samples = realloc(recorder->samples, new_capacity * sizeof(uint64_t));
+        if (new_samples == NULL) {
+            return;
+        }
+        recorder->samples = new_samples;
+        recorder->capacity = new_capacity;
+    }
+    recorder->samples[recorder->count++] = duration_ns;
+}
+
+void latency_reset(LatencyRecorder *recorder) {
+    recorder->count = 0;
+}
+
+void latency_free(LatencyRecorder *recorder) {
+    free(recorder->samples);
+    latency_init(recorder);
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile_us(const LatencyRecorder *recorder, double fraction) {
+    if (recorder->count == 0) {
+        return 0.0;
+    }
+    size_t rank = (size_t)(fraction * (double)recorder->count);
+    if (rank >= recorder->count) {
+        rank = recorder->count - 1;
+    }
+    return recorder->samples[rank] / 1000.0;
+}
+
+void latency_summarize(LatencyRecorder *recorder, double seconds, BenchResult *result) {
+    qsort(recorder->samples, recorder->count, sizeof(uint64_t), compare_u64);
+    result->ops = recorder->count;
+    result->seconds = seconds;
+    result->ops_per_sec = seconds > 0 ? recorder->count / seconds : 0.0;
+    result->p50_us = percentile_us(recorder, 0.50);
+    result->p99_us = percentile_us(recorder, 0.99);
+    result->p999_us = percentile_us(recorder, 0.999);
+    result->max_us = recorder->count ? recorder->samples[recorder->count - 1] / 1000.0 : 0.0;
+}
+
+void bench_print_text(FILE *out, const BenchResult *result) {
+    fprintf(out, "%-24s %10llu ops %6llu err %10.3f s %12.1f ops/s  p50 %9.1f us  p99 %9.1f us  p999 %9.1f us  max %9.1f us\n",
+            result->name, (unsigned long long)result->ops, (unsigned long long)result->errors,
+            result->seconds, result->ops_per_sec, result->p50_us, result->p99_us, result->p999_us, result->max_us);
+}
+
+void bench_print_json(FILE *out, const char *tool, const char *label, uint64_t seed,
+                      const BenchResult *results, size_t count) {
+    fprintf(out, "{\"tool\":\"%s\",\"label\":\"%s\",\"seed\":%llu,\"timestamp\":%ld,\"results\":[",
+            tool, label ? label : "", (unsigned long long)seed, (long)time(NULL));
+    for (size_t i = 0; i < count; i++) {
+        fprintf(out, "%s{\"name\":\"%s\",\"ops\":%llu,\"errors\":%llu,\"seconds\":%.6f,\"ops_per_sec\":%.1f,"
+                     "\"p50_us\":%.2f,\"p99_us\":%.2f,\"p999_us\":%.2f,\"max_us\":%.2f}",
+                i ? "," : "", results[i].name, (unsigned long long)results[i].ops,
+                (unsigned long long)results[i].errors, results[i].seconds, results[i].ops_per_sec,
+                results[i].p50_us, results[i].p99_us, results[i].p999_us, results[i].max_us);
+    }
+    fprintf(out, "]}\n");
+}
+
+const char *const bench_sub_device_models[BENCH_SUB_DEVICE_MODELS] = {"SENSOR", "ACTUATOR", "HY-TTC_50"};
+const char bench_sub_device_prefixes[BENCH_SUB_DEVICE_MODELS] = {'s', 'a', 'h'};
+
+#define IMPORT_WRITE_SIZE 65536
+
+// IMEIs stay seven digits however many devices there are.
+void bench_device_name(char *out, size_t size, int device) {
+    snprintf(out, size, "d%d.%d.%d", device, 1000 + device, 1000000 + device % 9000000);
+}
+
+void bench_sub_device_name(char *out, size_t size, int sub) {
+    snprintf(out, size, "%c%d.%s.%d", bench_sub_device_prefixes[sub % BENCH_SUB_DEVICE_MODELS], sub,
+             bench_sub_device_models[sub % BENCH_SUB_DEVICE_MODELS], 100 + sub);
+}
+
+void bench_sub_device_path(char *out, size_t size, const char *root, int device, int sub) {
+    snprintf(out, size, "%s/d%d/%c%d.%s", root, device, bench_sub_device_prefixes[sub % BENCH_SUB_DEVICE_MODELS], sub,
+             bench_sub_device_models[sub % BENCH_SUB_DEVICE_MODELS]);
+}
+
+int bench_import_fixture(const struct fuse_operations *ops, int devices, int sub_devices) {
+    size_t capacity = (size_t)devices * (48 + (size_t)sub_devices * 48) + 1;
+    char *batch = malloc(capacity);
+    if (batch == NULL) {
+        return -1;
+    }
+    size_t length = 0;
+    char name[64];
+    for (int i = 0; i < devices; i++) {
+        bench_device_name(name, sizeof(name), i);
+        length += snprintf(batch + length, capacity - length, "%s\n", name);
+        for (int sub = 0; sub < sub_devices; sub++) {
+            bench_sub_device_name(name, sizeof(name), sub);
+            length += snprintf(batch + length, capacity - length, "%s\n", name);
+        }
+    }
+
+    const char *path = "/.control/import";
+    struct fuse_file_info fi;
+    memset(&fi, 0, sizeof(fi));
+    fi.flags = O_WRONLY;
+    int result = ops->open(path, &fi);
+    if (result != 0) {
+        free(batch);
+        return -1;
+    }
+    for (size_t offset = 0; result == 0 && offset < length; offset += IMPORT_WRITE_SIZE) {
+        size_t chunk = length - offset < IMPORT_WRITE_SIZE ? length - offset : IMPORT_WRITE_SIZE;
+        result = ops->write(path, batch + offset, chunk, offset, &fi) == (int)chunk ? 0 : -1;
+    }
+    // The batch is applied on flush, which reports failed records.
+    if (ops->flush(path, &fi) != 0) {
+        result = -1;
+    }
+    ops->release(path, &fi);
+    free(batch);
+    return result;
+}
@@ -0,0 +1,75 @@
+#ifndef BENCH_COMMON_H
+#define BENCH_COMMON_H
+#include <stdint.h>
+#include <stdio.h>
+#include <stddef.h>
+
+// Shared helpers for the benchmark tools: a seeded PRNG, a latency recorder
+// that keeps every sample, result printing in text and JSON, and the device
+// fleet the tools provision.
+
+typedef struct {
+    uint64_t state;
+} BenchRng;
+
+void bench_rng_seed(BenchRng *rng, uint64_t seed);
+uint64_t bench_rng_next(BenchRng *rng);
+uint64_t bench_rng_below(BenchRng *rng, uint64_t bound);
+
+uint64_t bench_now_ns(void);
+
+typedef struct {
+    uint64_t *samples;
+    size_t count;
+    size_t capacity;
+} LatencyRecorder;
+
+typedef struct {
+    const char *name;
+    uint64_t ops;
+    uint64_t errors;
+    double seconds;
+    double ops_per_sec;
+    double p50_us;
+    double p99_us;
+    double p999_us;
+    double max_us;
+} BenchResult;
+
+void latency_init(LatencyRecorder *recorder);
+void latency_record(LatencyRecorder *recorder, uint64_t duration_ns);
+void latency_reset(LatencyRecorder *recorder);
+void latency_free(LatencyRecorder *recorder);
+
+// Sorts the samples and fills the latency and throughput fields of result.
+void latency_summarize(LatencyRecorder *recorder, double seconds, BenchResult *result);
+
+void bench_print_text(FILE *out, const BenchResult *result);
+
+// Writes {"label":...,"seed":...,"results":[...]} so runs can be diffed
+// across commits.
+void bench_print_json(FILE *out, const char *tool, const char *label, uint64_t seed,
+                      const BenchResult *results, size_t count);
+
+// The fleet every tool builds: devices d0, d1, ... with sub-devices
+// <prefix><n>.<model>, the model cycling through the table below.
+#define BENCH_SUB_DEVICE_MODELS 3
+extern const char *const bench_sub_device_models[BENCH_SUB_DEVICE_MODELS];
+extern const char bench_sub_device_prefixes[BENCH_SUB_DEVICE_MODELS];
+
+struct fuse_operations;
+
+// Device and sub-device names as mkdir and create take them, with the
+// serial and IMEI fields the import records use too.
+void bench_device_name(char *out, size_t size, int device);
+void bench_sub_device_name(char *out, size_t size, int sub);
+
+// Path of a created sub-device under root ("" for in-process calls).
+void bench_sub_device_path(char *out, size_t size, const char *root, int device, int sub);
+
+// Provisions the fleet through /.control/import of ops in 64 KiB writes, so
+// building 1M entries stays linear. Returns 0, or -1 when a write or a
+// record failed.
+int bench_import_fixture(const struct fuse_operations *ops, int devices, int sub_devices);
+
+#endif // BENCH_COMMON_H
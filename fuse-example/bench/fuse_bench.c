@@ -0,0 +1,449 @@
+// fuse-bench: mounts fuse-example in a scratch directory and drives
+// repeatable workloads through the kernel, reporting ops/s and latency
+// percentiles per workload.
+#define _GNU_SOURCE
+#include "bench_common.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <getopt.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifndef FUSE_EXAMPLE_BINARY
+#define FUSE_EXAMPLE_BINARY "fuse-example"
+#endif
+
+#define MAX_WORKLOADS 8
+
+typedef struct {
+    const char *binary;
+    const char *label;
+    const char *output;
+    const char *workloads;
+    uint64_t seed;
+    int devices;
+    int sub_devices;    // per device
+    uint64_t ops;       // per workload for stat, readdir, sensor and mixed
+    int debug_log;
+} BenchConfig;
+
+typedef struct {
+    const BenchConfig *config;
+    char mount_dir[PATH_MAX];
+    BenchRng rng;
+    int devices_created;
+    int sub_devices_created;    // per device
+    uint64_t scratch_counter;
+} BenchContext;
+
+static void device_path(const BenchContext *ctx, int device, char *out, size_t size) {
+    snprintf(out, size, "%s/d%d", ctx->mount_dir, device);
+}
+
+static void sub_device_path(const BenchContext *ctx, int device, int sub, char *out, size_t size) {
+    bench_sub_device_path(out, size, ctx->mount_dir, device, sub);
+}
+
+static int random_device(BenchContext *ctx) {
+    return (int)bench_rng_below(&ctx->rng, ctx->devices_created);
+}
+
+static int random_sub_device(BenchContext *ctx, int model_index) {
+    if (ctx->sub_devices_created == 0) {
+        return -1;
+    }
+    // Pick a sub-device of the requested model if there is one.
+    int sub = (int)bench_rng_below(&ctx->rng, ctx->sub_devices_created);
+    if (model_index >= 0) {
+        sub -= sub % BENCH_SUB_DEVICE_MODELS;
+        sub += model_index;
+        if (sub >= ctx->sub_devices_created) {
+            return -1;
+        }
+    }
+    return sub;
+}
+
+static int timed(LatencyRecorder *recorder, uint64_t start_ns, int ok) {
+    latency_record(recorder, bench_now_ns() - start_ns);
+    return ok ? 0 : 1;
+}
+
+static uint64_t run_mkdir(BenchContext *ctx, LatencyRecorder *recorder) {
+    uint64_t errors = 0;
+    char path[PATH_MAX];
+    char name[64];
+    for (int i = 0; i < ctx->config->devices; i++) {
+        bench_device_name(name, sizeof(name), i);
+        snprintf(path, sizeof(path), "%s/%s", ctx->mount_dir, name);
+        uint64_t start = bench_now_ns();
+        errors += timed(recorder, start, mkdir(path, 0755) == 0);
+    }
+    ctx->devices_created = ctx->config->devices;
+    return errors;
+}
+
+static uint64_t run_create(BenchContext *ctx, LatencyRecorder *recorder) {
+    uint64_t errors = 0;
+    char path[PATH_MAX];
+    char name[64];
+    for (int i = 0; i < ctx->devices_created; i++) {
+        for (int sub = 0; sub < ctx->config->sub_devices; sub++) {
+            bench_sub_device_name(name, sizeof(name), sub);
+            snprintf(path, sizeof(path), "%s/d%d/%s", ctx->mount_dir, i, name);
+            uint64_t start = bench_now_ns();
+            int fd = open(path, O_CREAT | O_WRONLY, 0644);
+            if (fd >= 0) {
+                close(fd);
+            }
+            errors += timed(recorder, start, fd >= 0);
+        }
+    }
+    ctx->sub_devices_created = ctx->config->sub_devices;
+    return errors;
+}
+
+static int do_stat(BenchContext *ctx) {
+    char path[PATH_MAX];
+    struct stat st;
+    int device = random_device(ctx);
+    int sub = random_sub_device(ctx, -1);
+    switch (bench_rng_below(&ctx->rng, 3)) {
+        case 0:
+            device_path(ctx, device, path, sizeof(path));
+            break;
+        case 1:
+            device_path(ctx, device, path, sizeof(path));
+            strncat(path, "/GPS", sizeof(path) - strlen(path) - 1);
+            break;
+        default:
+            if (sub < 0) {
+                device_path(ctx, device, path, sizeof(path));
+            } else {
+                sub_device_path(ctx, device, sub, path, sizeof(path));
+            }
+            break;
+    }
+    return stat(path, &st) == 0;
+}
+
+static int do_readdir(BenchContext *ctx) {
+    char path[PATH_MAX];
+    device_path(ctx, random_device(ctx), path, sizeof(path));
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        return 0;
+    }
+    while (readdir(dir) != NULL) {
+    }
+    closedir(dir);
+    return 1;
+}
+
+static int read_file(const char *path) {
+    char buffer[4096];
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    ssize_t n = read(fd, buffer, sizeof(buffer));
+    close(fd);
+    return n >= 0;
+}
+
+static int do_sensor_read(BenchContext *ctx) {
+    char path[PATH_MAX];
+    int device = random_device(ctx);
+    int kind = (int)bench_rng_below(&ctx->rng, 3);
+    int sub = kind == 2 ? random_sub_device(ctx, 0) : -1;
+    if (sub >= 0) {
+        sub_device_path(ctx, device, sub, path, sizeof(path));
+    } else {
+        device_path(ctx, device, path, sizeof(path));
+        strncat(path, kind == 1 ? "/GYRO" : "/GPS", sizeof(path) - strlen(path) - 1);
+    }
+    return read_file(path);
+}
+
+static int write_file(const char *path, const char *data) {
+    int fd = open(path, O_WRONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    ssize_t n = write(fd, data, strlen(data));
+    close(fd);
+    return n == (ssize_t)strlen(data);
+}
+
+static int do_write(BenchContext *ctx) {
+    char path[PATH_MAX];
+    int device = random_device(ctx);
+    int actuator = random_sub_device(ctx, 1);
+    int generic = random_sub_device(ctx, 2);
+    if (actuator >= 0 && bench_rng_below(&ctx->rng, 2) == 0) {
+        sub_device_path(ctx, device, actuator, path, sizeof(path));
+        return write_file(path, "set 42\n");
+    }
+    if (generic >= 0) {
+        sub_device_path(ctx, device, generic, path, sizeof(path));
+        return write_file(path, bench_rng_below(&ctx->rng, 2) ? "data\n" : "info\n");
+    }
+    return 1;
+}
+
+static int do_create_unlink(BenchContext *ctx) {
+    char path[PATH_MAX];
+    int device = random_device(ctx);
+    uint64_t id = ctx->scratch_counter++;
+    snprintf(path, sizeof(path), "%s/d%d/tmp%llu.SENSOR.1", ctx->mount_dir, device, (unsigned long long)id);
+    int fd = open(path, O_CREAT | O_WRONLY, 0644);
+    if (fd < 0) {
+        return 0;
+    }
+    close(fd);
+    snprintf(path, sizeof(path), "%s/d%d/tmp%llu.SENSOR", ctx->mount_dir, device, (unsigned long long)id);
+    return unlink(path) == 0;
+}
+
+static uint64_t run_loop(BenchContext *ctx, LatencyRecorder *recorder, int (*op)(BenchContext *)) {
+    uint64_t errors = 0;
+    for (uint64_t i = 0; i < ctx->config->ops; i++) {
+        uint64_t start = bench_now_ns();
+        errors += timed(recorder, start, op(ctx));
+    }
+    return errors;
+}
+
+// 50% stat, 20% sensor read, 10% readdir, 15% write, 5% create + unlink.
+static int do_mixed(BenchContext *ctx) {
+    uint64_t pick = bench_rng_below(&ctx->rng, 100);
+    if (pick < 50) return do_stat(ctx);
+    if (pick < 70) return do_sensor_read(ctx);
+    if (pick < 80) return do_readdir(ctx);
+    if (pick < 95) return do_write(ctx);
+    return do_create_unlink(ctx);
+}
+
+static uint64_t run_stat(BenchContext *ctx, LatencyRecorder *recorder) {
+    return run_loop(ctx, recorder, do_stat);
+}
+
+static uint64_t run_readdir(BenchContext *ctx, LatencyRecorder *recorder) {
+    return run_loop(ctx, recorder, do_readdir);
+}
+
+static uint64_t run_sensor(BenchContext *ctx, LatencyRecorder *recorder) {
+    return run_loop(ctx, recorder, do_sensor_read);
+}
+
+static uint64_t run_mixed(BenchContext *ctx, LatencyRecorder *recorder) {
+    return run_loop(ctx, recorder, do_mixed);
+}
+
+typedef struct {
+    const char *name;
+    uint64_t (*run)(BenchContext *ctx, LatencyRecorder *recorder);
+} Workload;
+
+// Order matters: later workloads use the devices the first two create.
+static const Workload workloads[] = {
+    {"mkdir", run_mkdir},
+    {"create", run_create},
+    {"stat", run_stat},
+    {"readdir", run_readdir},
+    {"sensor_read", run_sensor},
+    {"mixed_rw", run_mixed},
+};
+
+#define WORKLOAD_COUNT (sizeof(workloads) / sizeof(workloads[0]))
+
+static int workload_selected(const BenchConfig *config, const char *name) {
+    if (config->workloads == NULL || strcmp(config->workloads, "all") == 0) {
+        return 1;
+    }
+    size_t length = strlen(name);
+    for (const char *it = config->workloads; (it = strstr(it, name)) != NULL; it += length) {
+        int starts = it == config->workloads || it[-1] == ',';
+        int ends = it[length] == '\0' || it[length] == ',';
+        if (starts && ends) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static pid_t start_daemon(const BenchConfig *config, const char *mount_dir, const char *data_dir) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        setenv("FUSE_EXAMPLE_DATA_DIR", data_dir, 1);
+        setenv("FUSE_EXAMPLE_DEBUG_LOG", config->debug_log ? "1" : "0", 1);
+        setenv("FUSE_EXAMPLE_RESTORE", "0", 1);
+        execl(config->binary, config->binary, "-f", mount_dir, (char *)NULL);
+        perror("execl");
+        _exit(127);
+    }
+    return pid;
+}
+
+static int wait_for_mount(const char *mount_dir, pid_t daemon, int timeout_ms) {
+    char parent[PATH_MAX];
+    snprintf(parent, sizeof(parent), "%s/..", mount_dir);
+    for (int waited = 0; waited < timeout_ms; waited += 10) {
+        struct stat mount_stat, parent_stat;
+        if (stat(mount_dir, &mount_stat) == 0 && stat(parent, &parent_stat) == 0 &&
+            mount_stat.st_dev != parent_stat.st_dev) {
+            return 0;
+        }
+        if (waitpid(daemon, NULL, WNOHANG) == daemon) {
+            return -1;
+        }
+        usleep(10000);
+    }
+    return -1;
+}
+
+static void stop_daemon(const char *mount_dir, pid_t daemon) {
+    pid_t unmount = fork();
+    if (unmount == 0) {
+        execlp("fusermount", "fusermount", "-u", mount_dir, (char *)NULL);
+        _exit(127);
+    }
+    if (unmount > 0) {
+        waitpid(unmount, NULL, 0);
+    }
+    for (int waited = 0; waited < 5000; waited += 10) {
+        if (waitpid(daemon, NULL, WNOHANG) == daemon) {
+            return;
+        }
+        usleep(10000);
+    }
+    kill(daemon, SIGTERM);
+    waitpid(daemon, NULL, 0);
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+    (void)st;
+    (void)flag;
+    (void)ftw;
+    return remove(path);
+}
+
+static void usage(const char *program) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --workloads LIST   comma-separated: mkdir,create,stat,readdir,sensor_read,mixed_rw (default all)\n"
+            "  --devices N        devices created by mkdir (default 1000)\n"
+            "  --sub-devices N    sub-devices created per device (default 3)\n"
+            "  --ops N            operations per stat/readdir/sensor_read/mixed_rw workload (default 20000)\n"
+            "  --seed N           PRNG seed (default 1)\n"
+            "  --label TEXT       label stored in the JSON output, e.g. a commit id\n"
+            "  --output FILE      write JSON results to FILE (default: stdout)\n"
+            "  --binary PATH      filesystem binary (default: %s)\n"
+            "  --debug-log        keep the daemon's debug log enabled\n",
+            program, FUSE_EXAMPLE_BINARY);
+}
+
+int main(int argc, char *argv[]) {
+    BenchConfig config = {FUSE_EXAMPLE_BINARY, NULL, NULL, NULL, 1, 1000, 3, 20000, 0};
+    static struct option options[] = {
+        {"workloads", required_argument, NULL, 'w'},
+        {"devices", required_argument, NULL, 'd'},
+        {"sub-devices", required_argument, NULL, 's'},
+        {"ops", required_argument, NULL, 'n'},
+        {"seed", required_argument, NULL, 'S'},
+        {"label", required_argument, NULL, 'l'},
+        {"output", required_argument, NULL, 'o'},
+        {"binary", required_argument, NULL, 'b'},
+        {"debug-log", no_argument, NULL, 'D'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    int option;
+    while ((option = getopt_long(argc, argv, "w:d:s:n:S:l:o:b:Dh", options, NULL)) != -1) {
+        switch (option) {
+            case 'w': config.workloads = optarg; break;
+            case 'd': config.devices = atoi(optarg); break;
+            case 's': config.sub_devices = atoi(optarg); break;
+            case 'n': config.ops = strtoull(optarg, NULL, 10); break;
+            case 'S': config.seed = strtoull(optarg, NULL, 10); break;
+            case 'l': config.label = optarg; break;
+            case 'o': config.output = optarg; break;
+            case 'b': config.binary = optarg; break;
+            case 'D': config.debug_log = 1; break;
+            default: usage(argv[0]); return option == 'h' ? 0 : 2;
+        }
+    }
+    if (config.devices <= 0 || config.sub_devices < 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    char scratch[] = "/tmp/fuse-bench-XXXXXX";
+    if (mkdtemp(scratch) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    BenchContext ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.config = &config;
+    char data_dir[PATH_MAX];
+    snprintf(ctx.mount_dir, sizeof(ctx.mount_dir), "%s/mnt", scratch);
+    snprintf(data_dir, sizeof(data_dir), "%s/data", scratch);
+    mkdir(ctx.mount_dir, 0755);
+    mkdir(data_dir, 0755);
+    bench_rng_seed(&ctx.rng, config.seed);
+
+    pid_t daemon = start_daemon(&config, ctx.mount_dir, data_dir);
+    if (daemon < 0 || wait_for_mount(ctx.mount_dir, daemon, 10000) != 0) {
+        fprintf(stderr, "fuse-bench: %s did not mount %s\n", config.binary, ctx.mount_dir);
+        nftw(scratch, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+        return 1;
+    }
+
+    BenchResult results[WORKLOAD_COUNT];
+    size_t result_count = 0;
+    LatencyRecorder recorder;
+    latency_init(&recorder);
+    for (size_t i = 0; i < WORKLOAD_COUNT; i++) {
+        // mkdir and create build the fixture the other workloads need.
+        int selected = workload_selected(&config, workloads[i].name);
+        if (!selected && i >= 2) {
+            continue;
+        }
+        latency_reset(&recorder);
+        uint64_t start = bench_now_ns();
+        uint64_t errors = workloads[i].run(&ctx, &recorder);
+        double seconds = (bench_now_ns() - start) / 1e9;
+        if (!selected) {
+            continue;
+        }
+        BenchResult *result = &results[result_count++];
+        result->name = workloads[i].name;
+        latency_summarize(&recorder, seconds, result);
+        result->errors = errors;
+        bench_print_text(stderr, result);
+    }
+    latency_free(&recorder);
+
+    stop_daemon(ctx.mount_dir, daemon);
+    nftw(scratch, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+
+    FILE *out = config.output ? fopen(config.output, "w") : stdout;
+    if (out == NULL) {
+        perror(config.output);
+        return 1;
+    }
+    bench_print_json(out, "fuse-bench", config.label, config.seed, results, result_count);
+    if (out != stdout) {
+        fclose(out);
+    }
+    return 0;
+}
@@ -0,0 +1,378 @@
+// fuse-microbench: calls the filesystem operations in-process through
+// fuse_example_operations, without the kernel or libfuse in the loop, and
+// sweeps the number of entries to expose how each operation scales.
+#define _GNU_SOURCE
+#include "bench_common.h"
+#include "fuse_example.h"
+#include "device_manager.h"
+#include "sensor_engine.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SUB_DEVICES_PER_DEVICE 3
+
+typedef struct {
+    const char *label;
+    const char *output;
+    const char *sizes;
+    uint64_t seed;
+    uint64_t ops;           // upper bound of samples per measurement
+    uint64_t budget_ms;     // upper bound of time per measurement
+    int debug_log;
+} MicroConfig;
+
+typedef struct {
+    const MicroConfig *config;
+    BenchRng rng;
+    int devices;            // d0 .. d<devices - 1> exist
+    int removed;            // rmdir removes from the end
+    uint64_t scratch_counter;
+} MicroContext;
+
+static int count_entry(void *buf, const char *name, const struct stat *st, off_t offset) {
+    (void)name;
+    (void)st;
+    (void)offset;
+    (*(size_t *)buf)++;
+    return 0;
+}
+
+static int random_device(MicroContext *ctx) {
+    return (int)bench_rng_below(&ctx->rng, ctx->devices - ctx->removed);
+}
+
+static void sub_device_path(int device, int sub, char *out, size_t size) {
+    bench_sub_device_path(out, size, "", device, sub);
+}
+
+// Writes the fixture through /.control/import, the same path a bulk
+// provisioning run takes.
+static int import_fixture(int entries, int *devices) {
+    *devices = entries / (SUB_DEVICES_PER_DEVICE + 1);
+    if (*devices == 0) {
+        *devices = 1;
+    }
+    return bench_import_fixture(&fuse_example_operations, *devices, SUB_DEVICES_PER_DEVICE);
+}
+
+static int do_getattr_dir(MicroContext *ctx) {
+    char path[64];
+    struct stat st;
+    snprintf(path, sizeof(path), "/d%d", random_device(ctx));
+    return fuse_example_operations.getattr(path, &st) == 0;
+}
+
+static int do_getattr_file(MicroContext *ctx) {
+    char path[64];
+    struct stat st;
+    sub_device_path(random_device(ctx), (int)bench_rng_below(&ctx->rng, SUB_DEVICES_PER_DEVICE), path, sizeof(path));
+    return fuse_example_operations.getattr(path, &st) == 0;
+}
+
+static int do_getattr_virtual(MicroContext *ctx) {
+    char path[64];
+    struct stat st;
+    snprintf(path, sizeof(path), "/d%d/GPS", random_device(ctx));
+    return fuse_example_operations.getattr(path, &st) == 0;
+}
+
+// A lookup that fails scans everything a lookup can scan.
+static int do_getattr_missing(MicroContext *ctx) {
+    char path[64];
+    struct stat st;
+    snprintf(path, sizeof(path), "/d%d/missing.SENSOR", random_device(ctx));
+    return fuse_example_operations.getattr(path, &st) == -ENOENT;
+}
+
+static int do_readdir_root(MicroContext *ctx) {
+    (void)ctx;
+    size_t entries = 0;
+    return fuse_example_operations.readdir("/", &entries, count_entry, 0, NULL) == 0;
+}
+
+static int do_readdir_device(MicroContext *ctx) {
+    char path[64];
+    size_t entries = 0;
+    snprintf(path, sizeof(path), "/d%d", random_device(ctx));
+    return fuse_example_operations.readdir(path, &entries, count_entry, 0, NULL) == 0;
+}
+
+static int read_whole(const char *path) {
+    char buffer[4096];
+    struct fuse_file_info fi;
+    memset(&fi, 0, sizeof(fi));
+    fi.flags = O_RDONLY;
+    if (fuse_example_operations.open(path, &fi) != 0) {
+        return 0;
+    }
+    int result = fuse_example_operations.read(path, buffer, sizeof(buffer), 0, &fi);
+    fuse_example_operations.release(path, &fi);
+    return result >= 0;
+}
+
+static int do_read_gps(MicroContext *ctx) {
+    char path[64];
+    snprintf(path, sizeof(path), "/d%d/GPS", random_device(ctx));
+    return read_whole(path);
+}
+
+static int do_read_sensor(MicroContext *ctx) {
+    char path[64];
+    sub_device_path(random_device(ctx), 0, path, sizeof(path));
+    return read_whole(path);
+}
+
+static int write_string(const char *path, const char *data) {
+    struct fuse_file_info fi;
+    memset(&fi, 0, sizeof(fi));
+    fi.flags = O_WRONLY;
+    if (fuse_example_operations.open(path, &fi) != 0) {
+        return 0;
+    }
+    int result = fuse_example_operations.write(path, data, strlen(data), 0, &fi);
+    fuse_example_operations.release(path, &fi);
+    return result == (int)strlen(data);
+}
+
+// One tick moves the simulated values of the whole fleet.
+static int do_sensor_tick(MicroContext *ctx) {
+    (void)ctx;
+    sensor_engine_tick();
+    return 1;
+}
+
+// "info" looks the device up in the JSON file, so it scales with persistence.
+static int do_write_info(MicroContext *ctx) {
+    char path[64];
+    sub_device_path(random_device(ctx), 2, path, sizeof(path));
+    return write_string(path, "info\n");
+}
+
+static int do_mkdir(MicroContext *ctx) {
+    char path[64];
+    uint64_t id = ctx->scratch_counter++;
+    snprintf(path, sizeof(path), "/m%llu.%llu.%d", (unsigned long long)id, (unsigned long long)id, 2000000);
+    return fuse_example_operations.mkdir(path, 0755) == 0;
+}
+
+static int do_create(MicroContext *ctx) {
+    char path[64];
+    struct fuse_file_info fi;
+    memset(&fi, 0, sizeof(fi));
+    uint64_t id = ctx->scratch_counter++;
+    snprintf(path, sizeof(path), "/d%d/c%llu.SENSOR.1", random_device(ctx), (unsigned long long)id);
+    return fuse_example_operations.create(path, 0644, &fi) == 0;
+}
+
+static int do_save_json(MicroContext *ctx) {
+    (void)ctx;
+    save_registry_to_json(json_path);
+    return 1;
+}
+
+// Stops the measurement once one fixture device is left.
+static int do_rmdir(MicroContext *ctx) {
+    char path[64];
+    if (ctx->removed + 1 >= ctx->devices) {
+        return -1;
+    }
+    ctx->removed++;
+    snprintf(path, sizeof(path), "/d%d", ctx->devices - ctx->removed);
+    return fuse_example_operations.rmdir(path) == 0;
+}
+
+// run returns 1 on success, 0 on an error, and -1 when there is nothing
+// left to measure; that call is not sampled.
+typedef struct {
+    const char *name;
+    int (*run)(MicroContext *ctx);
+} Measurement;
+
+// The mutating measurements run last so the read-only ones all see the
+// same fixture.
+static const Measurement measurements[] = {
+    {"getattr_dir", do_getattr_dir},
+    {"getattr_file", do_getattr_file},
+    {"getattr_virtual", do_getattr_virtual},
+    {"getattr_missing", do_getattr_missing},
+    {"readdir_root", do_readdir_root},
+    {"readdir_device", do_readdir_device},
+    {"read_gps", do_read_gps},
+    {"read_sensor", do_read_sensor},
+    {"sensor_tick", do_sensor_tick},
+    {"write_info", do_write_info},
+    {"json_save", do_save_json},
+    {"mkdir", do_mkdir},
+    {"create", do_create},
+    {"rmdir", do_rmdir},
+};
+
+#define MEASUREMENT_COUNT (sizeof(measurements) / sizeof(measurements[0]))
+
+static BenchResult *append_result(BenchResult **results, size_t *count, size_t *capacity) {
+    if (*count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 32;
+        *results = realloc(*results, *capacity * sizeof(BenchResult));
+    }
+    BenchResult *result = &(*results)[(*count)++];
+    memset(result, 0, sizeof(*result));
+    return result;
+}
+
+static char *result_name(const char *measurement, int entries) {
+    char *name = NULL;
+    if (asprintf(&name, "%s@%d", measurement, entries) < 0) {
+        return NULL;
+    }
+    return name;
+}
+
+static void run_size(const MicroConfig *config, int entries, LatencyRecorder *recorder,
+                     BenchResult **results, size_t *count, size_t *capacity) {
+    MicroContext ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.config = config;
+    bench_rng_seed(&ctx.rng, config->seed);
+
+    fuse_example_setup();
+    fuse_example_operations.init(NULL);
+
+    uint64_t start = bench_now_ns();
+    int import_result = import_fixture(entries, &ctx.devices);
+    uint64_t elapsed = bench_now_ns() - start;
+    BenchResult *fixture = append_result(results, count, capacity);
+    latency_reset(recorder);
+    latency_record(recorder, elapsed);
+    latency_summarize(recorder, elapsed / 1e9, fixture);
+    fixture->name = result_name("fixture_import", entries);
+    fixture->ops = entries;
+    fixture->ops_per_sec = elapsed ? entries / (elapsed / 1e9) : 0.0;
+    fixture->errors = import_result != 0;
+    bench_print_text(stderr, fixture);
+
+    for (size_t i = 0; i < MEASUREMENT_COUNT; i++) {
+        uint64_t errors = 0;
+        uint64_t deadline = bench_now_ns() + config->budget_ms * 1000000ULL;
+        latency_reset(recorder);
+        start = bench_now_ns();
+        for (uint64_t op = 0; op < config->ops; op++) {
+            uint64_t op_start = bench_now_ns();
+            int ok = measurements[i].run(&ctx);
+            uint64_t op_end = bench_now_ns();
+            if (ok < 0) {
+                break;
+            }
+            errors += !ok;
+            latency_record(recorder, op_end - op_start);
+            if (op_end >= deadline) {
+                break;
+            }
+        }
+        BenchResult *result = append_result(results, count, capacity);
+        latency_summarize(recorder, (bench_now_ns() - start) / 1e9, result);
+        result->name = result_name(measurements[i].name, entries);
+        result->errors = errors;
+        bench_print_text(stderr, result);
+    }
+
+    fuse_example_teardown();
+}
+
+static void usage(const char *program) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --sizes LIST       comma-separated entry counts (default 1000,10000,100000,1000000)\n"
+            "  --ops N            maximum samples per measurement (default 10000)\n"
+            "  --budget-ms N      maximum time per measurement (default 2000)\n"
+            "  --seed N           PRNG seed (default 1)\n"
+            "  --label TEXT       label stored in the JSON output, e.g. a commit id\n"
+            "  --output FILE      write JSON results to FILE (default: stdout)\n"
+            "  --debug-log        keep the debug log enabled\n",
+            program);
+}
+
+int main(int argc, char *argv[]) {
+    MicroConfig config = {NULL, NULL, "1000,10000,100000,1000000", 1, 10000, 2000, 0};
+    static struct option options[] = {
+        {"sizes", required_argument, NULL, 'z'},
+        {"ops", required_argument, NULL, 'n'},
+        {"budget-ms", required_argument, NULL, 'B'},
+        {"seed", required_argument, NULL, 'S'},
+        {"label", required_argument, NULL, 'l'},
+        {"output", required_argument, NULL, 'o'},
+        {"debug-log", no_argument, NULL, 'D'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    int option;
+    while ((option = getopt_long(argc, argv, "z:n:B:S:l:o:Dh", options, NULL)) != -1) {
+        switch (option) {
+            case 'z': config.sizes = optarg; break;
+            case 'n': config.ops = strtoull(optarg, NULL, 10); break;
+            case 'B': config.budget_ms = strtoull(optarg, NULL, 10); break;
+            case 'S': config.seed = strtoull(optarg, NULL, 10); break;
+            case 'l': config.label = optarg; break;
+            case 'o': config.output = optarg; break;
+            case 'D': config.debug_log = 1; break;
+            default: usage(argv[0]); return option == 'h' ? 0 : 2;
+        }
+    }
+
+    // The JSON file and logs go to a scratch directory for the whole run.
+    char scratch[] = "/tmp/fuse-microbench-XXXXXX";
+    if (mkdtemp(scratch) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    setenv("FUSE_EXAMPLE_DATA_DIR", scratch, 1);
+    setenv("FUSE_EXAMPLE_DEBUG_LOG", config.debug_log ? "1" : "0", 1);
+    setenv("FUSE_EXAMPLE_RESTORE", "0", 1);
+
+    BenchResult *results = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    LatencyRecorder recorder;
+    latency_init(&recorder);
+    for (const char *it = config.sizes; *it != '\0';) {
+        char *end;
+        long entries = strtol(it, &end, 10);
+        if (end == it || entries <= 0) {
+            usage(argv[0]);
+            return 2;
+        }
+        run_size(&config, (int)entries, &recorder, &results, &count, &capacity);
+        it = *end == ',' ? end + 1 : end;
+    }
+    latency_free(&recorder);
+
+    static const char *files[] = {"fuse_debug_log.txt", "important_log_file.txt", "json_test_example.json",
+                                  "ops_stats_dump.txt", "slow_ops_log.txt", "slow_ops_log.txt.1"};
+    char path[PATH_MAX];
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+        snprintf(path, sizeof(path), "%s/%s", scratch, files[i]);
+        unlink(path);
+    }
+    rmdir(scratch);
+
+    FILE *out = config.output ? fopen(config.output, "w") : stdout;
+    if (out == NULL) {
+        perror(config.output);
+        return 1;
+    }
+    bench_print_json(out, "fuse-microbench", config.label, config.seed, results, count);
+    if (out != stdout) {
+        fclose(out);
+    }
+    for (size_t i = 0; i < count; i++) {
+        free((char *)results[i].name);
+    }
+    free(results);
+    return 0;
+}
@@ -0,0 +1,485 @@
+// fuse-replay: replays a trace recorded with FUSE_EXAMPLE_TRACE, either
+// in-process through fuse_example_operations or through the system calls
+// of a mounted filesystem, and reports throughput and latency per operation.
+#define _GNU_SOURCE
+#include "bench_common.h"
+#include "fuse_example.h"
+#include "op_trace.h"
+#include "wave_ioctl.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_OPEN_HANDLES 1024
+
+// Returned for records the replay cannot reproduce, such as a read whose
+// open happened before the recording started. They are counted apart and
+// left out of the latency and mismatch figures.
+#define REPLAY_SKIPPED INT_MIN
+
+typedef struct {
+    const char *trace;
+    const char *mount_dir;      // NULL replays in-process
+    const char *label;
+    const char *output;
+    int original_speed;
+} ReplayConfig;
+
+// Replayed opens, matched to later reads, writes and releases by path.
+// Releases close the oldest open of a path, which matches sequential use.
+typedef struct {
+    char *path;
+    int fd;
+    struct fuse_file_info fi;
+} OpenHandle;
+
+typedef struct {
+    const ReplayConfig *config;
+    OpenHandle handles[MAX_OPEN_HANDLES];
+    size_t handle_count;
+    char *io_buffer;
+    size_t io_capacity;
+} ReplayState;
+
+static OpenHandle *find_handle(ReplayState *state, const char *path) {
+    for (size_t i = 0; i < state->handle_count; i++) {
+        if (strcmp(state->handles[i].path, path) == 0) {
+            return &state->handles[i];
+        }
+    }
+    return NULL;
+}
+
+static OpenHandle *push_handle(ReplayState *state, const char *path) {
+    if (state->handle_count == MAX_OPEN_HANDLES) {
+        return NULL;
+    }
+    OpenHandle *handle = &state->handles[state->handle_count++];
+    memset(handle, 0, sizeof(*handle));
+    handle->path = strdup(path);
+    handle->fd = -1;
+    return handle;
+}
+
+static void drop_handle(ReplayState *state, OpenHandle *handle) {
+    free(handle->path);
+    size_t index = handle - state->handles;
+    memmove(&state->handles[index], &state->handles[index + 1],
+            (state->handle_count - index - 1) * sizeof(OpenHandle));
+    state->handle_count--;
+}
+
+static char *io_buffer(ReplayState *state, size_t size) {
+    if (size > state->io_capacity) {
+        free(state->io_buffer);
+        state->io_buffer = malloc(size);
+        state->io_capacity = state->io_buffer != NULL ? size : 0;
+    }
+    return state->io_buffer;
+}
+
+// The trace keeps the ioctl command but not its argument. A sweep can be
+// replayed from the start of the registry; a lookup cannot, since the
+// records it looked up are gone.
+static char *ioctl_argument(ReplayState *state, uint32_t cmd) {
+    if (cmd != WAVE_IOC_SWEEP) {
+        return NULL;
+    }
+    char *buffer = io_buffer(state, _IOC_SIZE(cmd));
+    if (buffer != NULL) {
+        memset(buffer, 0, _IOC_SIZE(cmd));
+    }
+    return buffer;
+}
+
+static int count_entry(void *buf, const char *name, const struct stat *st, off_t offset) {
+    (void)buf;
+    (void)name;
+    (void)st;
+    (void)offset;
+    return 0;
+}
+
+static int replay_in_process(ReplayState *state, const OpTraceRecord *record) {
+    const OpTraceRecordHeader *h = &record->header;
+    const char *path = record->path;
+    struct stat st;
+    OpenHandle *handle;
+    switch ((OpType)h->op) {
+        case OP_GETATTR:
+            return fuse_example_operations.getattr(path, &st);
+        case OP_READDIR:
+            return fuse_example_operations.readdir(path, NULL, count_entry, h->offset, NULL);
+        case OP_OPEN:
+        case OP_CREATE: {
+            handle = push_handle(state, path);
+            if (handle == NULL) {
+                return -EMFILE;
+            }
+            handle->fi.flags = h->op == OP_OPEN ? (int)h->mode : O_CREAT | O_WRONLY;
+            int result = h->op == OP_OPEN ? fuse_example_operations.open(path, &handle->fi)
+                                          : fuse_example_operations.create(path, h->mode, &handle->fi);
+            if (result != 0) {
+                drop_handle(state, handle);
+            }
+            return result;
+        }
+        case OP_READ: {
+            // Special files keep their state behind fi->fh, so a read
+            // without its open cannot be replayed.
+            handle = find_handle(state, path);
+            if (handle == NULL) {
+                return REPLAY_SKIPPED;
+            }
+            char *buffer = io_buffer(state, h->size);
+            if (buffer == NULL) {
+                return -ENOMEM;
+            }
+            return fuse_example_operations.read(path, buffer, h->size, h->offset, &handle->fi);
+        }
+        case OP_WRITE:
+            handle = find_handle(state, path);
+            if (handle == NULL) {
+                return REPLAY_SKIPPED;
+            }
+            return fuse_example_operations.write(path, record->payload, h->payload_length, h->offset, &handle->fi);
+        case OP_RELEASE: {
+            handle = find_handle(state, path);
+            if (handle == NULL) {
+                return 0;
+            }
+            int result = fuse_example_operations.release(path, &handle->fi);
+            drop_handle(state, handle);
+            return result;
+        }
+        case OP_TRUNCATE:
+            return fuse_example_operations.truncate(path, h->offset);
+        case OP_MKDIR:
+            return fuse_example_operations.mkdir(path, h->mode);
+        case OP_UTIMENS:
+            return fuse_example_operations.utimens(path, NULL);
+        case OP_RMDIR:
+            return fuse_example_operations.rmdir(path);
+        case OP_UNLINK:
+            return fuse_example_operations.unlink(path);
+        case OP_GETXATTR:
+        case OP_LISTXATTR: {
+            char *buffer = io_buffer(state, h->size);
+            if (buffer == NULL && h->size > 0) {
+                return -ENOMEM;
+            }
+            return h->op == OP_GETXATTR ? fuse_example_operations.getxattr(path, record->payload, buffer, h->size)
+                                        : fuse_example_operations.listxattr(path, buffer, h->size);
+        }
+        case OP_FLUSH:
+            handle = find_handle(state, path);
+            return handle != NULL ? fuse_example_operations.flush(path, &handle->fi) : REPLAY_SKIPPED;
+        case OP_IOCTL: {
+            handle = find_handle(state, path);
+            char *argument = ioctl_argument(state, h->mode);
+            if (handle == NULL || argument == NULL) {
+                return REPLAY_SKIPPED;
+            }
+            return fuse_example_operations.ioctl(path, (int)h->mode, NULL, &handle->fi, 0, argument);
+        }
+        case OP_POLL: {
+            // Without a kernel there is no poll handle to arm, so only the
+            // readiness check is replayed.
+            handle = find_handle(state, path);
+            if (handle == NULL) {
+                return REPLAY_SKIPPED;
+            }
+            unsigned revents = 0;
+            return fuse_example_operations.poll(path, &handle->fi, NULL, &revents);
+        }
+        default:
+            // init runs once before the replay starts.
+            return REPLAY_SKIPPED;
+    }
+}
+
+static int errno_result(int ok) {
+    return ok ? 0 : -errno;
+}
+
+// The kernel adds its own lookups and getattrs around every system call,
+// so a mount replay exercises more operations than the trace holds.
+static int replay_mounted(ReplayState *state, const OpTraceRecord *record) {
+    const OpTraceRecordHeader *h = &record->header;
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s%s", state->config->mount_dir, record->path);
+    struct stat st;
+    OpenHandle *handle;
+    switch ((OpType)h->op) {
+        case OP_GETATTR:
+            return errno_result(lstat(path, &st) == 0);
+        case OP_READDIR: {
+            DIR *dir = opendir(path);
+            if (dir == NULL) {
+                return -errno;
+            }
+            while (readdir(dir) != NULL) {
+            }
+            closedir(dir);
+            return 0;
+        }
+        case OP_OPEN:
+        case OP_CREATE: {
+            int fd = h->op == OP_OPEN ? open(path, (int)h->mode & ~(O_CREAT | O_EXCL | O_TRUNC))
+                                      : open(path, O_CREAT | O_WRONLY, h->mode);
+            if (fd < 0) {
+                return -errno;
+            }
+            handle = push_handle(state, record->path);
+            if (handle == NULL) {
+                close(fd);
+                return -EMFILE;
+            }
+            handle->fd = fd;
+            return 0;
+        }
+        case OP_READ: {
+            handle = find_handle(state, record->path);
+            if (handle == NULL) {
+                return REPLAY_SKIPPED;
+            }
+            char *buffer = io_buffer(state, h->size);
+            if (buffer == NULL) {
+                return -ENOMEM;
+            }
+            ssize_t n = pread(handle->fd, buffer, h->size, h->offset);
+            return n < 0 ? -errno : (int)n;
+        }
+        case OP_WRITE: {
+            handle = find_handle(state, record->path);
+            if (handle == NULL) {
+                return REPLAY_SKIPPED;
+            }
+            ssize_t n = pwrite(handle->fd, record->payload, h->payload_length, h->offset);
+            return n < 0 ? -errno : (int)n;
+        }
+        case OP_RELEASE:
+            handle = find_handle(state, record->path);
+            if (handle != NULL) {
+                close(handle->fd);
+                drop_handle(state, handle);
+            }
+            return 0;
+        case OP_TRUNCATE:
+            return errno_result(truncate(path, h->offset) == 0);
+        case OP_MKDIR:
+            return errno_result(mkdir(path, h->mode) == 0);
+        case OP_UTIMENS:
+            return errno_result(utimensat(AT_FDCWD, path, NULL, 0) == 0);
+        case OP_RMDIR:
+            return errno_result(rmdir(path) == 0);
+        case OP_UNLINK:
+            return errno_result(unlink(path) == 0);
+        case OP_GETXATTR:
+        case OP_LISTXATTR: {
+            char *buffer = io_buffer(state, h->size);
+            if (buffer == NULL && h->size > 0) {
+                return -ENOMEM;
+            }
+            ssize_t n = h->op == OP_GETXATTR ? lgetxattr(path, record->payload, buffer, h->size)
+                                             : llistxattr(path, buffer, h->size);
+            return n < 0 ? -errno : (int)n;
+        }
+        case OP_IOCTL: {
+            handle = find_handle(state, record->path);
+            char *argument = ioctl_argument(state, h->mode);
+            if (handle == NULL || argument == NULL) {
+                return REPLAY_SKIPPED;
+            }
+            return errno_result(ioctl(handle->fd, h->mode, argument) >= 0);
+        }
+        case OP_POLL: {
+            handle = find_handle(state, record->path);
+            if (handle == NULL) {
+                return REPLAY_SKIPPED;
+            }
+            struct pollfd pfd = {handle->fd, POLLIN | POLLOUT, 0};
+            return errno_result(poll(&pfd, 1, 0) >= 0);
+        }
+        default:
+            // The kernel sends flush from close, which release replays, and
+            // init at mount time.
+            return REPLAY_SKIPPED;
+    }
+}
+
+static void sleep_until(uint64_t target_ns) {
+    uint64_t now = bench_now_ns();
+    if (target_ns > now) {
+        struct timespec delay = {(time_t)((target_ns - now) / 1000000000ULL), (long)((target_ns - now) % 1000000000ULL)};
+        nanosleep(&delay, NULL);
+    }
+}
+
+static void usage(const char *program) {
+    fprintf(stderr,
+            "usage: %s [options] TRACE\n"
+            "  --mount DIR        replay through system calls on a mounted filesystem\n"
+            "                     (default: in-process through fuse_example_operations)\n"
+            "  --speed MODE       original (keep the recorded timing) or max (default)\n"
+            "  --label TEXT       label stored in the JSON output, e.g. a commit id\n"
+            "  --output FILE      write JSON results to FILE (default: stdout)\n",
+            program);
+}
+
+int main(int argc, char *argv[]) {
+    ReplayConfig config = {NULL, NULL, NULL, NULL, 0};
+    static struct option options[] = {
+        {"mount", required_argument, NULL, 'm'},
+        {"speed", required_argument, NULL, 's'},
+        {"label", required_argument, NULL, 'l'},
+        {"output", required_argument, NULL, 'o'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    int option;
+    while ((option = getopt_long(argc, argv, "m:s:l:o:h", options, NULL)) != -1) {
+        switch (option) {
+            case 'm': config.mount_dir = optarg; break;
+            case 's': config.original_speed = strcmp(optarg, "original") == 0; break;
+            case 'l': config.label = optarg; break;
+            case 'o': config.output = optarg; break;
+            default: usage(argv[0]); return option == 'h' ? 0 : 2;
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 2;
+    }
+    config.trace = argv[optind];
+
+    OpTraceReader reader;
+    if (op_trace_reader_open(&reader, config.trace) != 0) {
+        fprintf(stderr, "fuse-replay: %s is not a trace\n", config.trace);
+        return 1;
+    }
+
+    char scratch[] = "/tmp/fuse-replay-XXXXXX";
+    if (config.mount_dir == NULL) {
+        if (mkdtemp(scratch) == NULL) {
+            perror("mkdtemp");
+            return 1;
+        }
+        setenv("FUSE_EXAMPLE_DATA_DIR", scratch, 1);
+        setenv("FUSE_EXAMPLE_DEBUG_LOG", "0", 0);
+        unsetenv("FUSE_EXAMPLE_TRACE");
+        fuse_example_setup();
+        fuse_example_operations.init(NULL);
+    }
+
+    ReplayState state;
+    memset(&state, 0, sizeof(state));
+    state.config = &config;
+    LatencyRecorder recorders[OP_COUNT + 1];
+    uint64_t mismatches[OP_COUNT + 1] = {0};
+    uint64_t busy_ns[OP_COUNT + 1] = {0};
+    uint64_t skipped[OP_COUNT + 1] = {0};
+    for (int i = 0; i <= OP_COUNT; i++) {
+        latency_init(&recorders[i]);
+    }
+
+    OpTraceRecord record;
+    int status;
+    int first = 1;
+    uint64_t first_timestamp = 0;
+    uint64_t replay_start = bench_now_ns();
+    while ((status = op_trace_reader_next(&reader, &record)) == 1) {
+        if (first) {
+            first_timestamp = record.header.timestamp_ns;
+            first = 0;
+        }
+        if (config.original_speed) {
+            sleep_until(replay_start + (record.header.timestamp_ns - first_timestamp));
+        }
+        uint64_t start = bench_now_ns();
+        int result = config.mount_dir ? replay_mounted(&state, &record) : replay_in_process(&state, &record);
+        uint64_t duration = bench_now_ns() - start;
+        int op = record.header.op;
+        if (result == REPLAY_SKIPPED) {
+            skipped[op]++;
+            skipped[OP_COUNT]++;
+            continue;
+        }
+        // A result that differs from the recorded one means the replay
+        // diverged, e.g. because the trace started on a non-empty filesystem.
+        int mismatch = result != record.header.result;
+        latency_record(&recorders[op], duration);
+        latency_record(&recorders[OP_COUNT], duration);
+        busy_ns[op] += duration;
+        mismatches[op] += mismatch;
+        mismatches[OP_COUNT] += mismatch;
+    }
+    double seconds = (bench_now_ns() - replay_start) / 1e9;
+    if (status < 0) {
+        fprintf(stderr, "fuse-replay: %s is truncated or corrupt, stopped early\n", config.trace);
+    }
+    op_trace_reader_close(&reader);
+
+    // "all" is throughput over the whole replay; per-operation rows report
+    // the rate while that operation was running.
+    BenchResult results[OP_COUNT + 1];
+    size_t count = 0;
+    for (int i = 0; i <= OP_COUNT; i++) {
+        if (recorders[i].count == 0) {
+            continue;
+        }
+        BenchResult *result = &results[count++];
+        latency_summarize(&recorders[i], i == OP_COUNT ? seconds : busy_ns[i] / 1e9, result);
+        result->name = i == OP_COUNT ? "all" : op_names[i];
+        result->errors = mismatches[i];
+        bench_print_text(stderr, result);
+        latency_free(&recorders[i]);
+    }
+    for (int i = 0; i < OP_COUNT; i++) {
+        if (skipped[i] > 0) {
+            fprintf(stderr, "%-24s %10llu records skipped, not replayable from the trace\n", op_names[i],
+                    (unsigned long long)skipped[i]);
+        }
+    }
+
+    for (size_t i = 0; i < state.handle_count; i++) {
+        if (state.handles[i].fd >= 0) {
+            close(state.handles[i].fd);
+        }
+        free(state.handles[i].path);
+    }
+    free(state.io_buffer);
+    if (config.mount_dir == NULL) {
+        fuse_example_teardown();
+        static const char *files[] = {"fuse_debug_log.txt", "important_log_file.txt", "json_test_example.json",
+                                      "ops_stats_dump.txt", "slow_ops_log.txt", "slow_ops_log.txt.1"};
+        char path[PATH_MAX];
+        for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+            snprintf(path, sizeof(path), "%s/%s", scratch, files[i]);
+            unlink(path);
+        }
+        rmdir(scratch);
+    }
+
+    FILE *out = config.output ? fopen(config.output, "w") : stdout;
+    if (out == NULL) {
+        perror(config.output);
+        return 1;
+    }
+    bench_print_json(out, "fuse-replay", config.label, 0, results, count);
+    if (out != stdout) {
+        fclose(out);
+    }
+    return status < 0;
+}
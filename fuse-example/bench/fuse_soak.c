@@ -0,0 +1,358 @@
+// fuse-soak: runs a balanced mixed workload in-process for millions of
+// operations, samples RSS, heap and accounted memory and latency
+// percentiles at fixed intervals, and fails when memory or p99 drift past
+// the configured bounds. The workload creates exactly what it removes, so a
+// healthy build stays flat.
+#define _GNU_SOURCE
+#include "bench_common.h"
+#include "fuse_example.h"
+#include "mem_stats.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SUB_DEVICES_PER_DEVICE 3
+
+typedef struct {
+    const char *label;
+    const char *output;
+    uint64_t seed;
+    uint64_t ops;
+    uint64_t interval;          // ops per sample
+    int devices;
+    int warmup_samples;         // samples ignored when computing the baseline
+    long long max_rss_growth_kb;
+    long long max_heap_growth_kb;
+    double max_p99_ratio;
+} SoakConfig;
+
+typedef struct {
+    uint64_t ops;
+    double seconds;
+    long long rss;
+    long long heap;
+    long long accounted;
+    double p50_us;
+    double p99_us;
+} SoakSample;
+
+typedef struct {
+    BenchRng rng;
+    int devices;
+    uint64_t scratch_counter;
+} SoakContext;
+
+static int count_entry(void *buf, const char *name, const struct stat *st, off_t offset) {
+    (void)buf;
+    (void)name;
+    (void)st;
+    (void)offset;
+    return 0;
+}
+
+static long long resident_set_bytes(void) {
+    long long pages = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm != NULL) {
+        if (fscanf(statm, "%*s %lld", &pages) != 1) {
+            pages = 0;
+        }
+        fclose(statm);
+    }
+    return pages * sysconf(_SC_PAGESIZE);
+}
+
+static void sub_device_path(int device, int sub, char *out, size_t size) {
+    bench_sub_device_path(out, size, "", device, sub);
+}
+
+static int read_whole(const char *path) {
+    char buffer[4096];
+    struct fuse_file_info fi;
+    memset(&fi, 0, sizeof(fi));
+    fi.flags = O_RDONLY;
+    if (fuse_example_operations.open(path, &fi) != 0) {
+        return 0;
+    }
+    int result = fuse_example_operations.read(path, buffer, sizeof(buffer), 0, &fi);
+    fuse_example_operations.release(path, &fi);
+    return result >= 0;
+}
+
+static int write_string(const char *path, const char *data) {
+    struct fuse_file_info fi;
+    memset(&fi, 0, sizeof(fi));
+    fi.flags = O_WRONLY;
+    if (fuse_example_operations.open(path, &fi) != 0) {
+        return 0;
+    }
+    int result = fuse_example_operations.write(path, data, strlen(data), 0, &fi);
+    fuse_example_operations.release(path, &fi);
+    return result == (int)strlen(data);
+}
+
+// One operation of the mix; returns 1 on the expected outcome. Anything
+// that rewrites the JSON file costs milliseconds, so those stay at a few
+// per thousand to keep a multi-million run within minutes.
+static int soak_step(SoakContext *ctx) {
+    static const char *virtual_files[] = {"IMEI", "GPS", "GYRO"};
+    char path[PATH_MAX];
+    char other[PATH_MAX];
+    struct stat st;
+    int device = (int)bench_rng_below(&ctx->rng, ctx->devices);
+    int sub = (int)bench_rng_below(&ctx->rng, SUB_DEVICES_PER_DEVICE);
+    uint64_t pick = bench_rng_below(&ctx->rng, 1000);
+
+    if (pick < 200) {
+        snprintf(path, sizeof(path), "/d%d", device);
+        return fuse_example_operations.getattr(path, &st) == 0;
+    }
+    if (pick < 350) {
+        sub_device_path(device, sub, path, sizeof(path));
+        return fuse_example_operations.getattr(path, &st) == 0;
+    }
+    if (pick < 400) {
+        snprintf(path, sizeof(path), "/d%d/missing.SENSOR.1", device);
+        return fuse_example_operations.getattr(path, &st) == -ENOENT;
+    }
+    if (pick < 520) {
+        snprintf(path, sizeof(path), "/d%d", device);
+        return fuse_example_operations.readdir(path, NULL, count_entry, 0, NULL) == 0;
+    }
+    if (pick < 620) {
+        snprintf(path, sizeof(path), "/d%d/%s", device, virtual_files[bench_rng_below(&ctx->rng, 3)]);
+        return read_whole(path);
+    }
+    if (pick < 700) {
+        sub_device_path(device, bench_rng_below(&ctx->rng, 2) ? 0 : 2, path, sizeof(path));
+        return read_whole(path);
+    }
+    if (pick < 780) {
+        sub_device_path(device, 1, path, sizeof(path));
+        return write_string(path, "set 42\n");
+    }
+    if (pick < 840) {
+        sub_device_path(device, 2, path, sizeof(path));
+        return write_string(path, "data\n");
+    }
+    if (pick < 890) {
+        // utimens sees the path touch(1) was given, serial included.
+        sub_device_path(device, sub, other, sizeof(other));
+        snprintf(path, sizeof(path), "%s.%d", other, 100 + sub);
+        return fuse_example_operations.utimens(path, NULL) == 0;
+    }
+    if (pick < 940) {
+        return read_whole(bench_rng_below(&ctx->rng, 2) ? "/.stats/fleet" : "/.stats/memory");
+    }
+    if (pick < 996) {
+        sub_device_path(device, 2, path, sizeof(path));
+        return fuse_example_operations.truncate(path, (off_t)bench_rng_below(&ctx->rng, 64)) == 0;
+    }
+    if (pick < 998) {
+        uint64_t id = ctx->scratch_counter++;
+        struct fuse_file_info fi;
+        memset(&fi, 0, sizeof(fi));
+        snprintf(path, sizeof(path), "/d%d/t%llu.SENSOR.1", device, (unsigned long long)id);
+        snprintf(other, sizeof(other), "/d%d/t%llu.SENSOR", device, (unsigned long long)id);
+        return fuse_example_operations.create(path, 0644, &fi) == 0 && fuse_example_operations.unlink(other) == 0;
+    }
+    if (pick < 999) {
+        uint64_t id = ctx->scratch_counter++;
+        snprintf(path, sizeof(path), "/m%llu.%llu.2000000", (unsigned long long)id, (unsigned long long)id);
+        snprintf(other, sizeof(other), "/m%llu", (unsigned long long)id);
+        return fuse_example_operations.mkdir(path, 0755) == 0 && fuse_example_operations.rmdir(other) == 0;
+    }
+    sub_device_path(device, 2, path, sizeof(path));
+    return write_string(path, "info\n");
+}
+
+static double average(const SoakSample *samples, size_t from, size_t to, size_t field_offset) {
+    double sum = 0;
+    for (size_t i = from; i < to; i++) {
+        const char *base = (const char *)&samples[i] + field_offset;
+        sum += field_offset == offsetof(SoakSample, p99_us) ? *(const double *)base : (double)*(const long long *)base;
+    }
+    return to > from ? sum / (to - from) : 0.0;
+}
+
+static void usage(const char *program) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --ops N                 total operations (default 5000000)\n"
+            "  --interval N            operations per sample (default 250000)\n"
+            "  --devices N             devices in the fixture, 3 sub-devices each (default 200)\n"
+            "  --warmup N              samples skipped before the baseline (default 2)\n"
+            "  --max-rss-growth-kb N   allowed RSS growth (default 2048)\n"
+            "  --max-heap-growth-kb N  allowed heap growth (default 512)\n"
+            "  --max-p99-ratio X       allowed p99 growth factor (default 2.0)\n"
+            "  --seed N                PRNG seed (default 1)\n"
+            "  --label TEXT            label stored in the JSON output, e.g. a commit id\n"
+            "  --output FILE           write JSON results to FILE (default: stdout)\n",
+            program);
+}
+
+int main(int argc, char *argv[]) {
+    SoakConfig config = {NULL, NULL, 1, 5000000, 250000, 200, 2, 2048, 512, 2.0};
+    static struct option options[] = {
+        {"ops", required_argument, NULL, 'n'},
+        {"interval", required_argument, NULL, 'i'},
+        {"devices", required_argument, NULL, 'd'},
+        {"warmup", required_argument, NULL, 'w'},
+        {"max-rss-growth-kb", required_argument, NULL, 'R'},
+        {"max-heap-growth-kb", required_argument, NULL, 'H'},
+        {"max-p99-ratio", required_argument, NULL, 'P'},
+        {"seed", required_argument, NULL, 'S'},
+        {"label", required_argument, NULL, 'l'},
+        {"output", required_argument, NULL, 'o'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    int option;
+    while ((option = getopt_long(argc, argv, "n:i:d:w:R:H:P:S:l:o:h", options, NULL)) != -1) {
+        switch (option) {
+            case 'n': config.ops = strtoull(optarg, NULL, 10); break;
+            case 'i': config.interval = strtoull(optarg, NULL, 10); break;
+            case 'd': config.devices = atoi(optarg); break;
+            case 'w': config.warmup_samples = atoi(optarg); break;
+            case 'R': config.max_rss_growth_kb = atoll(optarg); break;
+            case 'H': config.max_heap_growth_kb = atoll(optarg); break;
+            case 'P': config.max_p99_ratio = atof(optarg); break;
+            case 'S': config.seed = strtoull(optarg, NULL, 10); break;
+            case 'l': config.label = optarg; break;
+            case 'o': config.output = optarg; break;
+            default: usage(argv[0]); return option == 'h' ? 0 : 2;
+        }
+    }
+    if (config.devices <= 0 || config.interval == 0 || config.ops < config.interval) {
+        usage(argv[0]);
+        return 2;
+    }
+    size_t sample_capacity = config.ops / config.interval;
+    if ((size_t)config.warmup_samples + 2 > sample_capacity) {
+        fprintf(stderr, "fuse-soak: need at least %d samples, raise --ops or lower --interval\n",
+                config.warmup_samples + 2);
+        return 2;
+    }
+
+    char scratch[] = "/tmp/fuse-soak-XXXXXX";
+    if (mkdtemp(scratch) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    setenv("FUSE_EXAMPLE_DATA_DIR", scratch, 1);
+    setenv("FUSE_EXAMPLE_DEBUG_LOG", "0", 0);
+    unsetenv("FUSE_EXAMPLE_TRACE");
+    fuse_example_setup();
+    fuse_example_operations.init(NULL);
+
+    SoakContext ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.devices = config.devices;
+    bench_rng_seed(&ctx.rng, config.seed);
+    if (bench_import_fixture(&fuse_example_operations, config.devices, SUB_DEVICES_PER_DEVICE) != 0) {
+        fprintf(stderr, "fuse-soak: fixture import failed\n");
+        return 1;
+    }
+
+    SoakSample *samples = calloc(sample_capacity, sizeof(SoakSample));
+    LatencyRecorder recorder;
+    latency_init(&recorder);
+    uint64_t errors = 0;
+    size_t sample_count = 0;
+    uint64_t start = bench_now_ns();
+    for (uint64_t op = 1; op <= config.ops && sample_count < sample_capacity; op++) {
+        uint64_t op_start = bench_now_ns();
+        errors += !soak_step(&ctx);
+        latency_record(&recorder, bench_now_ns() - op_start);
+        if (op % config.interval == 0) {
+            BenchResult window;
+            latency_summarize(&recorder, 0, &window);
+            SoakSample *sample = &samples[sample_count++];
+            sample->ops = op;
+            sample->seconds = (bench_now_ns() - start) / 1e9;
+            sample->rss = resident_set_bytes();
+            sample->heap = mem_heap_in_use();
+            sample->accounted = mem_total_live();
+            sample->p50_us = window.p50_us;
+            sample->p99_us = window.p99_us;
+            latency_reset(&recorder);
+            fprintf(stderr, "%12llu ops %9.1f s  rss %10lld  heap %10lld  accounted %10lld  p50 %8.1f us  p99 %8.1f us\n",
+                    (unsigned long long)sample->ops, sample->seconds, sample->rss, sample->heap, sample->accounted,
+                    sample->p50_us, sample->p99_us);
+        }
+    }
+    latency_free(&recorder);
+    fuse_example_teardown();
+
+    // Baseline: the samples right after warmup. Compared against the last
+    // quarter of the run, so a slow steady climb is caught but a single
+    // noisy sample is not.
+    size_t baseline_from = config.warmup_samples;
+    size_t baseline_to = baseline_from + (sample_count - baseline_from) / 4;
+    if (baseline_to == baseline_from) {
+        baseline_to++;
+    }
+    size_t tail_from = sample_count - (sample_count - baseline_from) / 4;
+    if (tail_from >= sample_count) {
+        tail_from = sample_count - 1;
+    }
+    double rss_growth_kb = (average(samples, tail_from, sample_count, offsetof(SoakSample, rss)) -
+                            average(samples, baseline_from, baseline_to, offsetof(SoakSample, rss))) / 1024;
+    double heap_growth_kb = (average(samples, tail_from, sample_count, offsetof(SoakSample, heap)) -
+                             average(samples, baseline_from, baseline_to, offsetof(SoakSample, heap))) / 1024;
+    double baseline_p99 = average(samples, baseline_from, baseline_to, offsetof(SoakSample, p99_us));
+    double p99_ratio = baseline_p99 > 0 ? average(samples, tail_from, sample_count, offsetof(SoakSample, p99_us)) / baseline_p99 : 1.0;
+
+    int failed = 0;
+    if (rss_growth_kb > config.max_rss_growth_kb) {
+        fprintf(stderr, "fuse-soak: FAIL rss grew %.0f KB (limit %lld KB)\n", rss_growth_kb, config.max_rss_growth_kb);
+        failed = 1;
+    }
+    if (heap_growth_kb > config.max_heap_growth_kb) {
+        fprintf(stderr, "fuse-soak: FAIL heap grew %.0f KB (limit %lld KB)\n", heap_growth_kb, config.max_heap_growth_kb);
+        failed = 1;
+    }
+    if (p99_ratio > config.max_p99_ratio) {
+        fprintf(stderr, "fuse-soak: FAIL p99 grew %.2fx (limit %.2fx)\n", p99_ratio, config.max_p99_ratio);
+        failed = 1;
+    }
+    if (!failed) {
+        fprintf(stderr, "fuse-soak: PASS rss %+.0f KB, heap %+.0f KB, p99 %.2fx, %llu unexpected results\n",
+                rss_growth_kb, heap_growth_kb, p99_ratio, (unsigned long long)errors);
+    }
+
+    FILE *out = config.output ? fopen(config.output, "w") : stdout;
+    if (out != NULL) {
+        fprintf(out, "{\"tool\":\"fuse-soak\",\"label\":\"%s\",\"seed\":%llu,\"ops\":%llu,\"errors\":%llu,"
+                     "\"rss_growth_kb\":%.1f,\"heap_growth_kb\":%.1f,\"p99_ratio\":%.3f,\"passed\":%s,\"samples\":[",
+                config.label ? config.label : "", (unsigned long long)config.seed, (unsigned long long)config.ops,
+                (unsigned long long)errors, rss_growth_kb, heap_growth_kb, p99_ratio, failed ? "false" : "true");
+        for (size_t i = 0; i < sample_count; i++) {
+            fprintf(out, "%s{\"ops\":%llu,\"seconds\":%.3f,\"rss\":%lld,\"heap\":%lld,\"accounted\":%lld,"
+                         "\"p50_us\":%.2f,\"p99_us\":%.2f}",
+                    i ? "," : "", (unsigned long long)samples[i].ops, samples[i].seconds, samples[i].rss,
+                    samples[i].heap, samples[i].accounted, samples[i].p50_us, samples[i].p99_us);
+        }
+        fprintf(out, "]}\n");
+        if (out != stdout) {
+            fclose(out);
+        }
+    }
+    free(samples);
+
+    static const char *files[] = {"fuse_debug_log.txt", "important_log_file.txt", "json_test_example.json",
+                                  "ops_stats_dump.txt", "slow_ops_log.txt", "slow_ops_log.txt.1"};
+    char path[PATH_MAX];
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+        snprintf(path, sizeof(path), "%s/%s", scratch, files[i]);
+        unlink(path);
+    }
+    rmdir(scratch);
+    return failed;
+}
@@ -0,0 +1,49 @@
+#ifndef ACTUATOR_QUEUE_H
+#define ACTUATOR_QUEUE_H
+#include <stddef.h>
+
+// Commands written to ACTUATOR files, handed to simulated devices. Each
+// actuator handle has a bounded queue that many writers fill without taking
+// a lock; worker threads take queues with pending commands round-robin and
+// apply one command per service slot, sleeping 1/rate seconds for each to
+// model the device. A full queue makes a non-blocking writer fail with
+// EAGAIN and a blocking one wait for room.
+//
+// With rate 0 (or before actuator_queue_start) commands are applied
+// directly by the writer.
+
+// Applies a command: label is the name given at submit time.
+typedef void (*ActuatorHandler)(int handle, const char *label, const char *command, size_t length);
+
+typedef struct {
+    unsigned int rate;          // commands per second per worker, 0 when applied directly
+    unsigned int workers;
+    unsigned int depth;         // commands per actuator queue
+    long long queued;           // accepted but not yet applied or dropped
+    long long accepted;
+    long long applied;
+    long long rejected;         // EAGAIN for non-blocking writers
+    long long blocked;          // writes that had to wait for room
+    long long dropped;          // discarded because the device was removed
+} ActuatorQueueStats;
+
+void actuator_queue_set_handler(ActuatorHandler handler);
+
+// Starts the workers; rate 0 leaves commands applied directly. depth is
+// rounded up to a power of two.
+int actuator_queue_start(unsigned int rate, unsigned int workers, unsigned int depth);
+void actuator_queue_stop(void);
+void actuator_queue_free(void);
+
+// Queues a command for handle. Returns 0, -EAGAIN when the queue is full
+// and nonblocking is set, -ENOMEM, or -EIO when the workers stop while the
+// writer waits.
+int actuator_queue_submit(int handle, const char *label, const char *command, size_t length, int nonblocking);
+
+// Drops the commands still queued for handle; called when the device goes
+// away so a reused handle does not inherit them.
+void actuator_queue_reset(int handle);
+
+void actuator_queue_stats(ActuatorQueueStats *stats);
+
+#endif // ACTUATOR_QUEUE_H
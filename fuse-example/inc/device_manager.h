@@ -3,11 +3,14 @@
 #define MAX_NAME_LENGTH 50
 #define MAX_MODEL_LENGTH 20
 #define INITIAL_CAPACITY 10
+#define DEVICE_CHUNK_SIZE 1024
+#define MAX_DEVICE_CHUNKS 4096
 #include <stdlib.h>
 #include <stdio.h>
 #include<json-c/json.h>
 #include <string.h>
 #include <time.h>
+#include <stdint.h>
 
 // Enum for entry type
 typedef enum {
@@ -24,22 +27,79 @@ typedef struct {
     char system_id[8];
     char imei[8];
     EntryType type;
+    int handle;         // stable index into the registry, never changes while in use
+    int parent_handle;  // handle of the parent device, -1 for top-level devices
+    int in_use;
+    int next_free;      // next handle on the free list when not in use
+    int next_in_bucket; // next handle in the same name index bucket
+    long long own_bytes;   // size of the file, or of the IMEI/GPS/GYRO files of a folder
+    long long total_bytes; // folders: own_bytes plus own_bytes of all children
+    int child_count;       // folders: number of sub-devices
+    int first_child;       // folders: a sub-device, -1 when there are none
+    int next_sibling;      // sub-devices: the other sub-devices of the same
+    int prev_sibling;      // folder, -1 at either end of the list
+    long list_position;    // position in the FUSE layer's file or directory list
+    uint64_t inode;        // persistent node number, kept in the JSON snapshot
 } DeviceEntry;
 
-#define MAX_DEVICES 100
-extern DeviceEntry* device_storage;
+// Fleet aggregates, kept up to date on every registry mutation.
+typedef struct {
+    int top_level_devices;
+    int sub_devices;
+    long long total_bytes;
+} FleetStats;
+
+typedef struct {
+    char model[MAX_MODEL_LENGTH];
+    int count;
+} ModelCount;
+
+extern FleetStats fleet_stats;
+
+#define DEVICE_FILTER_ANY_PARENT (-2)
+
+// Conditions a query applies to the registry; all of them must hold.
+// Ranges are inclusive.
+typedef struct {
+    char model_prefix[MAX_MODEL_LENGTH];   // "" matches every model
+    long long serial_min, serial_max;
+    long long registered_min, registered_max;
+    int parent_handle;                     // DEVICE_FILTER_ANY_PARENT, -1 for top-level devices
+} DeviceFilter;
+
+// The registry keeps entries in fixed-size chunks that are never moved,
+// so a DeviceEntry* stays valid until its handle is removed.
+extern DeviceEntry* device_chunks[MAX_DEVICE_CHUNKS];
 extern int device_count;
 extern int device_capacity;
 
 // Function prototypes
 void log_debug(const char *message);
 void count_dots(const char* path , int* return_result);
-void ensure_device_capacity();
+int ensure_device_capacity();
 DeviceEntry *create_and_add_device_entry(const char *name, const char *model, 
                                  int serial_number, time_t registration_date, 
-                                 char* imei, EntryType type);
+                                 char* imei, EntryType type, int parent_handle);
+DeviceEntry *get_device_entry(int handle);
+int find_device_handle(const char *name, const char *model, int parent_handle);
+void remove_device_entry(int handle);
+void set_device_bytes(int handle, long long bytes);
+const ModelCount *get_model_counts(int *count);
+void device_filter_init(DeviceFilter *filter);
+int device_scan(const DeviceFilter *filter, int *next_handle, int *handles, int max_handles);
+void free_device_registry();
+// qsort/bsearch order for arrays of handles.
+int compare_handles(const void *a, const void *b);
+// Makes new entries take inode numbers from next on, if that is higher.
+void device_reserve_inodes(uint64_t next);
+// Puts back what a snapshot recorded for entry: its inode (0 keeps the one
+// it was given), registration date and system id.
+void restore_device_entry(DeviceEntry *entry, uint64_t inode, time_t registration_date, const char *system_id);
 void add_to_parent(struct json_object *current, const char *parent_name, struct json_object *device_json);
 int is_valid_model(const char *model, EntryType type);
 void add_device_to_json(DeviceEntry *device, const char *json_path, const char *parent_name);
+void remove_device_from_json(const char *device_name, const char *json_path);
+void remove_folders_from_json(const int *handles, int count, const char *json_path);
+void save_registry_to_json(const char *json_path);
 
 #endif // DEVICE_MANAGER_H
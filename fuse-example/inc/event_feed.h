@@ -0,0 +1,58 @@
+#ifndef EVENT_FEED_H
+#define EVENT_FEED_H
+#include <stddef.h>
+#include <stdint.h>
+
+// Append-only feed of changes to the device tree. Every event gets the next
+// sequence number, starting at 1, and is kept in a fixed-size ring, so only
+// the most recent events can be read back. Each event reads as one line:
+//
+//   <seq> <unix-seconds> <op> <path>[ <size>]
+//
+// where op is mkdir, create, unlink, rmdir, write or truncate and size, the
+// file size after the change, follows write and truncate. A reader that
+// falls behind the ring gets
+//
+//   <seq> <unix-seconds> overflow <count>
+//
+// for the count events starting at seq that it missed, and then continues
+// with the oldest event still kept.
+typedef enum {
+    EVENT_MKDIR,
+    EVENT_CREATE,
+    EVENT_UNLINK,
+    EVENT_RMDIR,
+    EVENT_WRITE,
+    EVENT_TRUNCATE
+} EventOp;
+
+typedef struct EventCursor EventCursor;
+
+// Called after every append with the sequence number of the event.
+typedef void (*EventListener)(uint64_t seq);
+
+// Sizes the ring; capacity 0 turns the feed off. Drops the events kept so
+// far but not the sequence numbering.
+int event_feed_configure(size_t capacity);
+void event_feed_set_listener(EventListener listener);
+void event_feed_free(void);
+
+void event_feed_append(EventOp op, const char *path, long long size);
+
+// Sequence number the next event will get.
+uint64_t event_feed_next_seq(void);
+
+// Opens a reader at from_seq; 0 starts at the oldest event kept.
+EventCursor *event_feed_open(uint64_t from_seq);
+
+// Copies whole or partial lines up to size bytes and returns the number
+// copied, 0 once the reader has caught up. The reader continues from there
+// on the next call, so reads are sequential whatever the file offset.
+size_t event_feed_read(EventCursor *cursor, char *buf, size_t size);
+
+// Whether events past the reader's position exist.
+int event_feed_pending(const EventCursor *cursor);
+
+void event_feed_close(EventCursor *cursor);
+
+#endif // EVENT_FEED_H
@@ -0,0 +1,42 @@
+#ifndef FLEET_EXPORT_H
+#define FLEET_EXPORT_H
+#include <stddef.h>
+#include <sys/types.h>
+#include "device_manager.h"
+
+// Fleet-wide listings generated on demand, one record at a time in handle
+// order. A cursor holds the position of one open file and a single record,
+// so memory stays constant however large the fleet is. Sequential reads
+// continue where the previous one stopped; a read at an earlier offset
+// restarts from the beginning and skips forward. Devices added or removed
+// while a listing is being read may or may not appear in it.
+typedef enum {
+    FLEET_EXPORT_CSV,
+    FLEET_EXPORT_NDJSON
+} FleetExportFormat;
+
+typedef struct FleetExportCursor FleetExportCursor;
+
+// filter may be NULL to list every device.
+FleetExportCursor *fleet_export_open(FleetExportFormat format, const DeviceFilter *filter);
+
+// Copies up to size bytes of the listing starting at offset; returns the
+// number of bytes copied, 0 at the end.
+size_t fleet_export_read(FleetExportCursor *cursor, char *buf, size_t size, off_t offset);
+
+void fleet_export_close(FleetExportCursor *cursor);
+
+// Parses a query: whitespace-separated terms that must all match.
+//   model=PREFIX             model starts with PREFIX
+//   serial=LO..HI            serial number range; either end may be left out,
+//   registered=LO..HI        and a single value matches exactly; dates are
+//                            Unix seconds
+//   parent=NAME | parent=/   sub-devices of NAME, or top-level devices only
+//   format=csv | ndjson      output format, csv by default
+// The parent is resolved when the query is parsed, so callers that keep a
+// query parse it again for each scan. Returns 0, or -EINVAL with a message
+// in error.
+int fleet_query_parse(const char *text, DeviceFilter *filter, FleetExportFormat *format,
+                      char *error, size_t error_size);
+
+#endif // FLEET_EXPORT_H
@@ -0,0 +1,25 @@
+#ifndef FUSE_EXAMPLE_H
+#define FUSE_EXAMPLE_H
+
+#ifndef FUSE_USE_VERSION
+#define FUSE_USE_VERSION 29
+#endif
+#include <fuse.h>
+
+// The operation table and lifecycle of the filesystem. The daemon passes
+// the table to fuse_main; the in-process benchmarks call it directly.
+extern struct fuse_operations fuse_example_operations;
+extern const char *json_path;
+
+// Applies the FUSE_EXAMPLE_* environment overrides, starts recording a
+// trace when FUSE_EXAMPLE_TRACE names a file, and creates the empty file
+// and directory lists. Call before the first operation. The init operation
+// then restores the registry from the JSON file unless FUSE_EXAMPLE_RESTORE=0.
+void fuse_example_setup(void);
+
+// Closes the trace and frees the lists, the device registry and the control
+// file results, so fuse_example_setup can start over with an empty
+// filesystem.
+void fuse_example_teardown(void);
+
+#endif // FUSE_EXAMPLE_H
@@ -0,0 +1,45 @@
+#ifndef MEM_STATS_H
+#define MEM_STATS_H
+#include <stddef.h>
+
+// Live and peak bytes per subsystem. Owners report their own allocations
+// as deltas, so the numbers cover what the filesystem holds, not allocator
+// overhead; /.stats/memory shows them next to the heap and RSS totals.
+typedef enum {
+    MEM_FILE_DATA,      // File structs, names and data buffers
+    MEM_LISTS,          // FileList/DirList arrays and directory paths
+    MEM_REGISTRY,       // device chunks, name index, model counts
+    MEM_BUFFERS,        // control file and stats buffers, trace buffer
+    MEM_METRICS,        // per-thread op metrics blocks
+    MEM_JSON,           // json-c trees while persisting (transient)
+    MEM_SENSORS,        // simulated sensor values and versions
+    MEM_CATEGORY_COUNT
+} MemCategory;
+
+extern const char *mem_category_names[MEM_CATEGORY_COUNT];
+
+void mem_account(MemCategory category, long long delta);
+long long mem_live(MemCategory category);
+long long mem_peak(MemCategory category);
+long long mem_total_live(void);
+long long mem_total_peak(void);
+
+// Heap bytes in use according to the allocator.
+long long mem_heap_in_use(void);
+
+// json-c has no allocator hooks, so JSON usage is measured as the growth of
+// the heap between mem_json_begin and mem_json_sample, taken while the tree
+// is alive. Only the peak is kept. Samples outside a begin/end pair are
+// ignored.
+void mem_json_begin(void);
+void mem_json_sample(void);
+void mem_json_end(void);
+
+// Soft cap on mem_total_live; 0 turns it off. New devices are refused while
+// the total is at or above the cap.
+void mem_set_soft_cap(long long bytes);
+long long mem_soft_cap(void);
+int mem_over_soft_cap(void);
+long long mem_refused_count(void);
+
+#endif // MEM_STATS_H
@@ -0,0 +1,45 @@
+#ifndef OP_METRICS_H
+#define OP_METRICS_H
+#include <stdint.h>
+#include <stddef.h>
+
+// Operations that are metered, one per callback in fuse_example_operations.
+typedef enum {
+    OP_GETATTR,
+    OP_READDIR,
+    OP_OPEN,
+    OP_READ,
+    OP_WRITE,
+    OP_CREATE,
+    OP_MKDIR,
+    OP_UNLINK,
+    OP_RMDIR,
+    OP_TRUNCATE,
+    OP_UTIMENS,
+    OP_RELEASE,
+    OP_GETXATTR,
+    OP_LISTXATTR,
+    OP_IOCTL,
+    OP_POLL,
+    OP_INIT,
+    OP_FLUSH,
+    OP_COUNT
+} OpType;
+
+extern const char *op_names[OP_COUNT];
+
+// Monotonic clock in nanoseconds.
+uint64_t op_clock_ns(void);
+
+// Records one call. Each thread writes only its own counters, so this takes
+// no lock; readers sum over all threads.
+void op_metrics_record(OpType op, uint64_t duration_ns, int result);
+
+// Returns a malloc'd text table (json = 0) or JSON document (json = 1)
+// with counts and p50/p99/p999 latencies, and stores its length.
+char *op_metrics_render(int json, size_t *length);
+
+// Dumps the text table to dump_path whenever the process receives SIGUSR1.
+int op_metrics_install_dump_signal(const char *dump_path);
+
+#endif // OP_METRICS_H
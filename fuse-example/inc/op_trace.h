@@ -0,0 +1,64 @@
+#ifndef OP_TRACE_H
+#define OP_TRACE_H
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "op_metrics.h"
+
+// Binary trace of FUSE operations. A trace starts with an OpTraceHeader,
+// followed by one OpTraceRecordHeader per operation, each followed by the
+// path and, for writes, the written bytes. Fields are host byte order.
+
+#define OP_TRACE_MAGIC "WVTRACE1"
+
+typedef struct __attribute__((packed)) {
+    char magic[8];
+    uint64_t start_realtime_ns;     // wall clock at the start of the recording
+} OpTraceHeader;
+
+typedef struct __attribute__((packed)) {
+    uint64_t timestamp_ns;          // call start, relative to the recording start
+    uint32_t duration_ns;           // saturates at UINT32_MAX
+    int32_t result;
+    uint64_t offset;                // read/write/readdir offset, truncate length
+    uint32_t size;                  // read/write size, xattr buffer size
+    uint32_t mode;                  // open flags, mkdir/create mode, ioctl command
+    uint8_t op;                     // OpType
+    uint8_t reserved;
+    uint16_t path_length;
+    uint32_t payload_length;
+} OpTraceRecordHeader;
+
+typedef struct {
+    OpTraceRecordHeader header;
+    const char *path;               // NUL-terminated, valid until the next read
+    const char *payload;
+} OpTraceRecord;
+
+typedef struct {
+    FILE *file;
+    OpTraceHeader header;
+    char *buffer;
+    size_t capacity;
+} OpTraceReader;
+
+// Set while a recording is open; checked before building a record.
+extern int op_trace_active;
+
+// Starts recording to trace_path, replacing the file.
+int op_trace_open(const char *trace_path);
+
+// Appends one operation. Safe to call from any thread.
+void op_trace_record(OpType op, const char *path, uint64_t size, uint64_t offset, uint32_t mode,
+                     const char *payload, size_t payload_length,
+                     uint64_t start_ns, uint64_t duration_ns, int result);
+
+// Flushes and closes the recording.
+void op_trace_close(void);
+
+int op_trace_reader_open(OpTraceReader *reader, const char *trace_path);
+// Returns 1 and fills record, 0 at the end of the trace, -1 on a corrupt trace.
+int op_trace_reader_next(OpTraceReader *reader, OpTraceRecord *record);
+void op_trace_reader_close(OpTraceReader *reader);
+
+#endif // OP_TRACE_H
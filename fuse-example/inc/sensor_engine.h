@@ -0,0 +1,65 @@
+#ifndef SENSOR_ENGINE_H
+#define SENSOR_ENGINE_H
+#include <stddef.h>
+#include <stdint.h>
+#include "sensor_history.h"
+
+// Simulated sensor values, kept per registry handle in column arrays and
+// advanced by a tick thread. Every channel has a version that goes up when
+// its value changes, so readers can tell whether what they last read is
+// still current without comparing contents.
+typedef enum {
+    SENSOR_CHANNEL_GPS,     // top-level devices: two digits
+    SENSOR_CHANNEL_GYRO,    // top-level devices: three digits
+    SENSOR_CHANNEL_VALUE,   // sub-devices: a SENSOR reading, or a data file's contents
+    SENSOR_CHANNEL_COUNT
+} SensorChannel;
+
+typedef enum {
+    SENSOR_KIND_DEVICE,     // GPS and GYRO, advanced by the tick
+    SENSOR_KIND_READING,    // SENSOR sub-device, advanced by the tick
+    SENSOR_KIND_DATA        // other sub-devices, changed only by writes
+} SensorKind;
+
+// Called after values change: with a handle and channel for a single
+// change, or with handle -1 after a tick that may have changed any of them.
+typedef void (*SensorListener)(int handle, SensorChannel channel);
+
+void sensor_engine_set_listener(SensorListener listener);
+
+// Starts the tick thread; tick_ms 0 leaves the values static. Each tick is
+// shared by up to threads threads (the one ticking plus at most 15 helpers)
+// that take whole registry chunks, so threads 0 or 1 keeps it on one core.
+int sensor_engine_start(unsigned int tick_ms, unsigned int threads);
+void sensor_engine_stop(void);
+
+// Adds or removes a handle. The initial values derive from system_id, so a
+// device shows the same readings until the first tick changes them.
+void sensor_engine_track(int handle, SensorKind kind, const char *system_id);
+void sensor_engine_untrack(int handle);
+void sensor_engine_free(void);
+
+// Renders the channel as file contents; returns the length, or -1 when the
+// handle does not have the channel.
+int sensor_engine_render(int handle, SensorChannel channel, char *out, size_t size);
+uint64_t sensor_engine_version(int handle, SensorChannel channel);
+// Unix milliseconds of the channel's last change, or 0 for an untracked handle.
+int64_t sensor_engine_changed_ms(int handle, SensorChannel channel);
+
+// GPS and GYRO keep a history of their values in bytes_per_device bytes
+// (see sensor_history.h); set it before devices are tracked, since it drops
+// what was recorded. sensor_engine_history calls fn for the samples between
+// from_ms and to_ms (Unix milliseconds) and returns their number, or -1
+// without history.
+void sensor_engine_configure_history(size_t bytes_per_device);
+int sensor_engine_history(int handle, SensorChannel channel, int64_t from_ms, int64_t to_ms,
+                          SensorSampleFn fn, void *context);
+
+// Records an external change of the channel (a data write) and tells the
+// listener.
+void sensor_engine_touch(int handle, SensorChannel channel);
+
+// Advances every tracked value once; the tick thread calls this.
+void sensor_engine_tick(void);
+
+#endif // SENSOR_ENGINE_H
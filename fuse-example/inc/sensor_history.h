@@ -0,0 +1,38 @@
+#ifndef SENSOR_HISTORY_H
+#define SENSOR_HISTORY_H
+#include <stddef.h>
+#include <stdint.h>
+
+// Recent GPS and GYRO samples per registry handle, in a fixed number of
+// bytes per device. Each channel is a ring of 32-byte blocks: a block opens
+// with a keyframe (milliseconds since the device was tracked as a varint,
+// then the raw digits) and continues with samples stored as a varint time
+// delta and one zigzag varint per digit delta, usually a byte each. When
+// the ring is full the oldest block is dropped whole, so every block can be
+// decoded on its own.
+//
+// The module does no locking; the sensor engine calls it under its own lock.
+
+#define SENSOR_HISTORY_MAX_VALUES 3
+
+// Called for each sample in a window, oldest first.
+typedef void (*SensorSampleFn)(void *context, int64_t time_ms, const unsigned char *values, int count);
+
+// Sets the bytes kept per device, split between GPS and GYRO; 0 turns
+// history off. Drops any history recorded so far.
+void sensor_history_configure(size_t bytes_per_device);
+size_t sensor_history_bytes_per_device(void);
+void sensor_history_free(void);
+
+// Clears the history of handle and records its first samples.
+void sensor_history_reset(int handle, int64_t now_ms, const unsigned char *gps, const unsigned char *gyro);
+
+// channel 0 is GPS (2 values), 1 is GYRO (3 values).
+void sensor_history_record(int handle, int channel, int64_t now_ms, const unsigned char *values);
+
+// Calls fn for the samples of handle with from_ms <= time <= to_ms and
+// returns how many there were, or -1 when handle has no history.
+int sensor_history_scan(int handle, int channel, int64_t from_ms, int64_t to_ms,
+                        SensorSampleFn fn, void *context);
+
+#endif // SENSOR_HISTORY_H
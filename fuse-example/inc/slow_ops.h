@@ -0,0 +1,40 @@
+#ifndef SLOW_OPS_H
+#define SLOW_OPS_H
+#include <stddef.h>
+#include <stdint.h>
+#include "op_metrics.h"
+
+// Slow-operation log: callbacks slower than a threshold are written to a
+// separate, size-bounded file together with how their time split between
+// lookups, JSON persistence and debug logging.
+
+typedef enum {
+    SLOW_PHASE_OTHER,
+    SLOW_PHASE_LOOKUP,
+    SLOW_PHASE_PERSIST,
+    SLOW_PHASE_LOG,
+    SLOW_PHASE_COUNT
+} SlowOpPhase;
+
+// threshold_us = 0 turns the recorder off. The log is rotated to
+// "<log_path>.1" when it reaches max_bytes. With stack_every = N, every Nth
+// slow operation also logs the stack of its slowest phase; 0 logs none.
+int slow_ops_configure(const char *log_path, uint64_t threshold_us, size_t max_bytes, unsigned stack_every);
+void slow_ops_close(void);
+
+// Called by the metered wrappers around every callback.
+void slow_op_begin(void);
+void slow_op_end(OpType op, const char *path, uint64_t duration_ns, int result);
+
+// Time between enter and exit is charged to phase, minus any nested phase.
+SlowOpPhase slow_op_phase_enter(SlowOpPhase phase);
+void slow_op_phase_exit(SlowOpPhase previous);
+
+#define SLOW_OP_PHASE(phase, statement)                                 \
+    do {                                                                \
+        SlowOpPhase previous_phase = slow_op_phase_enter(phase);        \
+        statement;                                                      \
+        slow_op_phase_exit(previous_phase);                             \
+    } while (0)
+
+#endif // SLOW_OPS_H
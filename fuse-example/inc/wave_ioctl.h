@@ -0,0 +1,65 @@
+#ifndef WAVE_IOCTL_H
+#define WAVE_IOCTL_H
+#include <stdint.h>
+#include <sys/ioctl.h>
+
+// Batched metadata ioctls on /.control/ioctl, for collectors that would
+// otherwise stat and getxattr every device. Open the file read-only and
+// issue the ioctls on that descriptor. This header has no other dependency
+// so clients can include it on its own.
+//
+// FUSE passes at most _IOC_SIZE bytes (under 16 KiB) each way, which sets
+// the number of records per call.
+
+#define WAVE_IOCTL_MAGIC 'W'
+#define WAVE_RECORD_NAME_SIZE 52
+#define WAVE_RECORD_MODEL_SIZE 20
+#define WAVE_BATCH_RECORDS 112
+
+// One device or sub-device: its registry fields plus the mode, link count
+// and size getattr reports. Timestamps other than the registration date
+// are left to stat.
+struct wave_device_record {
+    int32_t handle;             // registry handle; lookup: -1 to look up by name
+    int32_t parent_handle;      // -1 for top-level devices; lookup by name: the parent
+    char name[WAVE_RECORD_NAME_SIZE];     // lookup by name: the device name
+    char model[WAVE_RECORD_MODEL_SIZE];   // lookup by name: "" for a top-level device
+    char imei[8];
+    char system_id[8];
+    int32_t serial_number;
+    uint32_t child_count;       // sub-devices of a top-level device
+    int64_t registration_date;  // Unix seconds
+    int64_t size;
+    uint32_t mode;
+    uint32_t nlink;
+    int32_t status;             // 0, or -ENOENT when a lookup found nothing
+    uint32_t reserved;
+} __attribute__((packed));
+
+// Fills up to WAVE_BATCH_RECORDS records in handle order, starting at
+// next_handle (0 for the first call). On return next_handle is where the
+// following call continues, or -1 once the registry has been covered.
+struct wave_ioctl_sweep {
+    int32_t next_handle;
+    uint32_t count;
+    uint32_t reserved[2];
+    struct wave_device_record records[WAVE_BATCH_RECORDS];
+} __attribute__((packed));
+
+// Looks up count records in place, each by handle or by name, model and
+// parent_handle, and fills in the rest. found counts the records with
+// status 0.
+struct wave_ioctl_lookup {
+    uint32_t count;
+    uint32_t found;
+    uint32_t reserved[2];
+    struct wave_device_record records[WAVE_BATCH_RECORDS];
+} __attribute__((packed));
+
+#define WAVE_IOC_SWEEP _IOWR(WAVE_IOCTL_MAGIC, 1, struct wave_ioctl_sweep)
+#define WAVE_IOC_LOOKUP _IOWR(WAVE_IOCTL_MAGIC, 2, struct wave_ioctl_lookup)
+
+_Static_assert(sizeof(struct wave_device_record) == 136, "wave_device_record layout changed");
+_Static_assert(sizeof(struct wave_ioctl_sweep) < (1 << 14), "sweep does not fit a FUSE ioctl");
+
+#endif // WAVE_IOCTL_H
@@ -0,0 +1,38 @@
+#ifndef WAVE_PROBES_H
+#define WAVE_PROBES_H
+
+// Static (USDT) probe points under the provider "wave_fs", usable from perf,
+// bpftrace and SystemTap, e.g.
+//   bpftrace -l 'usdt:./fuse-example:wave_fs:*'
+// When <sys/sdt.h> is available each probe is a single nop plus an ELF note,
+// and its arguments are plain values that are already at hand, so an
+// unattached probe costs nothing measurable. Without it the probes compile
+// away.
+//
+//   op__entry(op, path)                      op is an OpType
+//   op__exit(op, path, result, duration_ns)
+//   json__write__start(json_path)
+//   json__write__done(json_path, bytes, ok)
+//   index__lookup__start(name, model, parent_handle)
+//   index__lookup__done(name, handle)        handle is -1 when not found
+//   dir__lookup__start(path)
+//   dir__lookup__done(path, index)
+//   file__lookup__start(name, directory)
+//   file__lookup__done(name, found)
+//   log__flush__start(log_path)
+//   log__flush__done(log_path)
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define WAVE_PROBE1(name, a) DTRACE_PROBE1(wave_fs, name, a)
+#define WAVE_PROBE2(name, a, b) DTRACE_PROBE2(wave_fs, name, a, b)
+#define WAVE_PROBE3(name, a, b, c) DTRACE_PROBE3(wave_fs, name, a, b, c)
+#define WAVE_PROBE4(name, a, b, c, d) DTRACE_PROBE4(wave_fs, name, a, b, c, d)
+#else
+#define WAVE_PROBE1(name, a) do { } while (0)
+#define WAVE_PROBE2(name, a, b) do { } while (0)
+#define WAVE_PROBE3(name, a, b, c) do { } while (0)
+#define WAVE_PROBE4(name, a, b, c, d) do { } while (0)
+#endif
+
+#endif // WAVE_PROBES_H
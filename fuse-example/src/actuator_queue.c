@@ -0,0 +1,432 @@
+#include "actuator_queue.h"
+#include "device_manager.h"
+#include "mem_stats.h"
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// One slot of a bounded MPSC ring (Vyukov): sequence says whether the slot
+// is free for the producer at that position or filled for the consumer.
+typedef struct {
+    _Atomic size_t sequence;
+    char *text;                 // label, NUL, then the command
+    size_t label_length;
+    size_t length;
+    unsigned int generation;
+} CommandCell;
+
+typedef struct ActuatorQueue {
+    int handle;
+    _Atomic size_t enqueue_position;
+    size_t dequeue_position;            // only the worker holding the queue moves it
+    _Atomic unsigned int generation;    // bumped by actuator_queue_reset
+    _Atomic int scheduled;              // on the incoming stack, the ready list or with a worker
+    struct ActuatorQueue *next_ready;
+    _Atomic int space_waiters;          // blocked writers of this queue
+    pthread_cond_t space_cond;          // with space_mutex
+    CommandCell cells[];
+} ActuatorQueue;
+
+typedef ActuatorQueue *_Atomic QueueSlot;
+
+static QueueSlot *_Atomic queue_chunks[MAX_DEVICE_CHUNKS];
+static unsigned int queue_depth = 16;       // power of two
+static unsigned int service_rate = 0;
+static unsigned int worker_count = 0;
+static ActuatorHandler command_handler = NULL;
+
+// Producers push queues that just got work onto a lock-free stack; workers
+// move it, oldest first, onto the tail of the ready list under ready_mutex,
+// so queues are served round-robin.
+static ActuatorQueue *_Atomic incoming_queues = NULL;
+static ActuatorQueue *ready_head = NULL;
+static ActuatorQueue *ready_tail = NULL;
+static pthread_mutex_t ready_mutex = PTHREAD_MUTEX_INITIALIZER;
+static sem_t ready_sem;
+
+static pthread_t *workers = NULL;
+static _Atomic int workers_running = 0;
+
+// Blocking writers wait on the space_cond of their queue for a worker to
+// free a slot. The waiter count and the cell sequence are each written
+// before the other side's is read, with a seq_cst fence in between on both
+// sides, so either the worker sees the waiter or the writer sees the slot.
+static pthread_mutex_t space_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static _Atomic long long accepted_count, applied_count, rejected_count, blocked_count, dropped_count;
+
+void actuator_queue_set_handler(ActuatorHandler handler) {
+    command_handler = handler;
+}
+
+static size_t queue_bytes(void) {
+    return sizeof(ActuatorQueue) + (size_t)queue_depth * sizeof(CommandCell);
+}
+
+// Returns the queue of handle, creating it on first use. Racing creators
+// settle with a compare-and-swap, so this stays lock-free.
+static ActuatorQueue *queue_for(int handle) {
+    if (handle < 0 || handle / DEVICE_CHUNK_SIZE >= MAX_DEVICE_CHUNKS) {
+        return NULL;
+    }
+    QueueSlot *chunk = atomic_load_explicit(&queue_chunks[handle / DEVICE_CHUNK_SIZE], memory_order_acquire);
+    if (chunk == NULL) {
+        QueueSlot *fresh = (QueueSlot *)calloc(DEVICE_CHUNK_SIZE, sizeof(QueueSlot));
+        if (fresh == NULL) {
+            return NULL;
+        }
+        if (atomic_compare_exchange_strong(&queue_chunks[handle / DEVICE_CHUNK_SIZE], &chunk, fresh)) {
+            mem_account(MEM_BUFFERS, DEVICE_CHUNK_SIZE * sizeof(QueueSlot));
+            chunk = fresh;
+        } else {
+            free(fresh);
+        }
+    }
+    QueueSlot *slot = &chunk[handle % DEVICE_CHUNK_SIZE];
+    ActuatorQueue *queue = atomic_load_explicit(slot, memory_order_acquire);
+    if (queue == NULL) {
+        ActuatorQueue *fresh = (ActuatorQueue *)calloc(1, queue_bytes());
+        if (fresh == NULL) {
+            return NULL;
+        }
+        fresh->handle = handle;
+        pthread_cond_init(&fresh->space_cond, NULL);
+        for (size_t i = 0; i < queue_depth; i++) {
+            atomic_init(&fresh->cells[i].sequence, i);
+        }
+        if (atomic_compare_exchange_strong(slot, &queue, fresh)) {
+            mem_account(MEM_BUFFERS, queue_bytes());
+            queue = fresh;
+        } else {
+            pthread_cond_destroy(&fresh->space_cond);
+            free(fresh);
+        }
+    }
+    return queue;
+}
+
+// Wakes the blocked writers of every queue, e.g. when the workers stop.
+static void wake_all_writers(void) {
+    pthread_mutex_lock(&space_mutex);
+    for (int i = 0; i < MAX_DEVICE_CHUNKS; i++) {
+        QueueSlot *chunk = atomic_load(&queue_chunks[i]);
+        for (int j = 0; chunk != NULL && j < DEVICE_CHUNK_SIZE; j++) {
+            ActuatorQueue *queue = atomic_load(&chunk[j]);
+            if (queue != NULL) {
+                pthread_cond_broadcast(&queue->space_cond);
+            }
+        }
+    }
+    pthread_mutex_unlock(&space_mutex);
+}
+
+static int try_enqueue(ActuatorQueue *queue, char *text, size_t label_length, size_t length) {
+    size_t mask = queue_depth - 1;
+    size_t position = atomic_load_explicit(&queue->enqueue_position, memory_order_relaxed);
+    CommandCell *cell;
+    for (;;) {
+        cell = &queue->cells[position & mask];
+        size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+        if (difference == 0) {
+            if (atomic_compare_exchange_weak_explicit(&queue->enqueue_position, &position, position + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (difference < 0) {
+            return 0;
+        } else {
+            position = atomic_load_explicit(&queue->enqueue_position, memory_order_relaxed);
+        }
+    }
+    cell->text = text;
+    cell->label_length = label_length;
+    cell->length = length;
+    cell->generation = atomic_load_explicit(&queue->generation, memory_order_relaxed);
+    atomic_store_explicit(&cell->sequence, position + 1, memory_order_release);
+    return 1;
+}
+
+// Called by the worker holding the queue. Returns the cell, or NULL when the
+// queue is empty; release_cell gives the slot back.
+static CommandCell *peek_cell(ActuatorQueue *queue) {
+    CommandCell *cell = &queue->cells[queue->dequeue_position & (queue_depth - 1)];
+    size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+    return sequence == queue->dequeue_position + 1 ? cell : NULL;
+}
+
+static void release_cell(ActuatorQueue *queue, CommandCell *cell) {
+    atomic_store_explicit(&cell->sequence, queue->dequeue_position + queue_depth, memory_order_release);
+    queue->dequeue_position++;
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&queue->space_waiters, memory_order_relaxed) > 0) {
+        pthread_mutex_lock(&space_mutex);
+        pthread_cond_broadcast(&queue->space_cond);
+        pthread_mutex_unlock(&space_mutex);
+    }
+}
+
+// Hands a queue to the workers unless it is already scheduled.
+static void schedule_queue(ActuatorQueue *queue) {
+    if (atomic_exchange_explicit(&queue->scheduled, 1, memory_order_acq_rel) != 0) {
+        return;
+    }
+    ActuatorQueue *head = atomic_load_explicit(&incoming_queues, memory_order_relaxed);
+    do {
+        queue->next_ready = head;
+    } while (!atomic_compare_exchange_weak_explicit(&incoming_queues, &head, queue,
+                                                    memory_order_release, memory_order_relaxed));
+    sem_post(&ready_sem);
+}
+
+// Called with ready_mutex held.
+static void append_ready(ActuatorQueue *queue) {
+    queue->next_ready = NULL;
+    if (ready_tail != NULL) {
+        ready_tail->next_ready = queue;
+    } else {
+        ready_head = queue;
+    }
+    ready_tail = queue;
+}
+
+static ActuatorQueue *take_ready_queue(void) {
+    pthread_mutex_lock(&ready_mutex);
+    ActuatorQueue *incoming = atomic_exchange_explicit(&incoming_queues, NULL, memory_order_acquire);
+    // The stack holds the newest first; reverse it to keep arrival order.
+    ActuatorQueue *reversed = NULL;
+    while (incoming != NULL) {
+        ActuatorQueue *next = incoming->next_ready;
+        incoming->next_ready = reversed;
+        reversed = incoming;
+        incoming = next;
+    }
+    while (reversed != NULL) {
+        ActuatorQueue *next = reversed->next_ready;
+        append_ready(reversed);
+        reversed = next;
+    }
+    ActuatorQueue *queue = ready_head;
+    if (queue != NULL) {
+        ready_head = queue->next_ready;
+        if (ready_head == NULL) {
+            ready_tail = NULL;
+        }
+    }
+    pthread_mutex_unlock(&ready_mutex);
+    return queue;
+}
+
+static void sleep_ns(uint64_t ns) {
+    struct timespec delay = {(time_t)(ns / 1000000000ull), (long)(ns % 1000000000ull)};
+    while (nanosleep(&delay, &delay) != 0 && errno == EINTR) {
+    }
+}
+
+// Serves one command of queue, then puts the queue back at the end of the
+// ready list if it has more.
+static void serve_queue(ActuatorQueue *queue) {
+    CommandCell *cell = peek_cell(queue);
+    if (cell != NULL) {
+        char *text = cell->text;
+        size_t label_length = cell->label_length;
+        size_t length = cell->length;
+        int current = cell->generation == atomic_load_explicit(&queue->generation, memory_order_relaxed);
+        release_cell(queue, cell);
+        if (current) {
+            sleep_ns(1000000000ull / service_rate);
+            ActuatorHandler handler = command_handler;
+            if (handler != NULL) {
+                handler(queue->handle, text, text + label_length + 1, length);
+            }
+            atomic_fetch_add_explicit(&applied_count, 1, memory_order_relaxed);
+        } else {
+            atomic_fetch_add_explicit(&dropped_count, 1, memory_order_relaxed);
+        }
+        mem_account(MEM_BUFFERS, -(long long)(label_length + 1 + length));
+        free(text);
+    }
+    if (peek_cell(queue) != NULL) {
+        pthread_mutex_lock(&ready_mutex);
+        append_ready(queue);
+        pthread_mutex_unlock(&ready_mutex);
+        sem_post(&ready_sem);
+        return;
+    }
+    atomic_store_explicit(&queue->scheduled, 0, memory_order_release);
+    // A producer that saw the queue still scheduled relies on us to notice
+    // its command.
+    if (peek_cell(queue) != NULL) {
+        schedule_queue(queue);
+    }
+}
+
+static void *worker_main(void *arg) {
+    (void) arg;
+    while (atomic_load_explicit(&workers_running, memory_order_acquire)) {
+        sem_wait(&ready_sem);
+        ActuatorQueue *queue = take_ready_queue();
+        if (queue != NULL) {
+            serve_queue(queue);
+        }
+    }
+    return NULL;
+}
+
+int actuator_queue_start(unsigned int rate, unsigned int worker_threads, unsigned int depth) {
+    if (rate == 0 || atomic_load(&workers_running)) {
+        return 0;
+    }
+    queue_depth = 2;
+    while (queue_depth < depth) {
+        queue_depth *= 2;
+    }
+    service_rate = rate;
+    worker_count = worker_threads > 0 ? worker_threads : 1;
+    workers = (pthread_t *)calloc(worker_count, sizeof(pthread_t));
+    if (workers == NULL || sem_init(&ready_sem, 0, 0) != 0) {
+        free(workers);
+        workers = NULL;
+        return -1;
+    }
+    atomic_store(&workers_running, 1);
+    for (unsigned int i = 0; i < worker_count; i++) {
+        if (pthread_create(&workers[i], NULL, worker_main, NULL) != 0) {
+            worker_count = i;
+            actuator_queue_stop();
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void actuator_queue_stop(void) {
+    if (workers == NULL) {
+        return;
+    }
+    atomic_store(&workers_running, 0);
+    for (unsigned int i = 0; i < worker_count; i++) {
+        sem_post(&ready_sem);
+    }
+    for (unsigned int i = 0; i < worker_count; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    wake_all_writers();
+    free(workers);
+    workers = NULL;
+    worker_count = 0;
+    service_rate = 0;
+    sem_destroy(&ready_sem);
+}
+
+void actuator_queue_free(void) {
+    actuator_queue_stop();
+    for (int i = 0; i < MAX_DEVICE_CHUNKS; i++) {
+        QueueSlot *chunk = atomic_load(&queue_chunks[i]);
+        if (chunk == NULL) {
+            continue;
+        }
+        for (int j = 0; j < DEVICE_CHUNK_SIZE; j++) {
+            ActuatorQueue *queue = atomic_load(&chunk[j]);
+            if (queue == NULL) {
+                continue;
+            }
+            CommandCell *cell;
+            while ((cell = peek_cell(queue)) != NULL) {
+                mem_account(MEM_BUFFERS, -(long long)(cell->label_length + 1 + cell->length));
+                free(cell->text);
+                atomic_fetch_add(&dropped_count, 1);
+                release_cell(queue, cell);
+            }
+            mem_account(MEM_BUFFERS, -(long long)queue_bytes());
+            pthread_cond_destroy(&queue->space_cond);
+            free(queue);
+        }
+        mem_account(MEM_BUFFERS, -(long long)(DEVICE_CHUNK_SIZE * sizeof(QueueSlot)));
+        free(chunk);
+        atomic_store(&queue_chunks[i], NULL);
+    }
+    atomic_store(&incoming_queues, NULL);
+    ready_head = NULL;
+    ready_tail = NULL;
+}
+
+int actuator_queue_submit(int handle, const char *label, const char *command, size_t length, int nonblocking) {
+    if (!atomic_load_explicit(&workers_running, memory_order_acquire)) {
+        ActuatorHandler handler = command_handler;
+        if (handler != NULL) {
+            handler(handle, label, command, length);
+        }
+        atomic_fetch_add_explicit(&accepted_count, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&applied_count, 1, memory_order_relaxed);
+        return 0;
+    }
+    ActuatorQueue *queue = queue_for(handle);
+    size_t label_length = strlen(label);
+    char *text = (char *)malloc(label_length + 1 + length);
+    if (queue == NULL || text == NULL) {
+        free(text);
+        return -ENOMEM;
+    }
+    memcpy(text, label, label_length + 1);
+    memcpy(text + label_length + 1, command, length);
+    // Charged before the command becomes visible, so the worker's release
+    // never runs ahead of it.
+    mem_account(MEM_BUFFERS, (long long)(label_length + 1 + length));
+
+    if (!try_enqueue(queue, text, label_length, length)) {
+        if (nonblocking) {
+            mem_account(MEM_BUFFERS, -(long long)(label_length + 1 + length));
+            free(text);
+            atomic_fetch_add_explicit(&rejected_count, 1, memory_order_relaxed);
+            return -EAGAIN;
+        }
+        atomic_fetch_add_explicit(&blocked_count, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&queue->space_waiters, 1, memory_order_seq_cst);
+        atomic_thread_fence(memory_order_seq_cst);
+        pthread_mutex_lock(&space_mutex);
+        int queued = 0;
+        while (atomic_load_explicit(&workers_running, memory_order_acquire) &&
+               !(queued = try_enqueue(queue, text, label_length, length))) {
+            pthread_cond_wait(&queue->space_cond, &space_mutex);
+        }
+        pthread_mutex_unlock(&space_mutex);
+        atomic_fetch_sub_explicit(&queue->space_waiters, 1, memory_order_relaxed);
+        if (!queued) {
+            mem_account(MEM_BUFFERS, -(long long)(label_length + 1 + length));
+            free(text);
+            return -EIO;
+        }
+    }
+    atomic_fetch_add_explicit(&accepted_count, 1, memory_order_relaxed);
+    schedule_queue(queue);
+    return 0;
+}
+
+void actuator_queue_reset(int handle) {
+    if (handle < 0 || handle / DEVICE_CHUNK_SIZE >= MAX_DEVICE_CHUNKS) {
+        return;
+    }
+    QueueSlot *chunk = atomic_load_explicit(&queue_chunks[handle / DEVICE_CHUNK_SIZE], memory_order_acquire);
+    ActuatorQueue *queue = chunk != NULL ? atomic_load_explicit(&chunk[handle % DEVICE_CHUNK_SIZE], memory_order_acquire) : NULL;
+    if (queue != NULL) {
+        atomic_fetch_add_explicit(&queue->generation, 1, memory_order_relaxed);
+    }
+}
+
+void actuator_queue_stats(ActuatorQueueStats *stats) {
+    stats->rate = service_rate;
+    stats->workers = worker_count;
+    stats->depth = queue_depth;
+    stats->accepted = atomic_load(&accepted_count);
+    stats->applied = atomic_load(&applied_count);
+    stats->rejected = atomic_load(&rejected_count);
+    stats->blocked = atomic_load(&blocked_count);
+    stats->dropped = atomic_load(&dropped_count);
+    stats->queued = stats->accepted - stats->applied - stats->dropped;
+}
@@ -1,24 +1,291 @@
 #include "device_manager.h"
+#include "wave_probes.h"
+#include "slow_ops.h"
+#include "mem_stats.h"
+#include "sensor_engine.h"
+#include "actuator_queue.h"
 #include<json-c/json.h>
+#include <limits.h>
 
-DeviceEntry* device_storage = NULL;
+DeviceEntry* device_chunks[MAX_DEVICE_CHUNKS] = {NULL};
 int device_count = 0; 
 int device_capacity = 0;
+static int device_high_water = 0;   // handles below this have been handed out at least once
+static int free_list_head = -1;
+static uint64_t next_device_inode = 1;   // never reused, so a removed node's number stays dead
+
+FleetStats fleet_stats = {0, 0, 0};
+
+// Devices per model. The set of models is small, so a linear table is enough.
+static ModelCount *model_counts = NULL;
+static int model_count_size = 0;
+static int model_count_capacity = 0;
+
+// The fields queries filter on, kept column-wise next to each chunk so a
+// scan reads a few contiguous arrays instead of whole DeviceEntry records.
+typedef struct {
+    int serial_number[DEVICE_CHUNK_SIZE];
+    int parent_handle[DEVICE_CHUNK_SIZE];
+    long long registration_date[DEVICE_CHUNK_SIZE];
+    int model_id[DEVICE_CHUNK_SIZE];       // index into model_counts, -1 when the slot is free
+} DeviceColumns;
+
+static DeviceColumns *column_chunks[MAX_DEVICE_CHUNKS];
+
+// Name index: (parent, name, model) -> handle, chained through next_in_bucket.
+static int *index_buckets = NULL;
+static size_t index_bucket_count = 0;
+
+// Makes sure a handle is available for the next entry. Growth allocates a
+// new chunk instead of reallocating, so existing entries never move.
+int ensure_device_capacity() {
+    if (free_list_head != -1 || device_high_water < device_capacity) {
+        return 1;
+    }
+    int chunk = device_capacity / DEVICE_CHUNK_SIZE;
+    if (chunk >= MAX_DEVICE_CHUNKS) {
+        log_debug("ERROR: Device registry is full.");
+        return 0;
+    }
+    device_chunks[chunk] = (DeviceEntry *)calloc(DEVICE_CHUNK_SIZE, sizeof(DeviceEntry));
+    column_chunks[chunk] = (DeviceColumns *)malloc(sizeof(DeviceColumns));
+    if (device_chunks[chunk] == NULL || column_chunks[chunk] == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    memset(column_chunks[chunk]->model_id, 0xff, sizeof(column_chunks[chunk]->model_id));
+    mem_account(MEM_REGISTRY, DEVICE_CHUNK_SIZE * sizeof(DeviceEntry) + sizeof(DeviceColumns));
+    device_capacity += DEVICE_CHUNK_SIZE;
+    return 1;
+}
 
-void ensure_device_capacity() {
-    if (device_storage == NULL) {
-        device_capacity = INITIAL_CAPACITY;
-        device_storage = (DeviceEntry *)malloc(sizeof(DeviceEntry) * device_capacity);
-        if (device_storage == NULL) {
-            exit(EXIT_FAILURE);
+DeviceEntry *get_device_entry(int handle) {
+    if (handle < 0 || handle >= device_high_water) {
+        return NULL;
+    }
+    DeviceEntry *entry = &device_chunks[handle / DEVICE_CHUNK_SIZE][handle % DEVICE_CHUNK_SIZE];
+    return entry->in_use ? entry : NULL;
+}
+
+static size_t device_key_hash(const char *name, const char *model, int parent_handle) {
+    size_t hash = 2166136261u ^ (size_t)(parent_handle + 1);
+    for (const char *c = name; *c != '\0'; c++) {
+        hash = (hash ^ (unsigned char)*c) * 16777619u;
+    }
+    hash = (hash ^ '.') * 16777619u;
+    for (const char *c = model; *c != '\0'; c++) {
+        hash = (hash ^ (unsigned char)*c) * 16777619u;
+    }
+    return hash;
+}
+
+static void index_insert(DeviceEntry *entry) {
+    size_t bucket = device_key_hash(entry->name, entry->model, entry->parent_handle) & (index_bucket_count - 1);
+    entry->next_in_bucket = index_buckets[bucket];
+    index_buckets[bucket] = entry->handle;
+}
+
+static void index_remove(DeviceEntry *entry) {
+    size_t bucket = device_key_hash(entry->name, entry->model, entry->parent_handle) & (index_bucket_count - 1);
+    int *link = &index_buckets[bucket];
+    while (*link != -1) {
+        DeviceEntry *current = get_device_entry(*link);
+        if (current == entry) {
+            *link = entry->next_in_bucket;
+            return;
+        }
+        link = &current->next_in_bucket;
+    }
+}
+
+// Keeps the load factor at or below one; rehashing walks the live entries once.
+static void ensure_index_capacity() {
+    if (index_buckets != NULL && (size_t)device_count < index_bucket_count) {
+        return;
+    }
+    size_t new_count = index_bucket_count ? index_bucket_count * 2 : DEVICE_CHUNK_SIZE;
+    int *new_buckets = (int *)malloc(new_count * sizeof(int));
+    if (new_buckets == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    memset(new_buckets, 0xff, new_count * sizeof(int));
+    mem_account(MEM_REGISTRY, (long long)(new_count - index_bucket_count) * sizeof(int));
+    free(index_buckets);
+    index_buckets = new_buckets;
+    index_bucket_count = new_count;
+    for (int handle = 0; handle < device_high_water; handle++) {
+        DeviceEntry *entry = get_device_entry(handle);
+        if (entry != NULL) {
+            index_insert(entry);
         }
-    } else if (device_count >= device_capacity) {
-        device_capacity *= 2; 
-        DeviceEntry *new_storage = (DeviceEntry *)realloc(device_storage, sizeof(DeviceEntry) * device_capacity);
-        if (new_storage == NULL) {
+    }
+}
+
+// Looks a device up by the same key the filesystem enforces uniqueness on:
+// top-level devices by name, sub-devices by name and model within their parent.
+int find_device_handle(const char *name, const char *model, int parent_handle) {
+    WAVE_PROBE3(index__lookup__start, name, model, parent_handle);
+    if (index_buckets == NULL) {
+        WAVE_PROBE2(index__lookup__done, name, -1);
+        return -1;
+    }
+    SlowOpPhase previous_phase = slow_op_phase_enter(SLOW_PHASE_LOOKUP);
+    char key_name[MAX_NAME_LENGTH];
+    char key_model[MAX_MODEL_LENGTH];
+    snprintf(key_name, sizeof(key_name), "%s", name);
+    snprintf(key_model, sizeof(key_model), "%s", model);
+
+    size_t bucket = device_key_hash(key_name, key_model, parent_handle) & (index_bucket_count - 1);
+    for (int handle = index_buckets[bucket]; handle != -1; ) {
+        DeviceEntry *entry = get_device_entry(handle);
+        if (entry->parent_handle == parent_handle &&
+            strcmp(entry->name, key_name) == 0 && strcmp(entry->model, key_model) == 0) {
+            slow_op_phase_exit(previous_phase);
+            WAVE_PROBE2(index__lookup__done, name, handle);
+            return handle;
+        }
+        handle = entry->next_in_bucket;
+    }
+    slow_op_phase_exit(previous_phase);
+    WAVE_PROBE2(index__lookup__done, name, -1);
+    return -1;
+}
+
+static DeviceEntry *allocate_device_entry() {
+    if (!ensure_device_capacity()) {
+        return NULL;
+    }
+    int handle;
+    if (free_list_head != -1) {
+        handle = free_list_head;
+        free_list_head = device_chunks[handle / DEVICE_CHUNK_SIZE][handle % DEVICE_CHUNK_SIZE].next_free;
+    } else {
+        handle = device_high_water++;
+    }
+    DeviceEntry *entry = &device_chunks[handle / DEVICE_CHUNK_SIZE][handle % DEVICE_CHUNK_SIZE];
+    memset(entry, 0, sizeof(DeviceEntry));
+    entry->handle = handle;
+    entry->in_use = 1;
+    entry->next_free = -1;
+    device_count++;
+    return entry;
+}
+
+// Returns the model's index in the table, which never changes, or -1.
+static int adjust_model_count(const char *model, int delta) {
+    for (int i = 0; i < model_count_size; i++) {
+        if (strcmp(model_counts[i].model, model) == 0) {
+            model_counts[i].count += delta;
+            return i;
+        }
+    }
+    if (delta < 0) {
+        return -1;
+    }
+    if (model_count_size == model_count_capacity) {
+        int new_capacity = model_count_capacity ? model_count_capacity * 2 : 16;
+        ModelCount *new_counts = (ModelCount *)realloc(model_counts, new_capacity * sizeof(ModelCount));
+        if (new_counts == NULL) {
             exit(EXIT_FAILURE);
         }
-        device_storage = new_storage;
+        mem_account(MEM_REGISTRY, (long long)(new_capacity - model_count_capacity) * sizeof(ModelCount));
+        model_counts = new_counts;
+        model_count_capacity = new_capacity;
+    }
+    snprintf(model_counts[model_count_size].model, MAX_MODEL_LENGTH, "%s", model);
+    model_counts[model_count_size].count = delta;
+    return model_count_size++;
+}
+
+const ModelCount *get_model_counts(int *count) {
+    *count = model_count_size;
+    return model_counts;
+}
+
+// Sets the byte size a device contributes and propagates the difference to
+// the folder that owns it and to the fleet total.
+void set_device_bytes(int handle, long long bytes) {
+    DeviceEntry *entry = get_device_entry(handle);
+    if (entry == NULL) {
+        return;
+    }
+    long long delta = bytes - entry->own_bytes;
+    entry->own_bytes = bytes;
+    fleet_stats.total_bytes += delta;
+
+    DeviceEntry *folder = entry->type == FOLDER_TYPE ? entry : get_device_entry(entry->parent_handle);
+    if (folder != NULL) {
+        folder->total_bytes += delta;
+    }
+}
+
+// O(1): the slot goes on the free list and is handed out again by the next
+// create, so memory stays bounded by the peak number of live devices.
+void remove_device_entry(int handle) {
+    DeviceEntry *entry = get_device_entry(handle);
+    if (entry == NULL) {
+        return;
+    }
+    set_device_bytes(handle, 0);
+    if (entry->type == FOLDER_TYPE) {
+        fleet_stats.total_bytes -= entry->total_bytes;
+        fleet_stats.top_level_devices--;
+    } else {
+        DeviceEntry *parent = get_device_entry(entry->parent_handle);
+        if (parent != NULL) {
+            parent->child_count--;
+            if (entry->prev_sibling != -1) {
+                get_device_entry(entry->prev_sibling)->next_sibling = entry->next_sibling;
+            } else {
+                parent->first_child = entry->next_sibling;
+            }
+            if (entry->next_sibling != -1) {
+                get_device_entry(entry->next_sibling)->prev_sibling = entry->prev_sibling;
+            }
+        }
+        fleet_stats.sub_devices--;
+    }
+    adjust_model_count(entry->model, -1);
+    column_chunks[handle / DEVICE_CHUNK_SIZE]->model_id[handle % DEVICE_CHUNK_SIZE] = -1;
+    sensor_engine_untrack(handle);
+    actuator_queue_reset(handle);
+    index_remove(entry);
+    entry->in_use = 0;
+    entry->next_free = free_list_head;
+    free_list_head = handle;
+    device_count--;
+}
+
+void free_device_registry() {
+    sensor_engine_free();
+    actuator_queue_free();
+    for (int i = 0; i < MAX_DEVICE_CHUNKS && device_chunks[i] != NULL; i++) {
+        free(device_chunks[i]);
+        free(column_chunks[i]);
+        device_chunks[i] = NULL;
+        column_chunks[i] = NULL;
+    }
+    mem_account(MEM_REGISTRY, -((long long)device_capacity * sizeof(DeviceEntry) +
+                                (long long)(device_capacity / DEVICE_CHUNK_SIZE) * sizeof(DeviceColumns) +
+                                (long long)index_bucket_count * sizeof(int) +
+                                (long long)model_count_capacity * sizeof(ModelCount)));
+    free(index_buckets);
+    index_buckets = NULL;
+    index_bucket_count = 0;
+    free(model_counts);
+    model_counts = NULL;
+    model_count_size = 0;
+    model_count_capacity = 0;
+    memset(&fleet_stats, 0, sizeof(fleet_stats));
+    device_count = 0;
+    device_capacity = 0;
+    device_high_water = 0;
+    free_list_head = -1;
+    next_device_inode = 1;
+}
+
+void device_reserve_inodes(uint64_t next) {
+    if (next > next_device_inode) {
+        next_device_inode = next;
     }
 }
 
@@ -41,17 +308,26 @@ int is_valid_model(const char *model, EntryType type) {
 }
 
 
+static SensorKind sensor_kind_of(const DeviceEntry *entry) {
+    if (entry->type == FOLDER_TYPE) {
+        return SENSOR_KIND_DEVICE;
+    }
+    return strcmp(entry->model, "SENSOR") == 0 ? SENSOR_KIND_READING : SENSOR_KIND_DATA;
+}
+
 DeviceEntry *create_and_add_device_entry(const char *name, const char *model, 
                                          int serial_number, time_t registration_date, 
-                                         char* imei, EntryType type) {
-    ensure_device_capacity();
-
+                                         char* imei, EntryType type, int parent_handle) {
     if (!is_valid_model(model, type)) {
         return NULL;
     }
+    ensure_index_capacity();
 
-    // Create a new device entry and populate the fields
-    DeviceEntry *entry = &device_storage[device_count];
+    // Take a slot from the registry and populate the fields
+    DeviceEntry *entry = allocate_device_entry();
+    if (entry == NULL) {
+        return NULL;
+    }
     strncpy(entry->name, name, MAX_NAME_LENGTH - 1);
     entry->name[MAX_NAME_LENGTH - 1] = '\0'; 
 
@@ -72,10 +348,128 @@ DeviceEntry *create_and_add_device_entry(const char *name, const char *model,
     entry->system_id[7] = '\0';
     
     entry->type = type;
-    device_count++;
+    entry->parent_handle = parent_handle;
+    entry->first_child = -1;
+    entry->next_sibling = -1;
+    entry->prev_sibling = -1;
+    entry->list_position = -1;
+    index_insert(entry);
+
+    if (type == FOLDER_TYPE) {
+        fleet_stats.top_level_devices++;
+    } else {
+        DeviceEntry *parent = get_device_entry(parent_handle);
+        if (parent != NULL) {
+            parent->child_count++;
+            entry->next_sibling = parent->first_child;
+            if (parent->first_child != -1) {
+                get_device_entry(parent->first_child)->prev_sibling = entry->handle;
+            }
+            parent->first_child = entry->handle;
+        }
+        fleet_stats.sub_devices++;
+    }
+    DeviceColumns *columns = column_chunks[entry->handle / DEVICE_CHUNK_SIZE];
+    int slot = entry->handle % DEVICE_CHUNK_SIZE;
+    columns->serial_number[slot] = serial_number;
+    columns->parent_handle[slot] = parent_handle;
+    columns->registration_date[slot] = (long long)registration_date;
+    columns->model_id[slot] = adjust_model_count(entry->model, 1);
+
+    entry->inode = next_device_inode++;
+
+    sensor_engine_track(entry->handle, sensor_kind_of(entry), entry->system_id);
     return entry;
 }
 
+void restore_device_entry(DeviceEntry *entry, uint64_t inode, time_t registration_date, const char *system_id) {
+    if (inode != 0) {
+        entry->inode = inode;
+        device_reserve_inodes(inode + 1);
+    }
+    entry->registration_date = registration_date;
+    column_chunks[entry->handle / DEVICE_CHUNK_SIZE]->registration_date[entry->handle % DEVICE_CHUNK_SIZE] =
+        (long long)registration_date;
+    if (system_id != NULL && system_id[0] != '\0') {
+        strncpy(entry->system_id, system_id, sizeof(entry->system_id) - 1);
+        entry->system_id[sizeof(entry->system_id) - 1] = '\0';
+        // The sensors are seeded from the system id; reseed them.
+        sensor_engine_track(entry->handle, sensor_kind_of(entry), entry->system_id);
+    }
+}
+
+void device_filter_init(DeviceFilter *filter) {
+    memset(filter, 0, sizeof(*filter));
+    filter->serial_min = LLONG_MIN;
+    filter->serial_max = LLONG_MAX;
+    filter->registered_min = LLONG_MIN;
+    filter->registered_max = LLONG_MAX;
+    filter->parent_handle = DEVICE_FILTER_ANY_PARENT;
+}
+
+// Collects up to max_handles matching handles, starting at *next_handle and
+// leaving it after the last slot examined, so a caller can page through the
+// registry in constant memory. The model prefix is resolved once per call
+// against the model table; the rest compares column values.
+int device_scan(const DeviceFilter *filter, int *next_handle, int *handles, int max_handles) {
+    unsigned char *model_mask = NULL;
+    if (filter->model_prefix[0] != '\0') {
+        model_mask = (unsigned char *)calloc(model_count_size + 1, 1);
+        if (model_mask == NULL) {
+            return 0;
+        }
+        size_t prefix_length = strlen(filter->model_prefix);
+        for (int i = 0; i < model_count_size; i++) {
+            model_mask[i] = strncmp(model_counts[i].model, filter->model_prefix, prefix_length) == 0;
+        }
+    }
+
+    int found = 0;
+    int handle = *next_handle < 0 ? 0 : *next_handle;
+    while (found < max_handles && handle < device_high_water) {
+        const DeviceColumns *columns = column_chunks[handle / DEVICE_CHUNK_SIZE];
+        int chunk_end = (handle / DEVICE_CHUNK_SIZE + 1) * DEVICE_CHUNK_SIZE;
+        if (chunk_end > device_high_water) {
+            chunk_end = device_high_water;
+        }
+        for (int slot = handle % DEVICE_CHUNK_SIZE; handle < chunk_end && found < max_handles; slot++, handle++) {
+            int model_id = columns->model_id[slot];
+            if (model_id < 0 || (model_mask != NULL && !model_mask[model_id])) {
+                continue;
+            }
+            if (columns->serial_number[slot] < filter->serial_min || columns->serial_number[slot] > filter->serial_max ||
+                columns->registration_date[slot] < filter->registered_min ||
+                columns->registration_date[slot] > filter->registered_max) {
+                continue;
+            }
+            if (filter->parent_handle != DEVICE_FILTER_ANY_PARENT && columns->parent_handle[slot] != filter->parent_handle) {
+                continue;
+            }
+            handles[found++] = handle;
+        }
+    }
+    *next_handle = handle;
+    free(model_mask);
+    return found;
+}
+
+
+// Every JSON persistence path ends here, so the probes around it see each write.
+static int write_json_file(struct json_object *root, const char *json_path) {
+    WAVE_PROBE1(json__write__start, json_path);
+    FILE *file = fopen(json_path, "w");
+    if (file == NULL) {
+        WAVE_PROBE3(json__write__done, json_path, 0L, 0);
+        return -1;
+    }
+    size_t length = 0;
+    const char *text = json_object_to_json_string_length(root, JSON_C_TO_STRING_PRETTY, &length);
+    mem_json_sample();
+    int ok = fwrite(text, 1, length, file) == length && fputc('\n', file) != EOF;
+    ok = fclose(file) == 0 && ok;
+    WAVE_PROBE3(json__write__done, json_path, (long)length + 1, ok);
+    return ok ? 0 : -1;
+}
 
 void add_device_to_json(DeviceEntry *device, const char *json_path, const char *parent_name) {
     char log_message[512];
@@ -146,6 +540,7 @@ void add_device_to_json(DeviceEntry *device, const char *json_path, const char *
     json_object_object_add(device_json, "SerialNumber", json_object_new_int(device->serial_number));
     json_object_object_add(device_json, "RegistrationDate", json_object_new_int64(device->registration_date));
     json_object_object_add(device_json, "System id", json_object_new_string(device->system_id));
+    json_object_object_add(device_json, "Inode", json_object_new_int64((int64_t)device->inode));
     if (device->type == FOLDER_TYPE) {
         json_object_object_add(device_json, "IMEI", json_object_new_string(device->imei));
         json_object_object_add(device_json, "Type", json_object_new_string("Folder"));
@@ -183,11 +578,9 @@ void add_device_to_json(DeviceEntry *device, const char *json_path, const char *
             }
         }
     }
+    json_object_object_add(root, "NextInode", json_object_new_int64((int64_t)next_device_inode));
 
-    file = fopen(json_path, "w");
-    if (file) {
-        fprintf(file, "%s\n", json_object_to_json_string_ext(root, JSON_C_TO_STRING_PRETTY));
-        fclose(file);
+    if (write_json_file(root, json_path) == 0) {
         snprintf(log_message, sizeof(log_message), "INFO: JSON data written successfully to file.");
         log_debug(log_message);
     } else {
@@ -297,10 +690,7 @@ void remove_device_from_json(const char *device_name, const char *json_path) {
                     snprintf(log_message, sizeof(log_message), "INFO: File '%s' removed successfully.", device_name);
                     log_debug(log_message);
 
-                    file = fopen(json_path, "w");
-                    if (file) {
-                        fprintf(file, "%s\n", json_object_to_json_string_ext(root, JSON_C_TO_STRING_PRETTY));
-                        fclose(file);
+                    if (write_json_file(root, json_path) == 0) {
                         snprintf(log_message, sizeof(log_message), "INFO: JSON data written successfully to file.");
                         log_debug(log_message);
                     } else {
@@ -327,10 +717,7 @@ void remove_device_from_json(const char *device_name, const char *json_path) {
     log_debug(log_message);
 
     // Save the updated JSON back to the file
-    file = fopen(json_path, "w");
-    if (file) {
-        fprintf(file, "%s\n", json_object_to_json_string_ext(root, JSON_C_TO_STRING_PRETTY));
-        fclose(file);
+    if (write_json_file(root, json_path) == 0) {
         snprintf(log_message, sizeof(log_message), "INFO: JSON data written successfully to file.");
         log_debug(log_message);
     } else {
@@ -341,3 +728,118 @@ void remove_device_from_json(const char *device_name, const char *json_path) {
     json_object_put(root);
 }
 
+int compare_handles(const void *a, const void *b) {
+    int left = *(const int *)a, right = *(const int *)b;
+    return (left > right) - (left < right);
+}
+
+// Deletes a set of top-level devices, sub-devices included, from the JSON
+// file with one read and one write. handles must be sorted, and the devices
+// still registered, since entries are matched through the registry by name.
+void remove_folders_from_json(const int *handles, int count, const char *json_path) {
+    char log_message[512];
+    if (count == 0) {
+        return;
+    }
+    struct json_object *root = json_object_from_file(json_path);
+    struct json_object *devices_array = NULL;
+    if (root == NULL || !json_object_object_get_ex(root, "devices", &devices_array)) {
+        log_debug("ERROR: Failed to load the devices array from JSON.");
+        json_object_put(root);
+        return;
+    }
+
+    int removed = 0;
+    for (size_t i = json_object_array_length(devices_array); i-- > 0; ) {
+        struct json_object *device = json_object_array_get_idx(devices_array, i);
+        struct json_object *name = NULL;
+        if (!json_object_object_get_ex(device, "Name", &name)) {
+            continue;
+        }
+        int handle = find_device_handle(json_object_get_string(name), "TTConnectWave", -1);
+        if (handle != -1 && bsearch(&handle, handles, count, sizeof(int), compare_handles) != NULL) {
+            json_object_array_del_idx(devices_array, i, 1);
+            removed++;
+        }
+    }
+
+    if (write_json_file(root, json_path) == 0) {
+        snprintf(log_message, sizeof(log_message), "INFO: %d devices removed from JSON.", removed);
+        log_debug(log_message);
+    } else {
+        snprintf(log_message, sizeof(log_message), "ERROR: Failed to open JSON file for writing.");
+        log_debug(log_message);
+    }
+    json_object_put(root);
+}
+
+static struct json_object *device_to_json(const DeviceEntry *device) {
+    struct json_object *device_json = json_object_new_object();
+    json_object_object_add(device_json, "Name", json_object_new_string(device->name));
+    json_object_object_add(device_json, "Model", json_object_new_string(device->model));
+    json_object_object_add(device_json, "SerialNumber", json_object_new_int(device->serial_number));
+    json_object_object_add(device_json, "RegistrationDate", json_object_new_int64(device->registration_date));
+    json_object_object_add(device_json, "System id", json_object_new_string(device->system_id));
+    json_object_object_add(device_json, "Inode", json_object_new_int64((int64_t)device->inode));
+    if (device->type == FOLDER_TYPE) {
+        json_object_object_add(device_json, "IMEI", json_object_new_string(device->imei));
+        json_object_object_add(device_json, "Type", json_object_new_string("Folder"));
+    } else {
+        json_object_object_add(device_json, "Type", json_object_new_string("File"));
+    }
+    return device_json;
+}
+
+// Rewrites the whole JSON file from the registry in a single pass. Batch
+// operations use this instead of add_device_to_json/remove_device_from_json,
+// which re-read and re-write the file for every device.
+void save_registry_to_json(const char *json_path) {
+    char log_message[512];
+
+    struct json_object *root = json_object_new_object();
+    struct json_object *devices_array = json_object_new_array();
+    json_object_object_add(root, "devices", devices_array);
+    json_object_object_add(root, "NextInode", json_object_new_int64((int64_t)next_device_inode));
+
+    struct json_object **children = (struct json_object **)calloc(device_high_water ? device_high_water : 1,
+                                                                  sizeof(struct json_object *));
+    if (children == NULL) {
+        log_debug("ERROR: Memory allocation failed while saving the registry.");
+        json_object_put(root);
+        return;
+    }
+
+    for (int handle = 0; handle < device_high_water; handle++) {
+        DeviceEntry *device = get_device_entry(handle);
+        if (device == NULL || device->type != FOLDER_TYPE) {
+            continue;
+        }
+        struct json_object *device_json = device_to_json(device);
+        children[handle] = json_object_new_array();
+        json_object_object_add(device_json, "Children", children[handle]);
+        json_object_array_add(devices_array, device_json);
+    }
+    for (int handle = 0; handle < device_high_water; handle++) {
+        DeviceEntry *device = get_device_entry(handle);
+        if (device == NULL || device->type != FILE_TYPE) {
+            continue;
+        }
+        if (device->parent_handle < 0 || children[device->parent_handle] == NULL) {
+            snprintf(log_message, sizeof(log_message), "ERROR: Device '%s' has no parent folder, not saved.", device->name);
+            log_debug(log_message);
+            continue;
+        }
+        json_object_array_add(children[device->parent_handle], device_to_json(device));
+    }
+    free(children);
+
+    if (write_json_file(root, json_path) == 0) {
+        snprintf(log_message, sizeof(log_message), "INFO: Registry of %d devices written to JSON.", device_count);
+        log_debug(log_message);
+    } else {
+        snprintf(log_message, sizeof(log_message), "ERROR: Failed to open JSON file for writing.");
+        log_debug(log_message);
+    }
+
+    json_object_put(root);
+}
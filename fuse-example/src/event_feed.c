@@ -0,0 +1,169 @@
+#include "event_feed.h"
+#include "mem_stats.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define EVENT_LINE_SIZE 320
+
+// One slot of the ring. Paths longer than the field are cut; device paths
+// are far shorter.
+typedef struct {
+    uint64_t seq;
+    int64_t time;
+    long long size;
+    unsigned char op;
+    char path[231];
+} EventRecord;
+
+_Static_assert(sizeof(EventRecord) == 256, "EventRecord should stay at 256 bytes");
+
+struct EventCursor {
+    uint64_t next_seq;          // next event to render
+    size_t line_length;
+    size_t line_offset;         // bytes of line already consumed
+    char line[EVENT_LINE_SIZE];
+};
+
+static const char *event_op_names[] = {"mkdir", "create", "unlink", "rmdir", "write", "truncate"};
+
+static EventRecord *event_ring = NULL;
+static size_t event_capacity = 0;
+static uint64_t event_next = 1;
+static _Atomic uint64_t event_published = 1;   // event_next, readable without the lock
+static pthread_mutex_t event_mutex = PTHREAD_MUTEX_INITIALIZER;
+static EventListener event_listener = NULL;
+
+// Oldest sequence number still in the ring. Called with event_mutex held.
+static uint64_t oldest_seq(void) {
+    return event_next > event_capacity ? event_next - event_capacity : 1;
+}
+
+int event_feed_configure(size_t capacity) {
+    EventRecord *ring = NULL;
+    if (capacity > 0) {
+        ring = (EventRecord *)calloc(capacity, sizeof(EventRecord));
+        if (ring == NULL) {
+            return -1;
+        }
+    }
+    pthread_mutex_lock(&event_mutex);
+    mem_account(MEM_BUFFERS, ((long long)capacity - (long long)event_capacity) * (long long)sizeof(EventRecord));
+    free(event_ring);
+    event_ring = ring;
+    event_capacity = capacity;
+    pthread_mutex_unlock(&event_mutex);
+    return 0;
+}
+
+void event_feed_set_listener(EventListener listener) {
+    event_listener = listener;
+}
+
+void event_feed_free(void) {
+    event_feed_configure(0);
+}
+
+void event_feed_append(EventOp op, const char *path, long long size) {
+    pthread_mutex_lock(&event_mutex);
+    if (event_capacity == 0) {
+        pthread_mutex_unlock(&event_mutex);
+        return;
+    }
+    uint64_t seq = event_next++;
+    EventRecord *record = &event_ring[seq % event_capacity];
+    record->seq = seq;
+    record->time = (int64_t)time(NULL);
+    record->op = (unsigned char)op;
+    record->size = size;
+    snprintf(record->path, sizeof(record->path), "%s", path);
+    atomic_store_explicit(&event_published, event_next, memory_order_release);
+    pthread_mutex_unlock(&event_mutex);
+
+    EventListener listener = event_listener;
+    if (listener != NULL) {
+        listener(seq);
+    }
+}
+
+uint64_t event_feed_next_seq(void) {
+    return atomic_load_explicit(&event_published, memory_order_acquire);
+}
+
+EventCursor *event_feed_open(uint64_t from_seq) {
+    EventCursor *cursor = (EventCursor *)calloc(1, sizeof(EventCursor));
+    if (cursor == NULL) {
+        return NULL;
+    }
+    if (from_seq == 0) {
+        pthread_mutex_lock(&event_mutex);
+        from_seq = oldest_seq();
+        pthread_mutex_unlock(&event_mutex);
+    }
+    cursor->next_seq = from_seq;
+    mem_account(MEM_BUFFERS, sizeof(EventCursor));
+    return cursor;
+}
+
+// Renders the next line into the cursor; returns 0 when there is none yet.
+static int next_event_line(EventCursor *cursor) {
+    int found = 0;
+    pthread_mutex_lock(&event_mutex);
+    uint64_t oldest = oldest_seq();
+    if (event_capacity > 0 && cursor->next_seq < oldest) {
+        cursor->line_length = snprintf(cursor->line, sizeof(cursor->line), "%llu %lld overflow %llu\n",
+                                       (unsigned long long)cursor->next_seq, (long long)time(NULL),
+                                       (unsigned long long)(oldest - cursor->next_seq));
+        cursor->next_seq = oldest;
+        found = 1;
+    } else if (event_capacity > 0 && cursor->next_seq < event_next) {
+        const EventRecord *record = &event_ring[cursor->next_seq % event_capacity];
+        int length = snprintf(cursor->line, sizeof(cursor->line), "%llu %lld %s %s",
+                              (unsigned long long)record->seq, (long long)record->time,
+                              event_op_names[record->op], record->path);
+        if (record->op == EVENT_WRITE || record->op == EVENT_TRUNCATE) {
+            length += snprintf(cursor->line + length, sizeof(cursor->line) - length, " %lld", record->size);
+        }
+        cursor->line[length++] = '\n';
+        cursor->line_length = length;
+        cursor->next_seq++;
+        found = 1;
+    }
+    pthread_mutex_unlock(&event_mutex);
+    if (!found) {
+        cursor->line_length = 0;
+    }
+    cursor->line_offset = 0;
+    return found;
+}
+
+size_t event_feed_read(EventCursor *cursor, char *buf, size_t size) {
+    size_t copied = 0;
+    while (copied < size) {
+        if (cursor->line_offset == cursor->line_length && !next_event_line(cursor)) {
+            break;
+        }
+        size_t chunk = cursor->line_length - cursor->line_offset;
+        if (chunk > size - copied) {
+            chunk = size - copied;
+        }
+        memcpy(buf + copied, cursor->line + cursor->line_offset, chunk);
+        cursor->line_offset += chunk;
+        copied += chunk;
+    }
+    return copied;
+}
+
+int event_feed_pending(const EventCursor *cursor) {
+    return cursor->line_offset < cursor->line_length || cursor->next_seq < event_feed_next_seq();
+}
+
+void event_feed_close(EventCursor *cursor) {
+    if (cursor != NULL) {
+        mem_account(MEM_BUFFERS, -(long long)sizeof(EventCursor));
+        free(cursor);
+    }
+}
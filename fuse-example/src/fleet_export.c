@@ -0,0 +1,274 @@
+#include "fleet_export.h"
+#include "device_manager.h"
+#include "mem_stats.h"
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define EXPORT_RECORD_SIZE 1024
+#define EXPORT_BATCH_SIZE 256
+
+struct FleetExportCursor {
+    FleetExportFormat format;
+    DeviceFilter filter;
+    int header_done;
+    int next_handle;            // first handle not yet scanned
+    int batch[EXPORT_BATCH_SIZE];   // matching handles from the last scan
+    int batch_count;
+    int batch_position;
+    off_t position;             // listing offset of record[0]
+    size_t record_length;
+    size_t record_offset;       // bytes of record already consumed
+    char record[EXPORT_RECORD_SIZE];
+};
+
+static const char *csv_header = "name,model,serial_number,imei,system_id,parent,registration_date\n";
+
+// Appends value to out, quoted when it contains a separator, a quote or a
+// newline. Returns the new length.
+static size_t append_csv_field(char *out, size_t length, size_t capacity, const char *value) {
+    if (strpbrk(value, ",\"\n") == NULL) {
+        int written = snprintf(out + length, capacity - length, "%s", value);
+        return written < 0 ? length : length + (size_t)written;
+    }
+    if (length < capacity - 1) {
+        out[length++] = '"';
+    }
+    for (const char *c = value; *c != '\0' && length < capacity - 4; c++) {
+        if (*c == '"') {
+            out[length++] = '"';
+        }
+        out[length++] = *c;
+    }
+    out[length++] = '"';
+    out[length] = '\0';
+    return length;
+}
+
+static size_t append_json_string(char *out, size_t length, size_t capacity, const char *value) {
+    if (length < capacity - 1) {
+        out[length++] = '"';
+    }
+    for (const unsigned char *c = (const unsigned char *)value; *c != '\0' && length < capacity - 8; c++) {
+        if (*c == '"' || *c == '\\') {
+            out[length++] = '\\';
+            out[length++] = *c;
+        } else if (*c < 0x20) {
+            length += snprintf(out + length, capacity - length, "\\u%04x", *c);
+        } else {
+            out[length++] = *c;
+        }
+    }
+    out[length++] = '"';
+    out[length] = '\0';
+    return length;
+}
+
+static size_t render_csv_record(const DeviceEntry *device, const char *parent, char *out, size_t capacity) {
+    size_t length = append_csv_field(out, 0, capacity, device->name);
+    length += snprintf(out + length, capacity - length, ",%s,%d,", device->model, device->serial_number);
+    length = append_csv_field(out, length, capacity, device->imei);
+    length += snprintf(out + length, capacity - length, ",%s,", device->system_id);
+    length = append_csv_field(out, length, capacity, parent);
+    length += snprintf(out + length, capacity - length, ",%lld\n", (long long)device->registration_date);
+    return length < capacity ? length : capacity - 1;
+}
+
+static size_t render_ndjson_record(const DeviceEntry *device, const char *parent, char *out, size_t capacity) {
+    size_t length = (size_t)snprintf(out, capacity, "{\"name\":");
+    length = append_json_string(out, length, capacity, device->name);
+    length += snprintf(out + length, capacity - length, ",\"model\":\"%s\",\"serial_number\":%d,\"imei\":",
+                       device->model, device->serial_number);
+    length = append_json_string(out, length, capacity, device->imei);
+    length += snprintf(out + length, capacity - length, ",\"system_id\":\"%s\",\"parent\":", device->system_id);
+    if (parent[0] != '\0') {
+        length = append_json_string(out, length, capacity, parent);
+    } else {
+        length += snprintf(out + length, capacity - length, "null");
+    }
+    length += snprintf(out + length, capacity - length, ",\"registration_date\":%lld}\n",
+                       (long long)device->registration_date);
+    return length < capacity ? length : capacity - 1;
+}
+
+// Renders the next record into cursor->record. Returns 0 at the end.
+static int next_record(FleetExportCursor *cursor) {
+    cursor->position += cursor->record_length;
+    cursor->record_length = 0;
+    cursor->record_offset = 0;
+    if (!cursor->header_done) {
+        cursor->header_done = 1;
+        if (cursor->format == FLEET_EXPORT_CSV) {
+            cursor->record_length = (size_t)snprintf(cursor->record, sizeof(cursor->record), "%s", csv_header);
+            return 1;
+        }
+    }
+    for (;;) {
+        if (cursor->batch_position == cursor->batch_count) {
+            cursor->batch_position = 0;
+            cursor->batch_count = device_scan(&cursor->filter, &cursor->next_handle, cursor->batch, EXPORT_BATCH_SIZE);
+            if (cursor->batch_count == 0) {
+                return 0;
+            }
+        }
+        const DeviceEntry *device = get_device_entry(cursor->batch[cursor->batch_position++]);
+        if (device == NULL) {
+            continue;
+        }
+        const DeviceEntry *parent = get_device_entry(device->parent_handle);
+        const char *parent_name = parent != NULL ? parent->name : "";
+        if (cursor->format == FLEET_EXPORT_CSV) {
+            cursor->record_length = render_csv_record(device, parent_name, cursor->record, sizeof(cursor->record));
+        } else {
+            cursor->record_length = render_ndjson_record(device, parent_name, cursor->record, sizeof(cursor->record));
+        }
+        return 1;
+    }
+}
+
+static void rewind_cursor(FleetExportCursor *cursor) {
+    cursor->header_done = 0;
+    cursor->next_handle = 0;
+    cursor->batch_count = 0;
+    cursor->batch_position = 0;
+    cursor->position = 0;
+    cursor->record_length = 0;
+    cursor->record_offset = 0;
+}
+
+FleetExportCursor *fleet_export_open(FleetExportFormat format, const DeviceFilter *filter) {
+    FleetExportCursor *cursor = (FleetExportCursor *)calloc(1, sizeof(FleetExportCursor));
+    if (cursor == NULL) {
+        return NULL;
+    }
+    mem_account(MEM_BUFFERS, sizeof(FleetExportCursor));
+    cursor->format = format;
+    if (filter != NULL) {
+        cursor->filter = *filter;
+    } else {
+        device_filter_init(&cursor->filter);
+    }
+    return cursor;
+}
+
+size_t fleet_export_read(FleetExportCursor *cursor, char *buf, size_t size, off_t offset) {
+    if (offset < cursor->position + (off_t)cursor->record_offset) {
+        rewind_cursor(cursor);
+    }
+    size_t copied = 0;
+    while (copied < size) {
+        if (cursor->record_offset == cursor->record_length && !next_record(cursor)) {
+            break;
+        }
+        off_t current = cursor->position + (off_t)cursor->record_offset;
+        size_t available = cursor->record_length - cursor->record_offset;
+        if (current < offset) {
+            size_t skip = (size_t)(offset - current) < available ? (size_t)(offset - current) : available;
+            cursor->record_offset += skip;
+            continue;
+        }
+        size_t chunk = size - copied < available ? size - copied : available;
+        memcpy(buf + copied, cursor->record + cursor->record_offset, chunk);
+        cursor->record_offset += chunk;
+        copied += chunk;
+    }
+    return copied;
+}
+
+void fleet_export_close(FleetExportCursor *cursor) {
+    if (cursor != NULL) {
+        mem_account(MEM_BUFFERS, -(long long)sizeof(FleetExportCursor));
+        free(cursor);
+    }
+}
+
+// Parses LO..HI, LO.., ..HI or a single value into an inclusive range.
+static int parse_range(const char *value, long long *min, long long *max) {
+    const char *dots = strstr(value, "..");
+    char *end;
+    if (dots == NULL) {
+        *min = *max = strtoll(value, &end, 10);
+        return end != value && *end == '\0';
+    }
+    if (dots != value) {
+        *min = strtoll(value, &end, 10);
+        if (end != dots) {
+            return 0;
+        }
+    }
+    if (dots[2] != '\0') {
+        *max = strtoll(dots + 2, &end, 10);
+        if (*end != '\0') {
+            return 0;
+        }
+    }
+    return *min <= *max;
+}
+
+int fleet_query_parse(const char *text, DeviceFilter *filter, FleetExportFormat *format,
+                      char *error, size_t error_size) {
+    device_filter_init(filter);
+    *format = FLEET_EXPORT_CSV;
+    error[0] = '\0';
+
+    char term[256];
+    const char *cursor = text;
+    while (*cursor != '\0') {
+        cursor += strspn(cursor, " \t\r\n");
+        size_t length = strcspn(cursor, " \t\r\n");
+        if (length == 0) {
+            break;
+        }
+        if (length >= sizeof(term)) {
+            snprintf(error, error_size, "term too long: %.32s...", cursor);
+            return -EINVAL;
+        }
+        memcpy(term, cursor, length);
+        term[length] = '\0';
+        cursor += length;
+
+        char *value = strchr(term, '=');
+        if (value == NULL) {
+            snprintf(error, error_size, "expected key=value: %s", term);
+            return -EINVAL;
+        }
+        *value++ = '\0';
+        int valid = 1;
+        if (strcmp(term, "model") == 0) {
+            valid = strlen(value) < sizeof(filter->model_prefix);
+            snprintf(filter->model_prefix, sizeof(filter->model_prefix), "%s", value);
+        } else if (strcmp(term, "serial") == 0) {
+            valid = parse_range(value, &filter->serial_min, &filter->serial_max);
+        } else if (strcmp(term, "registered") == 0) {
+            valid = parse_range(value, &filter->registered_min, &filter->registered_max);
+        } else if (strcmp(term, "parent") == 0) {
+            if (strcmp(value, "/") == 0) {
+                filter->parent_handle = -1;
+            } else {
+                filter->parent_handle = find_device_handle(value, "TTConnectWave", -1);
+                if (filter->parent_handle == -1) {
+                    snprintf(error, error_size, "no such device: %s", value);
+                    return -EINVAL;
+                }
+            }
+        } else if (strcmp(term, "format") == 0) {
+            if (strcmp(value, "csv") == 0) {
+                *format = FLEET_EXPORT_CSV;
+            } else if (strcmp(value, "ndjson") == 0) {
+                *format = FLEET_EXPORT_NDJSON;
+            } else {
+                valid = 0;
+            }
+        } else {
+            snprintf(error, error_size, "unknown key: %s", term);
+            return -EINVAL;
+        }
+        if (!valid) {
+            snprintf(error, error_size, "invalid %s: %s", term, value);
+            return -EINVAL;
+        }
+    }
+    return 0;
+}
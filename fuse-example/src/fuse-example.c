@@ -1,4 +1,4 @@
-#define FUSE_USE_VERSION 26
+#define FUSE_USE_VERSION 29
 #define MAX_STATS 100
 
 #include <libgen.h>
@@ -14,26 +14,49 @@
 #include <sys/stat.h>
 #include <limits.h>
 #include "device_manager.h"
+#include "op_metrics.h"
+#include "op_trace.h"
+#include "wave_probes.h"
+#include "slow_ops.h"
+#include "mem_stats.h"
+#include "fleet_export.h"
+#include "wave_ioctl.h"
+#include "sensor_engine.h"
+#include "event_feed.h"
+#include "actuator_queue.h"
+#include "fuse_example.h"
 #include <stdarg.h>
 #include <time.h>
 #include<json-c/json.h>
 #include <mntent.h>
+#include <stdint.h>
+#include <poll.h>
+#include <pthread.h>
 
 static const char *log_file_path = "/home/boskobrankovic/RTOS/FUSE_project/anadolu_fs/fuse-example/fuse_debug_log.txt";
 static const char *important_log_file_path = "/home/boskobrankovic/RTOS/FUSE_project/anadolu_fs/fuse-example/important_log_file.txt";
+static const char *ops_dump_file_path = "/home/boskobrankovic/RTOS/FUSE_project/anadolu_fs/fuse-example/ops_stats_dump.txt";
+static const char *slow_ops_file_path = "/home/boskobrankovic/RTOS/FUSE_project/anadolu_fs/fuse-example/slow_ops_log.txt";
 const char *json_path = "/home/boskobrankovic/RTOS/FUSE_project/anadolu_fs/fuse-example/json_test_example.json";
 
 
+// Persistence runs inside a slow-op phase, and the json-c trees it builds
+// are measured for /.stats/memory.
+#define PERSIST(statement) \
+    SLOW_OP_PHASE(SLOW_PHASE_PERSIST, mem_json_begin(); statement; mem_json_end())
+
+// Returns a reference the caller releases with json_object_put.
 struct json_object* find_device(const char* device_name, const char* json_path) {
     char log_message[512];
-    char *real_device_name = strtok(strdup(device_name), ".");
-    snprintf(log_message, sizeof(log_message), "INFO: %s.", real_device_name);
-    log_debug(log_message);
     if (device_name == NULL || json_path == NULL) {
         snprintf(log_message, sizeof(log_message), "ERROR: Invalid arguments passed to find_device.");
         log_debug(log_message);
         return NULL;
     }
+    char real_device_name[256];
+    snprintf(real_device_name, sizeof(real_device_name), "%.*s", (int)strcspn(device_name, "."), device_name);
+    snprintf(log_message, sizeof(log_message), "INFO: %s.", real_device_name);
+    log_debug(log_message);
 
     snprintf(log_message, sizeof(log_message), "INFO: Entering find_device function.");
     log_debug(log_message);
@@ -62,6 +85,7 @@ struct json_object* find_device(const char* device_name, const char* json_path)
     fclose(file);
 
     struct json_object* root = json_tokener_parse(data);
+    mem_json_sample();
     free(data);
 
     if (!root) {
@@ -113,99 +137,126 @@ struct json_object* find_device(const char* device_name, const char* json_path)
     return NULL;
 }
 
-const char* find_imei(char *device_name, char *json_path) {
-    char log_message[512];
-
-    FILE *file = fopen(json_path, "r");
-    if (!file) {
-        snprintf(log_message, sizeof(log_message), "ERROR: Failed to open JSON file: %s", json_path);
-        log_debug(log_message);
-        return NULL; 
-    }
-
-    
-    fseek(file, 0, SEEK_END);
-    size_t size = ftell(file);
-    fseek(file, 0, SEEK_SET);
-
-    char *data = malloc(size + 1);
-    if (!data) {
-        fclose(file);
-        snprintf(log_message, sizeof(log_message), "ERROR: Memory allocation failed.");
-        log_debug(log_message);
-        return NULL;
-    }
+// FUSE_EXAMPLE_DATA_DIR moves the log files, the JSON file and the stats
+// dump into another directory, and FUSE_EXAMPLE_DEBUG_LOG=0 turns the debug
+// log off. Benchmarks use both to run in a scratch directory.
+// FUSE_EXAMPLE_RESTORE=0 starts from an empty registry instead of the
+// devices saved in the JSON file.
+static int restore_registry = 1;
+
+static void configure_paths_from_env(void) {
+    static char data_dir_paths[5][PATH_MAX];
+    const char *data_dir = getenv("FUSE_EXAMPLE_DATA_DIR");
+    if (data_dir != NULL && *data_dir != '\0') {
+        snprintf(data_dir_paths[0], PATH_MAX, "%s/fuse_debug_log.txt", data_dir);
+        snprintf(data_dir_paths[1], PATH_MAX, "%s/important_log_file.txt", data_dir);
+        snprintf(data_dir_paths[2], PATH_MAX, "%s/json_test_example.json", data_dir);
+        snprintf(data_dir_paths[3], PATH_MAX, "%s/ops_stats_dump.txt", data_dir);
+        snprintf(data_dir_paths[4], PATH_MAX, "%s/slow_ops_log.txt", data_dir);
+        log_file_path = data_dir_paths[0];
+        important_log_file_path = data_dir_paths[1];
+        json_path = data_dir_paths[2];
+        ops_dump_file_path = data_dir_paths[3];
+        slow_ops_file_path = data_dir_paths[4];
+    }
+    const char *debug_log = getenv("FUSE_EXAMPLE_DEBUG_LOG");
+    if (debug_log != NULL && strcmp(debug_log, "0") == 0) {
+        log_file_path = NULL;
+    }
+    const char *restore = getenv("FUSE_EXAMPLE_RESTORE");
+    restore_registry = restore == NULL || strcmp(restore, "0") != 0;
+}
 
-    fread(data, 1, size, file);
-    data[size] = '\0';  
-    fclose(file);
+static unsigned long long env_number(const char *name, unsigned long long default_value) {
+    const char *value = getenv(name);
+    return value != NULL && *value != '\0' ? strtoull(value, NULL, 10) : default_value;
+}
 
-    
-    struct json_object *root = json_tokener_parse(data);
-    free(data);
+// FUSE_EXAMPLE_MEMORY_CAP_MB sets the soft cap on accounted memory; new
+// devices are refused with ENOSPC above it.
+static void configure_memory_cap_from_env(void) {
+    mem_set_soft_cap((long long)env_number("FUSE_EXAMPLE_MEMORY_CAP_MB", 0) * 1024 * 1024);
+}
 
-    if (!root) {
-        snprintf(log_message, sizeof(log_message), "ERROR: Failed to parse JSON.");
-        log_debug(log_message);
-        return NULL;
-    }
+// FUSE_EXAMPLE_SENSOR_TICK_MS is how often the simulated sensors move
+// (default 1000 ms, 0 keeps them still) and FUSE_EXAMPLE_SENSOR_THREADS how
+// many threads share a tick (default: the online CPUs).
+// FUSE_EXAMPLE_HISTORY_BYTES is what each device keeps of its GPS and GYRO
+// history (default 256, 0 turns the history files empty).
+static unsigned int sensor_tick_ms = 1000;
+static unsigned int sensor_tick_threads = 1;
+
+static void configure_sensors_from_env(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    sensor_tick_ms = (unsigned int)env_number("FUSE_EXAMPLE_SENSOR_TICK_MS", 1000);
+    sensor_tick_threads = (unsigned int)env_number("FUSE_EXAMPLE_SENSOR_THREADS", cpus > 0 ? cpus : 1);
+    sensor_engine_configure_history((size_t)env_number("FUSE_EXAMPLE_HISTORY_BYTES", 256));
+}
 
-    
-    struct json_object *devices_array = NULL;
-    if (!json_object_object_get_ex(root, "devices", &devices_array)) {
-        snprintf(log_message, sizeof(log_message), "ERROR: Devices array not found in JSON.");
-        log_debug(log_message);
-        json_object_put(root);
-        return NULL;
+// FUSE_EXAMPLE_EVENT_RING is the number of change events /.events keeps
+// (default 8192, 256 bytes each, 0 turns the feed off).
+static void configure_events_from_env(void) {
+    size_t capacity = (size_t)env_number("FUSE_EXAMPLE_EVENT_RING", 8192);
+    if (event_feed_configure(capacity) != 0) {
+        fprintf(stderr, "fuse-example: cannot allocate %zu change events\n", capacity);
     }
+}
 
-    
-    for (int i = 0; i < json_object_array_length(devices_array); i++) {
-        struct json_object *device = json_object_array_get_idx(devices_array, i);
-        struct json_object *name_obj = NULL;
+// FUSE_EXAMPLE_ACTUATOR_RATE turns on the simulated actuators: each of
+// FUSE_EXAMPLE_ACTUATOR_WORKERS workers (default 2) applies that many
+// commands per second from per-device queues of FUSE_EXAMPLE_ACTUATOR_QUEUE
+// commands (default 16). At 0, the default, writes apply commands directly.
+static unsigned int actuator_rate = 0;
+static unsigned int actuator_workers = 2;
+static unsigned int actuator_queue_depth = 16;
+
+static void configure_actuators_from_env(void) {
+    actuator_rate = (unsigned int)env_number("FUSE_EXAMPLE_ACTUATOR_RATE", 0);
+    actuator_workers = (unsigned int)env_number("FUSE_EXAMPLE_ACTUATOR_WORKERS", 2);
+    actuator_queue_depth = (unsigned int)env_number("FUSE_EXAMPLE_ACTUATOR_QUEUE", 16);
+}
 
-        if (json_object_object_get_ex(device, "Name", &name_obj) &&
-            strcmp(json_object_get_string(name_obj), device_name) == 0) {
-            
-            struct json_object *imei_obj = NULL;
-            if (json_object_object_get_ex(device, "IMEI", &imei_obj)) {
-                const char *imei = json_object_get_string(imei_obj);
-                json_object_put(root);  
-                return imei;  
-            } else {
-                snprintf(log_message, sizeof(log_message), "IMEI not found for device: %s", device_name);
-                log_debug(log_message);
-                json_object_put(root);
-                return NULL;  
-            }
-        }
+// Callbacks slower than FUSE_EXAMPLE_SLOW_OP_US (default 50 ms, 0 turns the
+// log off) go to slow_ops_log.txt, which is rotated at
+// FUSE_EXAMPLE_SLOW_OP_LOG_KB. FUSE_EXAMPLE_SLOW_OP_STACKS=N adds a stack
+// to every Nth entry.
+static void configure_slow_ops_from_env(void) {
+    uint64_t threshold_us = env_number("FUSE_EXAMPLE_SLOW_OP_US", 50000);
+    size_t max_bytes = env_number("FUSE_EXAMPLE_SLOW_OP_LOG_KB", 1024) * 1024;
+    unsigned stack_every = (unsigned)env_number("FUSE_EXAMPLE_SLOW_OP_STACKS", 0);
+    if (slow_ops_configure(slow_ops_file_path, threshold_us, max_bytes, stack_every) != 0) {
+        fprintf(stderr, "fuse-example: cannot open slow operation log %s\n", slow_ops_file_path);
     }
-
-    
-    snprintf(log_message, sizeof(log_message), "Device '%s' not found in JSON.", device_name);
-    log_debug(log_message);
-    json_object_put(root);
-    return NULL;  
 }
 
 extern void log_debug(const char *message) {
-    
+    if (log_file_path == NULL) {
+        return;
+    }
+    WAVE_PROBE1(log__flush__start, log_file_path);
+    SlowOpPhase previous_phase = slow_op_phase_enter(SLOW_PHASE_LOG);
     FILE *log_file = fopen(log_file_path, "a");
     
     if (log_file) {
         fprintf(log_file, "%s\n", message);
         fclose(log_file);
     }
+    slow_op_phase_exit(previous_phase);
+    WAVE_PROBE1(log__flush__done, log_file_path);
 }
 
 extern void important_log_debug(const char *message) {
     
+    WAVE_PROBE1(log__flush__start, important_log_file_path);
+    SlowOpPhase previous_phase = slow_op_phase_enter(SLOW_PHASE_LOG);
     FILE *log_file = fopen(important_log_file_path, "a");
     
     if (log_file) {
         fprintf(log_file, "%s\n", message);
         fclose(log_file);
     }
+    slow_op_phase_exit(previous_phase);
+    WAVE_PROBE1(log__flush__done, important_log_file_path);
 }
 
 
@@ -223,13 +274,29 @@ typedef struct {
     char *data;        
     size_t capacity;   
     char read_type[20];
+    int device_handle; // registry handle of the sub-device
+    uint64_t cached_version; // VALUE version when last opened for reading, see open_callback
 } File;
 
 
+// Open-addressed hash index from a directory and name to a position in the
+// file or directory list, so lookups do not scan the lists. Slots hold the
+// position + 1 (0 is empty) and the table stays at most half full. Removal
+// shifts the rest of the probe run back instead of leaving tombstones.
+typedef struct {
+    size_t *slots;
+    size_t mask;        // slot count - 1
+    size_t count;
+} PathIndex;
+
+// Hash of the key of a list position, for rehashing and removal.
+typedef uint64_t (*PathIndexKey)(const void *list, size_t position);
+
 typedef struct {
     File **files;
     size_t size;
     size_t capacity;
+    PathIndex index;   // by directory and name
 } FileList;
 
 typedef struct {
@@ -237,99 +304,224 @@ typedef struct {
     char **dirs;
     size_t capacity;
     struct stat *stats;
+    int *handles;      // registry handle of the device each directory represents
+    PathIndex index;   // by path
 } DirList;
 
 static FileList file_list;
 static DirList dir_list;
 
+// Set by init_callback; the root and the control nodes report it as their
+// atime, mtime and ctime.
+static time_t mount_time;
+
+// Bytes per DirList slot across its three parallel arrays.
+#define DIR_LIST_ENTRY_BYTES (sizeof(char *) + sizeof(struct stat) + sizeof(int))
+
+// FNV-1a of directory, or of directory "/" name when name is given.
+static uint64_t path_hash(const char *directory, const char *name) {
+    uint64_t hash = 14695981039346656037ull;
+    for (const char *c = directory; *c != '\0'; c++) {
+        hash = (hash ^ (unsigned char)*c) * 1099511628211ull;
+    }
+    if (name != NULL) {
+        hash = (hash ^ '/') * 1099511628211ull;
+        for (const char *c = name; *c != '\0'; c++) {
+            hash = (hash ^ (unsigned char)*c) * 1099511628211ull;
+        }
+    }
+    return hash;
+}
+
+static uint64_t file_list_key(const void *list, size_t position) {
+    const File *file = ((const FileList *)list)->files[position];
+    return path_hash(file->directory, file->name);
+}
+
+static uint64_t dir_list_key(const void *list, size_t position) {
+    return path_hash(((const DirList *)list)->dirs[position], NULL);
+}
+
+static void path_index_free(PathIndex *index) {
+    if (index->slots != NULL) {
+        mem_account(MEM_LISTS, -(long long)((index->mask + 1) * sizeof(size_t)));
+    }
+    free(index->slots);
+    memset(index, 0, sizeof(*index));
+}
+
+static void path_index_place(PathIndex *index, uint64_t hash, size_t position) {
+    size_t slot = hash & index->mask;
+    while (index->slots[slot] != 0) {
+        slot = (slot + 1) & index->mask;
+    }
+    index->slots[slot] = position + 1;
+}
+
+static void path_index_insert(PathIndex *index, const void *list, PathIndexKey key, size_t position) {
+    size_t old_count = index->slots != NULL ? index->mask + 1 : 0;
+    if ((index->count + 1) * 2 > old_count) {
+        size_t slot_count = old_count > 0 ? old_count * 2 : 64;
+        size_t *old_slots = index->slots;
+        index->slots = (size_t *)calloc(slot_count, sizeof(size_t));
+        if (index->slots == NULL) {
+            perror("Failed to resize path index");
+            exit(EXIT_FAILURE);
+        }
+        index->mask = slot_count - 1;
+        mem_account(MEM_LISTS, (long long)((slot_count - old_count) * sizeof(size_t)));
+        for (size_t i = 0; i < old_count; i++) {
+            if (old_slots[i] != 0) {
+                path_index_place(index, key(list, old_slots[i] - 1), old_slots[i] - 1);
+            }
+        }
+        free(old_slots);
+    }
+    path_index_place(index, key(list, position), position);
+    index->count++;
+}
+
+// Slot holding position, whose key hashes to hash, or SIZE_MAX.
+static size_t path_index_slot(const PathIndex *index, uint64_t hash, size_t position) {
+    if (index->slots == NULL) {
+        return SIZE_MAX;
+    }
+    for (size_t slot = hash & index->mask; index->slots[slot] != 0; slot = (slot + 1) & index->mask) {
+        if (index->slots[slot] == position + 1) {
+            return slot;
+        }
+    }
+    return SIZE_MAX;
+}
+
+// Call while the key of position is still readable.
+static void path_index_remove(PathIndex *index, const void *list, PathIndexKey key, size_t position) {
+    size_t hole = path_index_slot(index, key(list, position), position);
+    if (hole == SIZE_MAX) {
+        return;
+    }
+    index->slots[hole] = 0;
+    index->count--;
+    for (size_t slot = (hole + 1) & index->mask; index->slots[slot] != 0; slot = (slot + 1) & index->mask) {
+        size_t home = key(list, index->slots[slot] - 1) & index->mask;
+        // An entry can move back into the hole unless its home slot lies
+        // after the hole in the probe run.
+        if (((slot - home) & index->mask) >= ((slot - hole) & index->mask)) {
+            index->slots[hole] = index->slots[slot];
+            index->slots[slot] = 0;
+            hole = slot;
+        }
+    }
+}
+
+// Records that the entry at from, whose key hashes to hash, moved to to.
+static void path_index_move(PathIndex *index, uint64_t hash, size_t from, size_t to) {
+    size_t slot = path_index_slot(index, hash, from);
+    if (slot != SIZE_MAX) {
+        index->slots[slot] = to + 1;
+    }
+}
+
+// Bytes a File holds, charged to MEM_FILE_DATA. capacity is the size of the
+// data allocation.
+static long long file_footprint(const File *file) {
+    return sizeof(File) + strlen(file->name) + 1 + strlen(file->directory) + 1 + file->capacity;
+}
+
+// Replaces the data buffer of a file; allocated is the size of the new
+// allocation. Frees the old buffer.
+static void set_file_data(File *file, char *data, size_t allocated) {
+    mem_account(MEM_FILE_DATA, (long long)allocated - (long long)file->capacity);
+    free(file->data);
+    file->data = data;
+    file->capacity = data != NULL ? allocated : 0;
+}
+
 long calculate_file_size(const char *file_path);
 long calculate_directory_size(const char *dir_path);
 int find_dir(const DirList *list, const char *dir_path);
+void generate_random_string(char *random_string, size_t length);
 
 
 void init_file_list(FileList *list, size_t initial_capacity) {
     list->files = (File**)calloc(initial_capacity,sizeof(File *));
     list->size = 0;
     list->capacity = initial_capacity;
+    memset(&list->index, 0, sizeof(list->index));
+    mem_account(MEM_LISTS, initial_capacity * sizeof(File *));
 }
 
 void init_dir_list(DirList *list, size_t initial_capacity) {
     list->dirs = (char **)calloc(initial_capacity, sizeof(char *));
     list->stats = (struct stat *)calloc(initial_capacity, sizeof(struct stat));
+    list->handles = (int *)calloc(initial_capacity, sizeof(int));
     list->size = 0;
     list->capacity = initial_capacity;
+    memset(&list->index, 0, sizeof(list->index));
+    mem_account(MEM_LISTS, initial_capacity * DIR_LIST_ENTRY_BYTES);
 }
 
 void free_dir_list(DirList *list) {
     for (size_t i = 0; i < list->size; i++) {
+        mem_account(MEM_LISTS, -(long long)(strlen(list->dirs[i]) + 1));
         free(list->dirs[i]);  
     }
+    mem_account(MEM_LISTS, -(long long)(list->capacity * DIR_LIST_ENTRY_BYTES));
     free(list->dirs);
     free(list->stats);
+    free(list->handles);
+    path_index_free(&list->index);
     list->dirs = NULL;
     list->stats = NULL;
+    list->handles = NULL;
     list->size = 0;
     list->capacity = 0;
 }
 
-void add_file(FileList *list, const char *name, char *directory) {
+// Actuators only take commands and sensors are read-only.
+static mode_t sub_device_file_mode(const char *model) {
+    if (strcmp(model, "ACTUATOR") == 0) {
+        return __S_IFREG | 0222;
+    }
+    if (strcmp(model, "SENSOR") == 0) {
+        return __S_IFREG | 0444;
+    }
+    return __S_IFREG | 0644;
+}
+
+File *add_file(FileList *list, const char *name, char *directory, int device_handle) {
     if (list->size >= list->capacity) {
+        mem_account(MEM_LISTS, list->capacity * sizeof(File *));
         list->capacity *= 2;
         list->files = realloc(list->files, list->capacity * sizeof(File *));
     }
 
-    File *new_file = (File *)malloc(sizeof(File));
+    File *new_file = (File *)calloc(1, sizeof(File));
     new_file->name = strdup(name);
-    if(!strcmp(name,"GYRO") || !strcmp(name,"IMEI") || !strcmp(name,"GPS")) {
-        log_debug("log_message");
-        new_file->data = (char*)calloc(10,sizeof(char)); 
-        new_file->stat.st_mode = __S_IFREG | 0444;
-        if(!strcmp(name,"GYRO")){ 
-            log_debug("inside strcmp for GYRO.");
-            size_t len = strlen(new_file->data);
-            new_file->data[len] = '0' + rand()%10;
-            new_file->data[len+1] = ' ';
-            new_file->data[len + 2] = '0' + rand()%10;
-            new_file->data[len+3] = ' '; 
-            new_file->data[len + 4] = '0' + rand()%10; 
-            new_file->data[len + 5] = '\n';
-            new_file->data[len + 6] = '\0';
-        } 
-        if(!strcmp(name,"GPS")){
-            log_debug("inside strcmp for GPS.");
-            size_t len = strlen(new_file->data);
-            new_file->data[len] = '0' + rand()%10;
-            new_file->data[len+1] = ' ';
-            new_file->data[len + 2] = '0' + rand()%10; 
-            new_file->data[len + 3] = '\n';
-            new_file->data[len + 4] = '\0';
-        }    
-        if(!strcmp(name,"IMEI")){
-            log_debug("inside strcmp for IMEI.");
-            char *dir = strtok(directory,".");
-            const char* dev_imei = find_imei(dir+1,json_path);
-            new_file->data = strdup(dev_imei);
-            new_file->data[strlen(new_file->data)] = '\n';
-        }
-        new_file->stat.st_size = strlen(new_file->data);
-        new_file->directory = strdup(directory);
+    new_file->data = NULL;
+    new_file->capacity = 0;
+    new_file->directory = strdup(directory);
+    mem_account(MEM_FILE_DATA, file_footprint(new_file));
+    char* model = strrchr(name,'.');
+    log_debug("log_message");
+    if(!strcmp(model+1,"SENSOR")) {
+        char helper_string[16];
+        generate_random_string(helper_string,8);
+        set_file_data(new_file, strdup(helper_string), strlen(helper_string) + 1);
+    }
+    else {
+        set_file_data(new_file, (char*)calloc(512,sizeof(char)), 512);
     }  
-    else{
-        new_file->data = (char*)calloc(512,sizeof(char));
-        new_file->directory = strdup(directory);
-        char* model = strrchr(name,'.');
-        log_debug("log_message");
-        if(!strcmp(model+1,"ACTUATOR")) new_file->stat.st_mode = __S_IFREG | 0222;
-        else if(!strcmp(model+1,"SENSOR")) {
-            char* helper_string[10];
-            generate_random_string(helper_string,8);
-            new_file->data = strdup(helper_string);
-            new_file->stat.st_mode = __S_IFREG | 0444;
-        }
-        else {
-            new_file->stat.st_mode = __S_IFREG | 0644;
-        }  
-        new_file->stat.st_size = strlen(new_file->data);
+    new_file->stat.st_mode = sub_device_file_mode(model + 1);
+    new_file->stat.st_size = strlen(new_file->data);
+    if (!strcmp(model + 1, "SENSOR")) {
+        // Reads render the engine's reading, newline included; its length
+        // is fixed, so getattr reports it from here on.
+        char reading[64];
+        int reading_length = sensor_engine_render(device_handle, SENSOR_CHANNEL_VALUE, reading, sizeof(reading));
+        if (reading_length >= 0) {
+            new_file->stat.st_size = reading_length;
+        }
     }
 
     new_file->stat.st_nlink = 1;
@@ -339,14 +531,22 @@ void add_file(FileList *list, const char *name, char *directory) {
     new_file->stat.st_mtime = time(NULL);
     new_file->stat.st_ctime = time(NULL);
 
-    new_file->capacity = 0;     
+    new_file->device_handle = device_handle;
+    set_device_bytes(device_handle, new_file->stat.st_size);
 
-    list->files[list->size++] = new_file;
+    DeviceEntry *device = get_device_entry(device_handle);
+    if (device != NULL) {
+        device->list_position = (long)list->size;
+    }
+    list->files[list->size] = new_file;
+    path_index_insert(&list->index, list, file_list_key, list->size);
+    list->size++;
 
     
     char log_message[512];
     snprintf(log_message, sizeof(log_message), "DEBUG: Added file: %s in directory: %s", name, directory);
     log_debug(log_message);
+    return new_file;
 }
 
 const char *extract_directory_name(const char *path) {
@@ -384,26 +584,46 @@ void get_parent_directory(const char *path, char *parent) {
     log_debug(log_message);
 }
 
-File *find_file(FileList *list, const char *name, const char *directory) {
-    for (size_t i = 0; i < list->size; i++) {
-        if (strcmp(list->files[i]->name, name) == 0 && strcmp(list->files[i]->directory, directory) == 0) {
-            
-            char log_message[512];
-            snprintf(log_message, sizeof(log_message), "DEBUG: File found: %s in directory: %s", name, directory);
-            log_debug(log_message);
-            return list->files[i];
+static long find_file_position(const FileList *list, const char *name, const char *directory) {
+    if (list->index.slots == NULL) {
+        return -1;
+    }
+    size_t mask = list->index.mask;
+    for (size_t slot = path_hash(directory, name) & mask; list->index.slots[slot] != 0; slot = (slot + 1) & mask) {
+        size_t position = list->index.slots[slot] - 1;
+        if (strcmp(list->files[position]->name, name) == 0 && strcmp(list->files[position]->directory, directory) == 0) {
+            return (long)position;
         }
     }
-    return NULL;
+    return -1;
+}
+
+File *find_file(FileList *list, const char *name, const char *directory) {
+    WAVE_PROBE2(file__lookup__start, name, directory);
+    SlowOpPhase previous_phase = slow_op_phase_enter(SLOW_PHASE_LOOKUP);
+    long position = find_file_position(list, name, directory);
+    slow_op_phase_exit(previous_phase);
+    WAVE_PROBE2(file__lookup__done, name, position != -1);
+    if (position == -1) {
+        return NULL;
+    }
+    char log_message[512];
+    snprintf(log_message, sizeof(log_message), "DEBUG: File found: %s in directory: %s", name, directory);
+    log_debug(log_message);
+    return list->files[position];
 }
 
 void free_file_list(FileList *list) {
     for (size_t i = 0; i < list->size; i++) {
+        mem_account(MEM_FILE_DATA, -file_footprint(list->files[i]));
         free(list->files[i]->name);
         free(list->files[i]->directory);
+        free(list->files[i]->data);
         free(list->files[i]);
     }
+    mem_account(MEM_LISTS, -(long long)(list->capacity * sizeof(File *)));
     free(list->files);
+    path_index_free(&list->index);
     list->files = NULL;
     list->size = 0;
     list->capacity = 0;
@@ -411,17 +631,25 @@ void free_file_list(FileList *list) {
 
 int find_dir(const DirList *list, const char *dir_path) {
     char log_message[512];
-    for (size_t i = 0; i < list->size; i++) {
-        snprintf(log_message, sizeof(log_message), "DEBUG: Directory: %s, and dir_path: %s", list->dirs[i],dir_path);
-        log_debug(log_message);
-        if (strcmp(list->dirs[i], dir_path) == 0) {
-            
-            snprintf(log_message, sizeof(log_message), "DEBUG: Directory found: %s", dir_path);
-            log_debug(log_message);
-            return i;
+    WAVE_PROBE1(dir__lookup__start, dir_path);
+    SlowOpPhase previous_phase = slow_op_phase_enter(SLOW_PHASE_LOOKUP);
+    int found = -1;
+    if (list->index.slots != NULL) {
+        size_t mask = list->index.mask;
+        for (size_t slot = path_hash(dir_path, NULL) & mask; list->index.slots[slot] != 0; slot = (slot + 1) & mask) {
+            if (strcmp(list->dirs[list->index.slots[slot] - 1], dir_path) == 0) {
+                found = (int)(list->index.slots[slot] - 1);
+                break;
+            }
         }
     }
-    return -1;
+    slow_op_phase_exit(previous_phase);
+    WAVE_PROBE2(dir__lookup__done, dir_path, found);
+    if (found != -1) {
+        snprintf(log_message, sizeof(log_message), "DEBUG: Directory found: %s", dir_path);
+        log_debug(log_message);
+    }
+    return found;
 }
 
 long calculate_file_size(const char *file_path) {
@@ -445,17 +673,21 @@ long calculate_file_size(const char *file_path) {
     return file->stat.st_size;
 }
 
+// Directory sizes are maintained incrementally in the registry, see set_device_bytes.
 long calculate_directory_size(const char *dir_path) {
-    long total_size = 0;
-    log_debug("inside calc dir size.");
-    
-    for (size_t i = 0; i < file_list.size; i++) {
-        if (strcmp(file_list.files[i]->directory, dir_path) == 0) {
-            total_size += file_list.files[i]->stat.st_size;
-            log_debug("inside calc dir size.");
-        }
+    int dir_index = find_dir(&dir_list, dir_path);
+    if (dir_index == -1) {
+        return 0;
     }
-    return total_size;
+    DeviceEntry *device = get_device_entry(dir_list.handles[dir_index]);
+    return device != NULL ? device->total_bytes : 0;
+}
+
+// Every change to a sub-device file size goes through here so that the
+// directory and fleet totals stay current.
+static void set_file_size(File *file, off_t size) {
+    file->stat.st_size = size;
+    set_device_bytes(file->device_handle, size);
 }
 
 void generate_random_string(char *random_string, size_t length) {
@@ -498,20 +730,15 @@ void modify_path(const char *path, const char *directory_name, char *new_path) {
     strcat(new_path, modified_directory);
 }
 
-void add_dir(DirList *dir_list, const char *dir_path) {
-    
-    for (size_t i = 0; i < dir_list->size; i++) {
-        if (strcmp(dir_list->dirs[i], dir_path) == 0) {
-            return;  
-        }
-    }
-
-    
+// Callers check for duplicates through the registry index before adding.
+int add_dir(DirList *dir_list, const char *dir_path, int device_handle) {
     if (dir_list->size == dir_list->capacity) {
+        mem_account(MEM_LISTS, dir_list->capacity * DIR_LIST_ENTRY_BYTES);
         dir_list->capacity *= 2;
         dir_list->dirs = realloc(dir_list->dirs, dir_list->capacity * sizeof(char *));
         dir_list->stats = realloc(dir_list->stats, dir_list->capacity * sizeof(struct stat));
-        if (!dir_list->dirs || !dir_list->stats) {
+        dir_list->handles = realloc(dir_list->handles, dir_list->capacity * sizeof(int));
+        if (!dir_list->dirs || !dir_list->stats || !dir_list->handles) {
             perror("Failed to resize directory list");
             exit(EXIT_FAILURE);
         }
@@ -519,6 +746,7 @@ void add_dir(DirList *dir_list, const char *dir_path) {
 
     
     dir_list->dirs[dir_list->size] = strdup(dir_path);
+    mem_account(MEM_LISTS, strlen(dir_path) + 1);
 
     
     dir_list->stats[dir_list->size].st_size = 0; 
@@ -528,8 +756,14 @@ void add_dir(DirList *dir_list, const char *dir_path) {
     dir_list->stats[dir_list->size].st_atime = time(NULL);
     dir_list->stats[dir_list->size].st_mtime = time(NULL);
     dir_list->stats[dir_list->size].st_ctime = time(NULL);
+    dir_list->handles[dir_list->size] = device_handle;
+    path_index_insert(&dir_list->index, dir_list, dir_list_key, dir_list->size);
+    DeviceEntry *device = get_device_entry(device_handle);
+    if (device != NULL) {
+        device->list_position = (long)dir_list->size;
+    }
 
-    dir_list->size++;
+    return dir_list->size++;
 }
 
 
@@ -562,110 +796,959 @@ void count_dots(const char* string,int* return_result){
     }
 }
 
-static int getattr_callback(const char *path, struct stat *stbuf) {
-    char log_message[512];
-    snprintf(log_message, sizeof(log_message), "DEBUG: Getattr callback called with path: %s.", path);
-    log_debug(log_message);
-    memset(stbuf, 0, sizeof(struct stat));  
-    int dot_counter = 0;
-    count_dots(extract_directory_name(path),&dot_counter);
-
-    char parent_dir[1024];
-    
-    if (strcmp(path, "/") == 0) {
-        stbuf->st_mode = S_IFDIR | 0775;
-        stbuf->st_nlink = 2;
-        stbuf->st_size = 0;
-        stbuf->st_uid = getuid();
-        stbuf->st_gid = getgid();
-        stbuf->st_atime = dir_list.stats[0].st_atime;
-        stbuf->st_mtime = dir_list.stats[0].st_mtime;
-        stbuf->st_ctime = dir_list.stats[0].st_ctime;
+// IMEI, GPS and GYRO are fully determined by their device, so they are not
+// stored as File objects. They are resolved from the parent device directory
+// and their content is generated on read.
+typedef enum {
+    VIRTUAL_NONE,
+    VIRTUAL_IMEI,
+    VIRTUAL_GPS,
+    VIRTUAL_GYRO,
+    VIRTUAL_GPS_HISTORY,
+    VIRTUAL_GYRO_HISTORY
+} VirtualFileKind;
+
+static const char *virtual_file_names[] = {"IMEI", "GPS", "GYRO", "GPS.history", "GYRO.history"};
+
+// GPS.history and GYRO.history list the samples the sensor engine kept,
+// one "<unix-ms> <values>" line each, oldest first. A suffix "@FROM-TO" in
+// Unix seconds narrows them to a window; either end can be left out, so
+// GPS.history@1700000000- is everything from that second on.
+static int parse_history_window(const char *suffix, int64_t *from_ms, int64_t *to_ms) {
+    *from_ms = INT64_MIN;
+    *to_ms = INT64_MAX;
+    if (*suffix == '\0') {
+        return 1;
+    }
+    const char *dash = strchr(suffix, '-');
+    if (*suffix != '@' || dash == NULL) {
         return 0;
     }
-    char* new_path = strdup(path);
-    const char *dir_name = extract_directory_name(path);
-    
-    
-    if(dot_counter == 2){
-        modify_path(path,dir_name,new_path);
+    char *end;
+    if (dash > suffix + 1) {
+        long long from = strtoll(suffix + 1, &end, 10);
+        if (end != dash || from < 0 || from > INT64_MAX / 1000 - 1) {
+            return 0;
+        }
+        *from_ms = from * 1000;
     }
-    
-    int dir_index = find_dir(&dir_list, new_path);
+    if (dash[1] != '\0') {
+        long long to = strtoll(dash + 1, &end, 10);
+        if (*end != '\0' || to < 0 || to > INT64_MAX / 1000 - 1) {
+            return 0;
+        }
+        *to_ms = to * 1000 + 999;
+    }
+    return 1;
+}
 
-    if (dir_index != -1) {
-        stbuf->st_mode = S_IFDIR | 0755;  
-        stbuf->st_nlink = 2;
-        stbuf->st_size = 0;  
-        stbuf->st_uid = getuid();
-        stbuf->st_gid = getgid();   
-        stbuf->st_atime = dir_list.stats[dir_index].st_atime;
-        stbuf->st_mtime = dir_list.stats[dir_index].st_mtime;
-        stbuf->st_ctime = dir_list.stats[dir_index].st_ctime;
+static VirtualFileKind virtual_file_kind(const char *file_name) {
+    if (!strcmp(file_name, "IMEI")) return VIRTUAL_IMEI;
+    if (!strcmp(file_name, "GPS")) return VIRTUAL_GPS;
+    if (!strcmp(file_name, "GYRO")) return VIRTUAL_GYRO;
+    int64_t from_ms, to_ms;
+    if (!strncmp(file_name, "GPS.history", 11) && parse_history_window(file_name + 11, &from_ms, &to_ms)) {
+        return VIRTUAL_GPS_HISTORY;
+    }
+    if (!strncmp(file_name, "GYRO.history", 12) && parse_history_window(file_name + 12, &from_ms, &to_ms)) {
+        return VIRTUAL_GYRO_HISTORY;
+    }
+    return VIRTUAL_NONE;
+}
 
-        snprintf(log_message, sizeof(log_message), "DEBUG: getattr for directory: %s, its size is: %d.", new_path,stbuf->st_size);
-        log_debug(log_message);
-        return 0;
+static int is_history_kind(VirtualFileKind kind) {
+    return kind == VIRTUAL_GPS_HISTORY || kind == VIRTUAL_GYRO_HISTORY;
+}
+
+// Returns the device a directory path stands for, or NULL for the root and
+// for paths that are not device directories.
+static DeviceEntry *find_dir_device(const char *dir_path, int *dir_index) {
+    if (strcmp(dir_path, "/") == 0) {
+        return NULL;
+    }
+    int index = find_dir(&dir_list, dir_path);
+    if (index == -1) {
+        return NULL;
+    }
+    if (dir_index != NULL) {
+        *dir_index = index;
+    }
+    return get_device_entry(dir_list.handles[index]);
+}
+
+// GPS and GYRO come from the sensor engine, which starts every device at
+// the readings its system ID used to give and moves them on each tick.
+static int render_virtual_file(VirtualFileKind kind, const DeviceEntry *device, char *out, size_t size) {
+    switch (kind) {
+        case VIRTUAL_IMEI:
+            return snprintf(out, size, "%s\n", device->imei);
+        case VIRTUAL_GPS:
+            return sensor_engine_render(device->handle, SENSOR_CHANNEL_GPS, out, size);
+        case VIRTUAL_GYRO:
+            return sensor_engine_render(device->handle, SENSOR_CHANNEL_GYRO, out, size);
+        default:
+            return -1;
     }
+}
 
-    char* secondary_path = strdup(path);
-    if(dot_counter == 2){
-        modify_path_to_remove_serial(path,secondary_path);
+// Readers of sensor values can poll for changes. A readable open of a GPS,
+// GYRO or sub-device file gets a SensorWatch in fi->fh holding the version
+// of the value it last read; poll reports POLLIN while the engine's version
+// differs, so a fresh open is readable until its first read. When the kernel
+// asks to be notified, the watch keeps the poll handle and is armed until
+// the engine reports a change for it.
+typedef struct SensorWatch {
+    int handle;
+    SensorChannel channel;
+    uint64_t seen_version;
+    struct fuse_pollhandle *poll_handle;
+    struct SensorWatch *prev;
+    struct SensorWatch *next;
+} SensorWatch;
+
+static SensorWatch *armed_watches = NULL;
+static pthread_mutex_t watch_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Special files all live under "/." and keep their own state in fi->fh, as
+// do history files.
+static SensorWatch *sensor_watch_from(const char *path, struct fuse_file_info *fi) {
+    if (fi == NULL || fi->fh == 0 || strncmp(path, "/.", 2) == 0 ||
+        is_history_kind(virtual_file_kind(extract_directory_name(path)))) {
+        return NULL;
     }
-    get_parent_directory(secondary_path, parent_dir);
+    return (SensorWatch *)(uintptr_t)fi->fh;
+}
 
-    const char *file_name = extract_directory_name(secondary_path);
+static SensorWatch *open_sensor_watch(int handle, SensorChannel channel) {
+    SensorWatch *watch = (SensorWatch *)calloc(1, sizeof(SensorWatch));
+    if (watch != NULL) {
+        watch->handle = handle;
+        watch->channel = channel;
+        mem_account(MEM_SENSORS, sizeof(SensorWatch));
+    }
+    return watch;
+}
 
-    File *file = find_file(&file_list, file_name, parent_dir);
+// Called with watch_mutex held.
+static void disarm_sensor_watch(SensorWatch *watch) {
+    if (watch->poll_handle == NULL) {
+        return;
+    }
+    fuse_pollhandle_destroy(watch->poll_handle);
+    watch->poll_handle = NULL;
+    if (watch->prev != NULL) {
+        watch->prev->next = watch->next;
+    } else {
+        armed_watches = watch->next;
+    }
+    if (watch->next != NULL) {
+        watch->next->prev = watch->prev;
+    }
+    watch->prev = NULL;
+    watch->next = NULL;
+}
 
-    if (file) { 
-        stbuf->st_mode = file->stat.st_mode;
-        stbuf->st_size = file->stat.st_size;
-        stbuf->st_nlink = file->stat.st_nlink;
-        stbuf->st_uid = file->stat.st_uid;
-        stbuf->st_gid = file->stat.st_gid;
-        stbuf->st_atime = file->stat.st_atime;
-        stbuf->st_mtime = file->stat.st_mtime;
-        stbuf->st_ctime = file->stat.st_ctime;
+static void close_sensor_watch(SensorWatch *watch) {
+    pthread_mutex_lock(&watch_mutex);
+    disarm_sensor_watch(watch);
+    pthread_mutex_unlock(&watch_mutex);
+    mem_account(MEM_SENSORS, -(long long)sizeof(SensorWatch));
+    free(watch);
+}
 
-        snprintf(log_message, sizeof(log_message), "DEBUG: getattr for file: %s in directory: %s. Its size is: %d.", file_name, parent_dir,stbuf->st_size);
-        log_debug(log_message);
+// Sensor engine listener: wakes the pollers of every armed watch whose value
+// moved past what it last read. handle -1 means any value may have changed.
+static void notify_sensor_watches(int handle, SensorChannel channel) {
+    pthread_mutex_lock(&watch_mutex);
+    SensorWatch *watch = armed_watches;
+    while (watch != NULL) {
+        SensorWatch *next = watch->next;
+        if ((handle == -1 || (watch->handle == handle && watch->channel == channel)) &&
+            sensor_engine_version(watch->handle, watch->channel) != watch->seen_version) {
+            fuse_notify_poll(watch->poll_handle);
+            disarm_sensor_watch(watch);
+        }
+        watch = next;
+    }
+    pthread_mutex_unlock(&watch_mutex);
+}
+
+// Change feed: /.events reads from the oldest event kept and /.events@N
+// resumes at sequence number N. Each open gets an EventReader in fi->fh;
+// reads return 0 once the reader has caught up, and poll reports POLLIN
+// when new events arrive. Armed readers share watch_mutex with the sensor
+// watches.
+static const char *events_path = "/.events";
+
+typedef struct EventReader {
+    EventCursor *cursor;
+    struct fuse_pollhandle *poll_handle;
+    struct EventReader *prev;
+    struct EventReader *next;
+} EventReader;
+
+static EventReader *armed_readers = NULL;
+
+static int parse_events_path(const char *path, uint64_t *from_seq) {
+    size_t length = strlen(events_path);
+    if (strncmp(path, events_path, length) != 0) {
+        return 0;
+    }
+    if (path[length] == '\0') {
+        *from_seq = 0;
+        return 1;
+    }
+    if (path[length] != '@' || !isdigit((unsigned char)path[length + 1])) {
+        return 0;
+    }
+    char *end;
+    unsigned long long seq = strtoull(path + length + 1, &end, 10);
+    if (*end != '\0') {
         return 0;
     }
+    *from_seq = seq;
+    return 1;
+}
 
-    
-    snprintf(log_message, sizeof(log_message), "DEBUG: getattr failed, new_path not found: %s nor secondary_path has been found %s.", new_path,secondary_path);
-    log_debug(log_message);
-    return -ENOENT;
+static int is_events_path(const char *path) {
+    uint64_t from_seq;
+    return parse_events_path(path, &from_seq);
 }
 
-static int readdir_callback(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi) {
-    (void) offset;
-    (void) fi;
+// Called with watch_mutex held.
+static void disarm_event_reader(EventReader *reader) {
+    if (reader->poll_handle == NULL) {
+        return;
+    }
+    fuse_pollhandle_destroy(reader->poll_handle);
+    reader->poll_handle = NULL;
+    if (reader->prev != NULL) {
+        reader->prev->next = reader->next;
+    } else {
+        armed_readers = reader->next;
+    }
+    if (reader->next != NULL) {
+        reader->next->prev = reader->prev;
+    }
+    reader->prev = NULL;
+    reader->next = NULL;
+}
 
-    char log_message[512];
-    snprintf(log_message, sizeof(log_message), "DEBUG: readdir_callback called with path = %s", path);
-    log_debug(log_message);
+// Event feed listener: every armed reader is waiting for the next event.
+static void notify_event_readers(uint64_t seq) {
+    (void) seq;
+    pthread_mutex_lock(&watch_mutex);
+    while (armed_readers != NULL) {
+        fuse_notify_poll(armed_readers->poll_handle);
+        disarm_event_reader(armed_readers);
+    }
+    pthread_mutex_unlock(&watch_mutex);
+}
 
-    
-    filler(buf, ".", NULL, 0);
-    filler(buf, "..", NULL, 0);
-    snprintf(log_message, sizeof(log_message), "DEBUG: Reading after main fillers.");
-    log_debug(log_message);
+// Joins a directory and an entry name into the path an event reports.
+static void event_path(char *out, size_t size, const char *dir, const char *name) {
+    snprintf(out, size, "%s/%s", strcmp(dir, "/") == 0 ? "" : dir, name);
+}
 
-    
-    for (size_t i = 0; i < dir_list.size; i++) {       
-        
-        char parent_dir[1024];
-        get_parent_directory(dir_list.dirs[i], parent_dir);
-        snprintf(log_message, sizeof(log_message), "DEBUG: Parent_dir: %s and path: %s", parent_dir,path);
-        log_debug(log_message);
+// Control files live under /.control. Writes to an open control file are
+// collected in the ControlHandle kept in fi->fh and applied on flush, which
+// close(2) waits for, so a read right after the writer's close sees the
+// results. A read returns the per-line results of the handle's own batch,
+// or of the last batch applied through any handle when the file was
+// opened. Batches are applied one at a time under control_mutex.
+static const char *control_dir_path = "/.control";
+
+// Largest batch one handle collects; writes past it fail with EFBIG.
+#define CONTROL_BATCH_MAX ((size_t)256 << 20)
+
+typedef struct {
+    char *data;
+    size_t size;
+    size_t capacity;
+} ControlBuffer;
+
+// apply returns 0, or -EIO when some records failed.
+typedef struct {
+    const char *path;
+    int (*apply)(ControlBuffer *batch, ControlBuffer *results);
+    ControlBuffer results;      // of the last batch, under control_mutex
+} ControlFile;
+
+typedef struct {
+    ControlBuffer batch;        // written since the last flush
+    ControlBuffer results;
+} ControlHandle;
+
+static pthread_mutex_t control_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int apply_import_batch(ControlBuffer *batch, ControlBuffer *results);
+static int apply_remove_batch(ControlBuffer *batch, ControlBuffer *results);
+static void restore_registry_from_json(void);
+
+// Read-only node that only answers the batched metadata ioctls in
+// wave_ioctl.h.
+static const char *ioctl_control_path = "/.control/ioctl";
+
+static ControlFile control_files[] = {
+    {"/.control/import", apply_import_batch, {NULL, 0, 0}},
+    {"/.control/remove", apply_remove_batch, {NULL, 0, 0}},
+};
+
+#define CONTROL_FILE_COUNT (sizeof(control_files) / sizeof(control_files[0]))
+
+static ControlFile *find_control_file(const char *path) {
+    for (size_t i = 0; i < CONTROL_FILE_COUNT; i++) {
+        if (strcmp(path, control_files[i].path) == 0) {
+            return &control_files[i];
+        }
+    }
+    return NULL;
+}
+
+static int is_control_file(const char *path) {
+    return find_control_file(path) != NULL;
+}
+
+static ControlBuffer *control_buffer_from(struct fuse_file_info *fi) {
+    return (ControlBuffer *)(uintptr_t)fi->fh;
+}
+
+static ControlHandle *control_handle_from(struct fuse_file_info *fi) {
+    return (ControlHandle *)(uintptr_t)fi->fh;
+}
+
+static int control_buffer_reserve(ControlBuffer *buffer, size_t extra) {
+    if (buffer->size + extra + 1 <= buffer->capacity) {
+        return 1;
+    }
+    size_t new_capacity = buffer->capacity ? buffer->capacity : 4096;
+    while (buffer->size + extra + 1 > new_capacity) {
+        new_capacity *= 2;
+    }
+    char *new_data = realloc(buffer->data, new_capacity);
+    if (new_data == NULL) {
+        return 0;
+    }
+    mem_account(MEM_BUFFERS, (long long)new_capacity - (long long)buffer->capacity);
+    buffer->data = new_data;
+    buffer->capacity = new_capacity;
+    return 1;
+}
+
+static int control_buffer_append(ControlBuffer *buffer, const char *data, size_t size) {
+    if (!control_buffer_reserve(buffer, size)) {
+        return 0;
+    }
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+    buffer->data[buffer->size] = '\0';
+    return 1;
+}
+
+static void control_buffer_printf(ControlBuffer *buffer, const char *format, ...) {
+    char line[1024];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (length > 0) {
+        control_buffer_append(buffer, line, (size_t)length < sizeof(line) ? (size_t)length : sizeof(line) - 1);
+    }
+}
+
+static void free_control_buffer(ControlBuffer *buffer) {
+    mem_account(MEM_BUFFERS, -(long long)buffer->capacity);
+    free(buffer->data);
+    buffer->data = NULL;
+    buffer->size = 0;
+    buffer->capacity = 0;
+}
+
+// Stores a write at offset, zero-filling any gap, into a buffer of at most
+// limit bytes. Growing the buffer is refused above the memory soft cap.
+// Returns size or -errno.
+static int control_buffer_write(ControlBuffer *buffer, const char *data, size_t size, off_t offset, size_t limit) {
+    if (offset < 0 || (size_t)offset > limit || size > limit - (size_t)offset) {
+        return -EFBIG;
+    }
+    size_t end = (size_t)offset + size;
+    if (end > buffer->size) {
+        if (end + 1 > buffer->capacity && mem_over_soft_cap()) {
+            return -ENOSPC;
+        }
+        if (!control_buffer_reserve(buffer, end - buffer->size)) {
+            return -ENOMEM;
+        }
+        memset(buffer->data + buffer->size, 0, end - buffer->size);
+        buffer->size = end;
+        buffer->data[end] = '\0';
+    }
+    memcpy(buffer->data + offset, data, size);
+    return (int)size;
+}
+
+static void copy_control_buffer(ControlBuffer *to, const ControlBuffer *from) {
+    free_control_buffer(to);
+    if (from->size > 0) {
+        control_buffer_append(to, from->data, from->size);
+    }
+}
+
+// Applies what the handle collected and makes its results the file's.
+static int flush_control_file(ControlFile *control, ControlHandle *handle) {
+    if (handle->batch.size == 0) {
+        return 0;
+    }
+    ControlBuffer results = {NULL, 0, 0};
+    pthread_mutex_lock(&control_mutex);
+    int result = control->apply(&handle->batch, &results);
+    copy_control_buffer(&control->results, &results);
+    pthread_mutex_unlock(&control_mutex);
+    free_control_buffer(&handle->results);
+    handle->results = results;
+    free_control_buffer(&handle->batch);
+    return result;
+}
+
+static void append_history_sample(void *context, int64_t time_ms, const unsigned char *values, int count) {
+    ControlBuffer *out = (ControlBuffer *)context;
+    char line[64];
+    int length = snprintf(line, sizeof(line), "%lld", (long long)time_ms);
+    for (int i = 0; i < count; i++) {
+        length += snprintf(line + length, sizeof(line) - length, " %u", values[i]);
+    }
+    line[length++] = '\n';
+    control_buffer_append(out, line, length);
+}
+
+// Renders the samples a history file name asks for.
+static void render_history_file(VirtualFileKind kind, const char *file_name, const DeviceEntry *device,
+                                ControlBuffer *out) {
+    int64_t from_ms, to_ms;
+    parse_history_window(strchr(file_name, '.') + strlen(".history"), &from_ms, &to_ms);
+    sensor_engine_history(device->handle, kind == VIRTUAL_GPS_HISTORY ? SENSOR_CHANNEL_GPS : SENSOR_CHANNEL_GYRO,
+                          from_ms, to_ms, append_history_sample, out);
+}
+
+// Read-only statistics under /.stats. Each open renders a snapshot into a
+// ControlBuffer kept in fi->fh, so a reader sees consistent numbers.
+static const char *stats_dir_path = "/.stats";
+
+typedef struct {
+    const char *path;
+    void (*render)(ControlBuffer *out);
+} StatsFile;
+
+static void render_fleet_stats(ControlBuffer *out) {
+    control_buffer_printf(out, "devices %d\n", device_count);
+    control_buffer_printf(out, "top_level_devices %d\n", fleet_stats.top_level_devices);
+    control_buffer_printf(out, "sub_devices %d\n", fleet_stats.sub_devices);
+    control_buffer_printf(out, "bytes %lld\n", fleet_stats.total_bytes);
+    int model_count = 0;
+    const ModelCount *models = get_model_counts(&model_count);
+    for (int i = 0; i < model_count; i++) {
+        if (models[i].count > 0) {
+            control_buffer_printf(out, "model %s %d\n", models[i].model, models[i].count);
+        }
+    }
+}
+
+static void render_op_stats(ControlBuffer *out, int json) {
+    size_t length = 0;
+    char *text = op_metrics_render(json, &length);
+    if (text != NULL) {
+        control_buffer_append(out, text, length);
+        free(text);
+    }
+}
+
+static void render_op_stats_text(ControlBuffer *out) {
+    render_op_stats(out, 0);
+}
+
+static void render_op_stats_json(ControlBuffer *out) {
+    render_op_stats(out, 1);
+}
+
+static long long resident_set_bytes(void) {
+    long long pages = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm != NULL) {
+        if (fscanf(statm, "%*s %lld", &pages) != 1) {
+            pages = 0;
+        }
+        fclose(statm);
+    }
+    return pages * sysconf(_SC_PAGESIZE);
+}
+
+static void render_memory_stats(ControlBuffer *out) {
+    control_buffer_printf(out, "%-12s %14s %14s\n", "category", "live_bytes", "peak_bytes");
+    for (int i = 0; i < MEM_CATEGORY_COUNT; i++) {
+        control_buffer_printf(out, "%-12s %14lld %14lld\n", mem_category_names[i], mem_live(i), mem_peak(i));
+    }
+    control_buffer_printf(out, "%-12s %14lld %14lld\n", "total", mem_total_live(), mem_total_peak());
+    control_buffer_printf(out, "heap_in_use %lld\n", mem_heap_in_use());
+    control_buffer_printf(out, "rss %lld\n", resident_set_bytes());
+    control_buffer_printf(out, "soft_cap %lld\n", mem_soft_cap());
+    control_buffer_printf(out, "refused_over_cap %lld\n", mem_refused_count());
+}
+
+static void render_actuator_stats(ControlBuffer *out) {
+    ActuatorQueueStats stats;
+    actuator_queue_stats(&stats);
+    control_buffer_printf(out, "service_rate %u\n", stats.rate);
+    control_buffer_printf(out, "workers %u\n", stats.workers);
+    control_buffer_printf(out, "queue_depth %u\n", stats.depth);
+    control_buffer_printf(out, "queued %lld\n", stats.queued);
+    control_buffer_printf(out, "accepted %lld\n", stats.accepted);
+    control_buffer_printf(out, "applied %lld\n", stats.applied);
+    control_buffer_printf(out, "rejected %lld\n", stats.rejected);
+    control_buffer_printf(out, "blocked %lld\n", stats.blocked);
+    control_buffer_printf(out, "dropped %lld\n", stats.dropped);
+}
+
+static StatsFile stats_files[] = {
+    {"/.stats/fleet", render_fleet_stats},
+    {"/.stats/ops", render_op_stats_text},
+    {"/.stats/ops.json", render_op_stats_json},
+    {"/.stats/memory", render_memory_stats},
+    {"/.stats/actuators", render_actuator_stats},
+};
+
+#define STATS_FILE_COUNT (sizeof(stats_files) / sizeof(stats_files[0]))
+
+static StatsFile *find_stats_file(const char *path) {
+    for (size_t i = 0; i < STATS_FILE_COUNT; i++) {
+        if (strcmp(path, stats_files[i].path) == 0) {
+            return &stats_files[i];
+        }
+    }
+    return NULL;
+}
+
+// Fleet listings under /.export. Unlike the stats files they are not
+// rendered on open: a FleetExportCursor in fi->fh produces them a record at
+// a time as they are read, so their size is unknown and they use direct_io.
+static const char *export_dir_path = "/.export";
+
+typedef struct {
+    const char *path;
+    FleetExportFormat format;
+} ExportFile;
+
+static ExportFile export_files[] = {
+    {"/.export/devices.csv", FLEET_EXPORT_CSV},
+    {"/.export/devices.ndjson", FLEET_EXPORT_NDJSON},
+};
+
+#define EXPORT_FILE_COUNT (sizeof(export_files) / sizeof(export_files[0]))
+
+static ExportFile *find_export_file(const char *path) {
+    for (size_t i = 0; i < EXPORT_FILE_COUNT; i++) {
+        if (strcmp(path, export_files[i].path) == 0) {
+            return &export_files[i];
+        }
+    }
+    return NULL;
+}
+
+// Saved queries under /.query. Writing a filter (see fleet_query_parse) to
+// /.query/<handle> stores it on flush, so the writer's close fails with
+// EINVAL if it does not parse. Reading the file parses the saved text again,
+// resolving parent=NAME against the devices there are now, runs it as a
+// scan over the registry columns and streams the matches the same way the
+// export files do.
+static const char *query_dir_path = "/.query";
+
+#define MAX_QUERY_FILES 64
+#define MAX_QUERY_TEXT 4096
+
+typedef struct {
+    int in_use;
+    char name[64];
+    ControlBuffer text;     // the filter last written, under control_mutex
+} QueryFile;
+
+// What an open query file keeps in fi->fh: the filter being written, or
+// the cursor (or the parse error) being read.
+typedef struct {
+    ControlBuffer text;
+    FleetExportCursor *cursor;
+} QueryHandle;
+
+static QueryFile query_files[MAX_QUERY_FILES];
+
+static const char *query_file_name(const char *path) {
+    size_t prefix_length = strlen(query_dir_path);
+    if (strncmp(path, query_dir_path, prefix_length) != 0 || path[prefix_length] != '/') {
+        return NULL;
+    }
+    const char *name = path + prefix_length + 1;
+    if (*name == '\0' || strchr(name, '/') != NULL || strlen(name) >= sizeof(query_files[0].name)) {
+        return NULL;
+    }
+    return name;
+}
+
+static QueryFile *find_query_file(const char *path) {
+    const char *name = query_file_name(path);
+    if (name == NULL) {
+        return NULL;
+    }
+    for (int i = 0; i < MAX_QUERY_FILES; i++) {
+        if (query_files[i].in_use && strcmp(query_files[i].name, name) == 0) {
+            return &query_files[i];
+        }
+    }
+    return NULL;
+}
+
+static int add_query_file(const char *path) {
+    const char *name = query_file_name(path);
+    if (name == NULL) {
+        return -EINVAL;
+    }
+    if (find_query_file(path) != NULL) {
+        return -EEXIST;
+    }
+    for (int i = 0; i < MAX_QUERY_FILES; i++) {
+        if (!query_files[i].in_use) {
+            memset(&query_files[i], 0, sizeof(QueryFile));
+            query_files[i].in_use = 1;
+            snprintf(query_files[i].name, sizeof(query_files[i].name), "%s", name);
+            return 0;
+        }
+    }
+    return -ENOSPC;
+}
+
+static QueryHandle *query_handle_from(struct fuse_file_info *fi) {
+    return (QueryHandle *)(uintptr_t)fi->fh;
+}
+
+static void remove_query_file(QueryFile *query) {
+    pthread_mutex_lock(&control_mutex);
+    free_control_buffer(&query->text);
+    query->in_use = 0;
+    pthread_mutex_unlock(&control_mutex);
+}
+
+// Saves what a writer wrote as the query's filter.
+static int flush_query_file(QueryFile *query, QueryHandle *handle) {
+    if (handle->text.size == 0) {
+        return 0;
+    }
+    DeviceFilter filter;
+    FleetExportFormat format;
+    char error[256];
+    int result = fleet_query_parse(handle->text.data, &filter, &format, error, sizeof(error));
+    pthread_mutex_lock(&control_mutex);
+    copy_control_buffer(&query->text, &handle->text);
+    pthread_mutex_unlock(&control_mutex);
+    free_control_buffer(&handle->text);
+    return result;
+}
+
+// Starts a scan of the saved filter, or fills text with why it cannot.
+static int open_query_scan(QueryFile *query, QueryHandle *handle) {
+    DeviceFilter filter;
+    FleetExportFormat format = FLEET_EXPORT_CSV;
+    char error[256];
+    int parsed = 0;
+    device_filter_init(&filter);
+    pthread_mutex_lock(&control_mutex);
+    if (query->text.size > 0) {
+        parsed = fleet_query_parse(query->text.data, &filter, &format, error, sizeof(error));
+    }
+    pthread_mutex_unlock(&control_mutex);
+    if (parsed != 0) {
+        control_buffer_printf(&handle->text, "ERROR %s\n", error);
+        return 0;
+    }
+    handle->cursor = fleet_export_open(format, &filter);
+    return handle->cursor != NULL ? 0 : -ENOMEM;
+}
+
+static void fill_control_stat(struct stat *stbuf, mode_t mode, off_t size) {
+    stbuf->st_mode = mode;
+    stbuf->st_nlink = S_ISDIR(mode) ? 2 : 1;
+    stbuf->st_size = size;
+    stbuf->st_uid = getuid();
+    stbuf->st_gid = getgid();
+    stbuf->st_atime = mount_time;
+    stbuf->st_mtime = mount_time;
+    stbuf->st_ctime = mount_time;
+}
+
+// Inode numbers, reported with use_ino: the root is 1, a device node is its
+// persistent number shifted left by 3 with the kind of virtual file in the
+// low bits, and nodes under "/." that are not devices take a hash of their
+// path with the top bit set.
+static ino_t device_node_ino(const DeviceEntry *device, VirtualFileKind kind) {
+    return (ino_t)((device->inode << 3) | (uint64_t)kind);
+}
+
+static ino_t path_node_ino(const char *path) {
+    return (ino_t)((1ull << 63) | (path_hash(path, NULL) >> 1));
+}
+
+// The attributes of the device tree, shared by getattr and readdir. They
+// leave the fields they do not set as they are.
+static void fill_dir_stat(struct stat *stbuf, int dir_index) {
+    DeviceEntry *device = get_device_entry(dir_list.handles[dir_index]);
+    if (device != NULL) {
+        stbuf->st_ino = device_node_ino(device, VIRTUAL_NONE);
+    }
+    stbuf->st_mode = S_IFDIR | 0755;  
+    stbuf->st_nlink = 2 + (device != NULL ? device->child_count : 0);
+    stbuf->st_size = device != NULL ? device->total_bytes : 0;  
+    stbuf->st_uid = dir_list.stats[dir_index].st_uid;
+    stbuf->st_gid = dir_list.stats[dir_index].st_gid;
+    stbuf->st_atime = dir_list.stats[dir_index].st_atime;
+    stbuf->st_mtime = dir_list.stats[dir_index].st_mtime;
+    stbuf->st_ctime = dir_list.stats[dir_index].st_ctime;
+}
+
+static void fill_virtual_stat(struct stat *stbuf, VirtualFileKind kind, const char *file_name,
+                              const DeviceEntry *device, int parent_index) {
+    char content[64];
+    stbuf->st_ino = device_node_ino(device, kind);
+    stbuf->st_mode = __S_IFREG | 0444;
+    stbuf->st_nlink = 1;
+    if (is_history_kind(kind)) {
+        ControlBuffer snapshot = {NULL, 0, 0};
+        render_history_file(kind, file_name, device, &snapshot);
+        stbuf->st_size = snapshot.size;
+        free_control_buffer(&snapshot);
+    } else {
+        stbuf->st_size = render_virtual_file(kind, device, content, sizeof(content));
+    }
+    stbuf->st_uid = dir_list.stats[parent_index].st_uid;
+    stbuf->st_gid = dir_list.stats[parent_index].st_gid;
+    stbuf->st_atime = dir_list.stats[parent_index].st_atime;
+    stbuf->st_mtime = dir_list.stats[parent_index].st_mtime;
+    stbuf->st_ctime = dir_list.stats[parent_index].st_ctime;
+    // GPS, GYRO and their history files change with every move of the value.
+    if (kind != VIRTUAL_IMEI) {
+        SensorChannel channel = kind == VIRTUAL_GPS || kind == VIRTUAL_GPS_HISTORY ? SENSOR_CHANNEL_GPS : SENSOR_CHANNEL_GYRO;
+        int64_t changed_ms = sensor_engine_changed_ms(device->handle, channel);
+        if (changed_ms > 0) {
+            stbuf->st_mtime = (time_t)(changed_ms / 1000);
+        }
+    }
+}
+
+static void fill_file_stat(struct stat *stbuf, const File *file) {
+    DeviceEntry *device = get_device_entry(file->device_handle);
+    if (device != NULL) {
+        stbuf->st_ino = device_node_ino(device, VIRTUAL_NONE);
+    }
+    stbuf->st_mode = file->stat.st_mode;
+    stbuf->st_size = file->stat.st_size;
+    stbuf->st_nlink = file->stat.st_nlink;
+    stbuf->st_uid = file->stat.st_uid;
+    stbuf->st_gid = file->stat.st_gid;
+    stbuf->st_atime = file->stat.st_atime;
+    stbuf->st_mtime = file->stat.st_mtime;
+    stbuf->st_ctime = file->stat.st_ctime;
+}
+
+static int getattr_callback(const char *path, struct stat *stbuf) {
+    char log_message[512];
+    snprintf(log_message, sizeof(log_message), "DEBUG: Getattr callback called with path: %s.", path);
+    log_debug(log_message);
+    memset(stbuf, 0, sizeof(struct stat));  
+    stbuf->st_ino = path_node_ino(path);
+    int dot_counter = 0;
+    count_dots(extract_directory_name(path),&dot_counter);
+
+    char parent_dir[1024];
+    
+    if (strcmp(path, "/") == 0) {
+        stbuf->st_ino = 1;
+        stbuf->st_mode = S_IFDIR | 0775;
+        // Its own two links, plus the ".." of each device directory and of
+        // /.control, /.stats, /.export and /.query.
+        stbuf->st_nlink = 2 + 4 + fleet_stats.top_level_devices;
+        stbuf->st_size = fleet_stats.total_bytes;
+        stbuf->st_uid = getuid();
+        stbuf->st_gid = getgid();
+        stbuf->st_atime = mount_time;
+        stbuf->st_mtime = mount_time;
+        stbuf->st_ctime = mount_time;
+        return 0;
+    }
+    if (strcmp(path, control_dir_path) == 0 || strcmp(path, stats_dir_path) == 0 ||
+        strcmp(path, export_dir_path) == 0 || strcmp(path, query_dir_path) == 0) {
+        fill_control_stat(stbuf, S_IFDIR | 0755, 0);
+        return 0;
+    }
+    if (find_query_file(path) != NULL) {
+        fill_control_stat(stbuf, S_IFREG | 0666, 0);
+        return 0;
+    }
+    if (strcmp(path, ioctl_control_path) == 0) {
+        fill_control_stat(stbuf, S_IFREG | 0444, 0);
+        return 0;
+    }
+    if (query_file_name(path) != NULL) {
+        return -ENOENT;
+    }
+    if (find_export_file(path) != NULL || is_events_path(path)) {
+        fill_control_stat(stbuf, S_IFREG | 0444, 0);
+        return 0;
+    }
+    StatsFile *stats = find_stats_file(path);
+    if (stats != NULL) {
+        ControlBuffer snapshot = {NULL, 0, 0};
+        stats->render(&snapshot);
+        fill_control_stat(stbuf, S_IFREG | 0444, snapshot.size);
+        free_control_buffer(&snapshot);
+        return 0;
+    }
+    if (is_control_file(path)) {
+        pthread_mutex_lock(&control_mutex);
+        size_t results_size = find_control_file(path)->results.size;
+        pthread_mutex_unlock(&control_mutex);
+        fill_control_stat(stbuf, S_IFREG | 0666, results_size);
+        return 0;
+    }
+    char new_path[PATH_MAX];
+    snprintf(new_path, sizeof(new_path), "%s", path);
+    const char *dir_name = extract_directory_name(path);
+    
+    
+    if(dot_counter == 2){
+        modify_path(path,dir_name,new_path);
+    }
+    
+    int dir_index = find_dir(&dir_list, new_path);
+
+    if (dir_index != -1) {
+        fill_dir_stat(stbuf, dir_index);
+
+        snprintf(log_message, sizeof(log_message), "DEBUG: getattr for directory: %s, its size is: %d.", new_path,stbuf->st_size);
+        log_debug(log_message);
+        return 0;
+    }
+
+    char secondary_path[PATH_MAX];
+    snprintf(secondary_path, sizeof(secondary_path), "%s", path);
+    if(dot_counter == 2){
+        modify_path_to_remove_serial(path,secondary_path);
+    }
+    get_parent_directory(secondary_path, parent_dir);
+
+    const char *file_name = extract_directory_name(secondary_path);
+
+    VirtualFileKind kind = virtual_file_kind(file_name);
+    if (kind != VIRTUAL_NONE) {
+        int parent_index = -1;
+        DeviceEntry *device = find_dir_device(parent_dir, &parent_index);
+        if (device != NULL) {
+            fill_virtual_stat(stbuf, kind, file_name, device, parent_index);
+            return 0;
+        }
+    }
+
+    File *file = find_file(&file_list, file_name, parent_dir);
+
+    if (file) { 
+        fill_file_stat(stbuf, file);
+
+        snprintf(log_message, sizeof(log_message), "DEBUG: getattr for file: %s in directory: %s. Its size is: %d.", file_name, parent_dir,stbuf->st_size);
+        log_debug(log_message);
+        return 0;
+    }
+
+    
+    snprintf(log_message, sizeof(log_message), "DEBUG: getattr failed, new_path not found: %s nor secondary_path has been found %s.", new_path,secondary_path);
+    log_debug(log_message);
+    return -ENOENT;
+}
+
+// Lists name with the attributes getattr reports for dir/name.
+static void fill_entry_with_attr(void *buf, fuse_fill_dir_t filler, const char *dir, const char *name) {
+    char child_path[PATH_MAX];
+    struct stat stbuf;
+    snprintf(child_path, sizeof(child_path), "%s/%s", strcmp(dir, "/") == 0 ? "" : dir, name);
+    filler(buf, name, getattr_callback(child_path, &stbuf) == 0 ? &stbuf : NULL, 0);
+}
+
+// Every entry is listed with the attributes getattr would report, so with
+// use_ino the listing carries each entry's inode number and type. libfuse 2
+// has no readdirplus, so the kernel still looks entries up one by one, but
+// those lookups go through the path indexes instead of scanning the lists.
+static int readdir_callback(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi) {
+    (void) offset;
+    (void) fi;
+
+    char log_message[512];
+    snprintf(log_message, sizeof(log_message), "DEBUG: readdir_callback called with path = %s", path);
+    log_debug(log_message);
+
+    
+    filler(buf, ".", NULL, 0);
+    filler(buf, "..", NULL, 0);
+    snprintf(log_message, sizeof(log_message), "DEBUG: Reading after main fillers.");
+    log_debug(log_message);
+
+    int parent_index = -1;
+    DeviceEntry *device = NULL;
+    struct stat stbuf;
+    if (strcmp(path, "/") == 0) {
+        fill_entry_with_attr(buf, filler, path, control_dir_path + 1);
+        fill_entry_with_attr(buf, filler, path, stats_dir_path + 1);
+        fill_entry_with_attr(buf, filler, path, export_dir_path + 1);
+        fill_entry_with_attr(buf, filler, path, query_dir_path + 1);
+        fill_entry_with_attr(buf, filler, path, events_path + 1);
+    } else if (strcmp(path, query_dir_path) == 0) {
+        for (int i = 0; i < MAX_QUERY_FILES; i++) {
+            if (query_files[i].in_use) {
+                fill_entry_with_attr(buf, filler, path, query_files[i].name);
+            }
+        }
+        return 0;
+    } else if (strcmp(path, export_dir_path) == 0) {
+        for (size_t i = 0; i < EXPORT_FILE_COUNT; i++) {
+            fill_entry_with_attr(buf, filler, path, extract_directory_name(export_files[i].path));
+        }
+        return 0;
+    } else if (strcmp(path, stats_dir_path) == 0) {
+        for (size_t i = 0; i < STATS_FILE_COUNT; i++) {
+            fill_entry_with_attr(buf, filler, path, extract_directory_name(stats_files[i].path));
+        }
+        return 0;
+    } else if (strcmp(path, control_dir_path) == 0) {
+        for (size_t i = 0; i < CONTROL_FILE_COUNT; i++) {
+            fill_entry_with_attr(buf, filler, path, extract_directory_name(control_files[i].path));
+        }
+        fill_entry_with_attr(buf, filler, path, extract_directory_name(ioctl_control_path));
+        return 0;
+    } else if ((device = find_dir_device(path, &parent_index)) != NULL) {
+        for (size_t i = 0; i < sizeof(virtual_file_names) / sizeof(virtual_file_names[0]); i++) {
+            memset(&stbuf, 0, sizeof(stbuf));
+            fill_virtual_stat(&stbuf, virtual_file_kind(virtual_file_names[i]), virtual_file_names[i], device, parent_index);
+            filler(buf, virtual_file_names[i], &stbuf, 0);
+        }
+    }
+
+    
+    for (size_t i = 0; i < dir_list.size; i++) {       
+        
+        char parent_dir[1024];
+        get_parent_directory(dir_list.dirs[i], parent_dir);
+        snprintf(log_message, sizeof(log_message), "DEBUG: Parent_dir: %s and path: %s", parent_dir,path);
+        log_debug(log_message);
 
         if (strcmp(parent_dir, path) == 0) {
             const char *base_name = extract_directory_name(dir_list.dirs[i]);
             snprintf(log_message,sizeof(log_message),"Extracted dir name is::: %s.",base_name);
             log_debug(log_message);
-            filler(buf, base_name, NULL, 0);
+            memset(&stbuf, 0, sizeof(stbuf));
+            fill_dir_stat(&stbuf, (int)i);
+            filler(buf, base_name, &stbuf, 0);
             snprintf(log_message, sizeof(log_message), "DEBUG: Listed directory: %s", base_name);
             log_debug(log_message);
         }
@@ -673,7 +1756,9 @@ static int readdir_callback(const char *path, void *buf, fuse_fill_dir_t filler,
     
     for (size_t i = 0; i < file_list.size; i++) {
         if (strcmp(file_list.files[i]->directory, path) == 0) {
-            filler(buf, file_list.files[i]->name, NULL, 0); 
+            memset(&stbuf, 0, sizeof(stbuf));
+            fill_file_stat(&stbuf, file_list.files[i]);
+            filler(buf, file_list.files[i]->name, &stbuf, 0); 
             snprintf(log_message, sizeof(log_message), "DEBUG: Listed file: %s in directory: %s", 
                      file_list.files[i]->name, file_list.files[i]->directory);
             log_debug(log_message);
@@ -682,38 +1767,209 @@ static int readdir_callback(const char *path, void *buf, fuse_fill_dir_t filler,
     return 0;
 }
 
+// Runs when a simulated actuator takes a command, on a queue worker, or on
+// the writer's thread when commands are applied directly.
+static void apply_actuator_command(int handle, const char *label, const char *command, size_t length) {
+    (void) handle;
+    char log_message[512];
+    snprintf(log_message, sizeof(log_message), "[%s] : %.*s", label, (int)length, command);
+    important_log_debug(log_message);
+}
+
 static void* init_callback(struct fuse_conn_info *conn) {
-    
+    mount_time = time(NULL);
+
     FILE *important_log_file = fopen(important_log_file_path, "w");
     if(important_log_file){
         fclose(important_log_file);
     }
-    FILE *log_file = fopen(log_file_path, "w");
+    FILE *log_file = log_file_path ? fopen(log_file_path, "w") : NULL;
     if (log_file) {
         fclose(log_file);  
     }
-    FILE *json_file = fopen(json_path,"w");
-    if (json_file) {
-        fclose(json_file);  
+    if (restore_registry) {
+        restore_registry_from_json();
+    } else {
+        FILE *json_file = fopen(json_path,"w");
+        if (json_file) {
+            fclose(json_file);  
+        }
     }
     
-    log_debug("Filesystem mounted and log file cleared && json file cleared.");
+    if (op_metrics_install_dump_signal(ops_dump_file_path) != 0) {
+        log_debug("ERROR: Failed to install the SIGUSR1 stats dump.");
+    }
+    // fuse_main forks into the background before init, so the tick thread
+    // is started here rather than in fuse_example_setup.
+    sensor_engine_set_listener(notify_sensor_watches);
+    event_feed_set_listener(notify_event_readers);
+    actuator_queue_set_handler(apply_actuator_command);
+    if (actuator_queue_start(actuator_rate, actuator_workers, actuator_queue_depth) != 0) {
+        log_debug("ERROR: Failed to start the actuator workers.");
+    }
+    if (sensor_engine_start(sensor_tick_ms, sensor_tick_threads) != 0) {
+        log_debug("ERROR: Failed to start the sensor engine.");
+    }
+    log_debug(restore_registry ? "Filesystem mounted and log file cleared, registry restored from json file."
+                               : "Filesystem mounted and log file cleared && json file cleared.");
     return NULL;
 }
 
+// Page cache policy for sub-device files. SENSOR readings move on every tick
+// and ACTUATOR writes are commands, so both bypass the cache. Other files
+// only change through writes, and a write stores generated content rather
+// than the bytes written, so writable opens bypass the cache too. A
+// read-only open keeps what the kernel cached as long as the file's VALUE
+// version has not moved since the last such open.
+// The kernel keeps one page cache per file, so the version is kept per File
+// rather than per handle: whichever open sees it move drops the pages for
+// every descriptor. It is only checked at open, though, so a descriptor
+// opened before a write may go on reading the old pages until the file is
+// opened again; the high-level libfuse 2 API cannot invalidate from write.
+static void set_file_cache_mode(File *file, const char *file_name, struct fuse_file_info *fi) {
+    const char *model = strrchr(file_name, '.');
+    if ((model != NULL && (!strcmp(model + 1, "SENSOR") || !strcmp(model + 1, "ACTUATOR"))) ||
+        (fi->flags & O_ACCMODE) != O_RDONLY) {
+        fi->direct_io = 1;
+        return;
+    }
+    uint64_t version = sensor_engine_version(file->device_handle, SENSOR_CHANNEL_VALUE);
+    fi->keep_cache = file->cached_version == version;
+    file->cached_version = version;
+}
+
 static int open_callback(const char *path, struct fuse_file_info *fi) {
     log_debug("Inside open callback.");
+    ControlFile *control = find_control_file(path);
+    if (control != NULL) {
+        ControlHandle *handle = (ControlHandle *)calloc(1, sizeof(ControlHandle));
+        if (handle == NULL) {
+            return -ENOMEM;
+        }
+        pthread_mutex_lock(&control_mutex);
+        copy_control_buffer(&handle->results, &control->results);
+        pthread_mutex_unlock(&control_mutex);
+        fi->fh = (uint64_t)(uintptr_t)handle;
+        fi->direct_io = 1;
+        return 0;
+    }
+    StatsFile *stats = find_stats_file(path);
+    if (stats != NULL) {
+        if ((fi->flags & O_ACCMODE) != O_RDONLY) {
+            return -EACCES;
+        }
+        ControlBuffer *snapshot = (ControlBuffer *)calloc(1, sizeof(ControlBuffer));
+        if (snapshot == NULL) {
+            return -ENOMEM;
+        }
+        stats->render(snapshot);
+        fi->fh = (uint64_t)(uintptr_t)snapshot;
+        fi->direct_io = 1;
+        return 0;
+    }
+    if (strcmp(path, ioctl_control_path) == 0) {
+        return (fi->flags & O_ACCMODE) == O_RDONLY ? 0 : -EACCES;
+    }
+    QueryFile *query = find_query_file(path);
+    if (query != NULL) {
+        int access_mode = fi->flags & O_ACCMODE;
+        if (access_mode == O_RDWR) {
+            return -EACCES;
+        }
+        QueryHandle *handle = (QueryHandle *)calloc(1, sizeof(QueryHandle));
+        if (handle == NULL) {
+            return -ENOMEM;
+        }
+        if (access_mode == O_RDONLY) {
+            if (open_query_scan(query, handle) != 0) {
+                free(handle);
+                return -ENOMEM;
+            }
+            fi->direct_io = 1;
+        }
+        fi->fh = (uint64_t)(uintptr_t)handle;
+        return 0;
+    }
+    uint64_t from_seq;
+    if (parse_events_path(path, &from_seq)) {
+        if ((fi->flags & O_ACCMODE) != O_RDONLY) {
+            return -EACCES;
+        }
+        EventReader *reader = (EventReader *)calloc(1, sizeof(EventReader));
+        if (reader == NULL || (reader->cursor = event_feed_open(from_seq)) == NULL) {
+            free(reader);
+            return -ENOMEM;
+        }
+        fi->fh = (uint64_t)(uintptr_t)reader;
+        fi->direct_io = 1;
+        fi->nonseekable = 1;
+        return 0;
+    }
+    ExportFile *export_file = find_export_file(path);
+    if (export_file != NULL) {
+        if ((fi->flags & O_ACCMODE) != O_RDONLY) {
+            return -EACCES;
+        }
+        FleetExportCursor *cursor = fleet_export_open(export_file->format, NULL);
+        if (cursor == NULL) {
+            return -ENOMEM;
+        }
+        fi->fh = (uint64_t)(uintptr_t)cursor;
+        fi->direct_io = 1;
+        return 0;
+    }
     char parent_dir[1024];
     char log_message[512];
     get_parent_directory(path, parent_dir);
     const char *file_name = extract_directory_name(path);
-    if(!strcmp(file_name,"GPS") || !strcmp(file_name,"IMEI") || !strcmp(file_name,"GYRO")){
+    int readable = (fi->flags & O_ACCMODE) != O_WRONLY;
+    VirtualFileKind kind = virtual_file_kind(file_name);
+    DeviceEntry *device = kind != VIRTUAL_NONE ? find_dir_device(parent_dir, NULL) : NULL;
+    if (device != NULL) {
         log_debug("Special file detected.");
+        if (is_history_kind(kind)) {
+            // A snapshot, so a reader going through it in pieces sees one
+            // consistent window while the ring moves on.
+            if ((fi->flags & O_ACCMODE) != O_RDONLY) {
+                return -EACCES;
+            }
+            ControlBuffer *snapshot = (ControlBuffer *)calloc(1, sizeof(ControlBuffer));
+            if (snapshot == NULL) {
+                return -ENOMEM;
+            }
+            render_history_file(kind, file_name, device, snapshot);
+            fi->fh = (uint64_t)(uintptr_t)snapshot;
+            fi->direct_io = 1;
+            return 0;
+        }
+        // The IMEI of a device never changes; GPS and GYRO are live.
+        if (kind == VIRTUAL_IMEI) {
+            fi->keep_cache = 1;
+        } else {
+            fi->direct_io = 1;
+        }
+        if (readable && kind != VIRTUAL_IMEI) {
+            SensorWatch *watch = open_sensor_watch(device->handle,
+                                                   kind == VIRTUAL_GPS ? SENSOR_CHANNEL_GPS : SENSOR_CHANNEL_GYRO);
+            if (watch == NULL) {
+                return -ENOMEM;
+            }
+            fi->fh = (uint64_t)(uintptr_t)watch;
+        }
         return 0;
     }
-    if (find_file(&file_list, file_name, parent_dir) != NULL){
+    File *file = find_file(&file_list, file_name, parent_dir);
+    if (file != NULL){
         snprintf(log_message, sizeof(log_message), "DEBUG: File opened successfully: %s in directory: %s", file_name, parent_dir);
         log_debug(log_message);
+        set_file_cache_mode(file, file_name, fi);
+        if (readable && (file->stat.st_mode & S_IRUSR)) {
+            SensorWatch *watch = open_sensor_watch(file->device_handle, SENSOR_CHANNEL_VALUE);
+            if (watch == NULL) {
+                return -ENOMEM;
+            }
+            fi->fh = (uint64_t)(uintptr_t)watch;
+        }
         return 0;  
     }
     snprintf(log_message, sizeof(log_message), "DEBUG: File not opened. File name is: %s.",file_name);
@@ -723,8 +1979,11 @@ static int open_callback(const char *path, struct fuse_file_info *fi) {
 
 static int utimens_callback(const char *path, const struct timespec tv[2]) {
     char log_message[512];
+    if (is_control_file(path) || find_query_file(path) != NULL) {
+        return 0;
+    }
     snprintf(log_message, sizeof(log_message), "DEBUG: Utimens callback called with %s as path.", path);
-    char* secondary_path = (char*)calloc(100,sizeof(char));
+    char secondary_path[PATH_MAX];
     modify_path_to_remove_serial(path,secondary_path);
     log_debug(log_message);
     char parent_dir[1024];
@@ -743,6 +2002,10 @@ static int utimens_callback(const char *path, const struct timespec tv[2]) {
         return 0;
     }
 
+    if (virtual_file_kind(file_name) != VIRTUAL_NONE && find_dir_device(parent_dir, NULL) != NULL) {
+        return 0;
+    }
+
     
     File *file = find_file(&file_list, file_name, parent_dir);
     if (file) {
@@ -853,69 +2116,96 @@ int check_restrictions(const char *input, const char *parent_directory, ParsedIn
     return 1;
 }
 
-static int create_callback(const char *path, mode_t mode, struct fuse_file_info *fi) {
-    (void) fi;  
-
+// How a node is provisioned. A single operation persists it at once; a
+// batch saves the registry when it is done. A node restored from the JSON
+// file at mount is already persisted, is not a change to report on the
+// event feed, and is not refused for the memory soft cap, since a refused
+// node would be dropped from the file by the next save.
+typedef enum {
+    PROVISION_PERSIST,
+    PROVISION_BATCH,
+    PROVISION_RESTORE
+} ProvisionMode;
+
+// Creates a sub-device file in an existing device directory.
+static int provision_sub_device(int parent_handle, const char *parent_dir, const char *file_name, ProvisionMode mode) {
     char log_message[512];
     time_t registration_date = time(NULL);
-    char parent_dir[1024];
-    get_parent_directory(path, parent_dir);
-    const char *file_name = extract_directory_name(path);
-    if(!strcmp(file_name,"GYRO") || !strcmp(file_name,"IMEI") || !strcmp(file_name,"GPS")){
-        if (find_file(&file_list, file_name, parent_dir) != NULL) {
-            return -EEXIST;  
-        }
-        snprintf(log_message, sizeof(log_message), "DEBUG: Creating %s file.", file_name);
-        log_debug(log_message);
-        add_file(&file_list,file_name,parent_dir);
-        return 0;
-    }
     ParsedInput parsed_input;
 
-    if(!check_restrictions(file_name,parent_dir,&parsed_input)){
+    if (mode != PROVISION_RESTORE && mem_over_soft_cap()) {
+        log_debug("ERROR: Memory soft cap reached, sub-device refused.");
+        return -ENOSPC;
+    }
+
+    int restriction_result = check_restrictions(file_name, parent_dir, &parsed_input);
+    if (restriction_result <= 0) {
         snprintf(log_message,sizeof(log_message),"ERROR: Restrictions not set.");
         log_debug(log_message);
-        return -EXIT_FAILURE;
+        return restriction_result < 0 ? restriction_result : -EXIT_FAILURE;
     }
 
-    char real_path[256];
+    char real_file_name[256];
+    get_substring_up_to_char(file_name, real_file_name, '.');
 
-    modify_path_to_remove_serial(path,real_path);
-
-    const char* real_file_name = extract_directory_name(real_path);
+    int result = 0;
+    if (parent_handle == -1) {
+        result = -ENOENT;
+    } else if (find_device_handle(parsed_input.name, parsed_input.model, parent_handle) != -1) {
+        result = -EEXIST;
+    } else {
+        DeviceEntry *device = create_and_add_device_entry(
+            parsed_input.name, parsed_input.model, parsed_input.serial_number, registration_date, parsed_input.imei, FILE_TYPE, parent_handle);
+        if (device == NULL) {
+            snprintf(log_message, sizeof(log_message), "DEBUG: Device is null.");
+            log_debug(log_message);
+            result = -ENOMEM;
+        } else {
+            add_file(&file_list, real_file_name, (char *)parent_dir, device->handle);
+            if (mode == PROVISION_PERSIST) {
+                PERSIST(add_device_to_json(device, json_path, extract_directory_name(parent_dir)));
+            }
+            if (mode != PROVISION_RESTORE) {
+                char created_path[PATH_MAX];
+                event_path(created_path, sizeof(created_path), parent_dir, real_file_name);
+                event_feed_append(EVENT_CREATE, created_path, 0);
+            }
+            snprintf(log_message, sizeof(log_message), "DEBUG: File created successfully: %s in directory: %s", real_file_name, parent_dir);
+            log_debug(log_message);
+        }
+    }
 
-    snprintf(log_message, sizeof(log_message), "DEBUG: Real path: %s", real_path);
-    log_debug(log_message);
+    free(parsed_input.name);
+    free(parsed_input.model);
+    return result;
+}
 
-    
-    if (find_file(&file_list, real_file_name, parent_dir) != NULL) {
-        return -EEXIST;  
+static int create_callback(const char *path, mode_t mode, struct fuse_file_info *fi) {
+    if (query_file_name(path) != NULL) {
+        int result = add_query_file(path);
+        return result != 0 ? result : open_callback(path, fi);
     }
 
-    
-    if (find_dir(&dir_list, parent_dir) == -1) {
-        return -ENOENT;  
-    }
-    DeviceEntry *device = create_and_add_device_entry(
-        parsed_input.name, parsed_input.model, parsed_input.serial_number, registration_date, parsed_input.imei, FILE_TYPE);
-    
-    if(device == NULL){
-        snprintf(log_message, sizeof(log_message), "DEBUG: Device is null.");
-        log_debug(log_message);
+    char parent_dir[1024];
+    get_parent_directory(path, parent_dir);
+    const char *file_name = extract_directory_name(path);
+    if (virtual_file_kind(file_name) != VIRTUAL_NONE) {
+        return find_dir_device(parent_dir, NULL) != NULL ? -EEXIST : -ENOENT;
+    }
+
+    int parent_index = find_dir(&dir_list, parent_dir);
+    int parent_handle = parent_index == -1 ? -1 : dir_list.handles[parent_index];
+    int result = provision_sub_device(parent_handle, parent_dir, file_name, PROVISION_PERSIST);
+    if (result == 0 && fi != NULL) {
+        // The file is stored without the serial the name was created with.
+        char real_file_name[256];
+        get_substring_up_to_char(file_name, real_file_name, '.');
+        File *file = find_file(&file_list, real_file_name, parent_dir);
+        if (file != NULL) {
+            set_file_cache_mode(file, real_file_name, fi);
+        }
     }
-    add_file(&file_list, real_file_name, parent_dir);
-    add_device_to_json(device, json_path, extract_directory_name(parent_dir));
-
-    
-    snprintf(log_message, sizeof(log_message), "DEBUG: File created successfully: %s in directory: %s", real_file_name, parent_dir);
-    log_debug(log_message);
-
-    struct timespec ts[2];
-    clock_gettime(CLOCK_REALTIME, &ts[0]);  
-    ts[1] = ts[0];  
-    
-
-    return 0;  
+    return result;
 }
 
 static int read_callback(const char *path, char *buf, size_t size, off_t offset,
@@ -923,8 +2213,84 @@ static int read_callback(const char *path, char *buf, size_t size, off_t offset,
     log_debug("Inside read callback function.");
     char log_message[512];
     char parent_dir[1024];
+    if (is_control_file(path)) {
+        ControlBuffer *results = &control_handle_from(fi)->results;
+        if (offset >= (off_t)results->size) {
+            return 0;
+        }
+        if (offset + size > results->size) {
+            size = results->size - offset;
+        }
+        memcpy(buf, results->data + offset, size);
+        return size;
+    }
+    if (find_stats_file(path) != NULL) {
+        ControlBuffer *snapshot = control_buffer_from(fi);
+        if (offset >= (off_t)snapshot->size) {
+            return 0;
+        }
+        if (offset + size > snapshot->size) {
+            size = snapshot->size - offset;
+        }
+        memcpy(buf, snapshot->data + offset, size);
+        return size;
+    }
+    if (find_export_file(path) != NULL) {
+        return (int)fleet_export_read((FleetExportCursor *)(uintptr_t)fi->fh, buf, size, offset);
+    }
+    if (strcmp(path, ioctl_control_path) == 0) {
+        return 0;
+    }
+    if (is_events_path(path)) {
+        return (int)event_feed_read(((EventReader *)(uintptr_t)fi->fh)->cursor, buf, size);
+    }
+    if (find_query_file(path) != NULL) {
+        QueryHandle *handle = query_handle_from(fi);
+        if (handle->cursor != NULL) {
+            return (int)fleet_export_read(handle->cursor, buf, size, offset);
+        }
+        if (offset >= (off_t)handle->text.size) {
+            return 0;
+        }
+        if (offset + size > handle->text.size) {
+            size = handle->text.size - offset;
+        }
+        memcpy(buf, handle->text.data + offset, size);
+        return size;
+    }
     get_parent_directory(path, parent_dir);
     char* file_name = extract_directory_name(path);
+    VirtualFileKind kind = virtual_file_kind(file_name);
+    if (kind != VIRTUAL_NONE) {
+        DeviceEntry *device = find_dir_device(parent_dir, NULL);
+        if (device != NULL && is_history_kind(kind)) {
+            ControlBuffer *snapshot = control_buffer_from(fi);
+            if (offset >= (off_t)snapshot->size) {
+                return 0;
+            }
+            if (offset + size > snapshot->size) {
+                size = snapshot->size - offset;
+            }
+            memcpy(buf, snapshot->data + offset, size);
+            return size;
+        }
+        if (device != NULL) {
+            SensorWatch *watch = sensor_watch_from(path, fi);
+            if (watch != NULL) {
+                watch->seen_version = sensor_engine_version(watch->handle, watch->channel);
+            }
+            char content[64];
+            int length = render_virtual_file(kind, device, content, sizeof(content));
+            if (offset >= length) {
+                return 0;
+            }
+            if (offset + size > (size_t)length) {
+                size = length - offset;
+            }
+            memcpy(buf, content + offset, size);
+            return size;
+        }
+    }
     File *file = find_file(&file_list, file_name, parent_dir);
     if (!file) {
         snprintf(log_message, sizeof(log_message), "ERROR: File not found: %s in directory: %s", file_name, parent_dir);
@@ -933,9 +2299,31 @@ static int read_callback(const char *path, char *buf, size_t size, off_t offset,
     }
     char* model = strrchr(file_name,'.');
     if(model!= NULL && !strcmp(model+1,"ACTUATOR")) return -EPERM;
-    if (offset + size > strlen(file->data)) {
-        memcpy(buf, file->data + offset, strlen(file->data) - offset);
-        return strlen(file->data) - offset;
+    SensorWatch *watch = sensor_watch_from(path, fi);
+    if (watch != NULL) {
+        watch->seen_version = sensor_engine_version(watch->handle, watch->channel);
+    }
+    if (model != NULL && !strcmp(model+1,"SENSOR")) {
+        char reading[64];
+        int reading_length = sensor_engine_render(file->device_handle, SENSOR_CHANNEL_VALUE, reading, sizeof(reading));
+        if (reading_length >= 0) {
+            if (offset >= reading_length) {
+                return 0;
+            }
+            if (offset + size > (size_t)reading_length) {
+                size = reading_length - offset;
+            }
+            memcpy(buf, reading + offset, size);
+            return size;
+        }
+    }
+    size_t length = strlen(file->data);
+    if (offset >= (off_t)length) {
+        return 0;
+    }
+    if (offset + size > length) {
+        memcpy(buf, file->data + offset, length - offset);
+        return length - offset;
     }
     memcpy(buf, file->data + offset, size);
     
@@ -997,85 +2385,312 @@ static int validate_and_parse_mkdir_input(const char *dir_name, ParsedInput *par
         }
     }
 
-    parsed->name = name;
-    parsed->serial_number = atoi(serial_number_str);
-    parsed->imei = imei_str;
-    parsed->model = NULL;
+    parsed->name = name;
+    parsed->serial_number = atoi(serial_number_str);
+    parsed->imei = imei_str;
+    parsed->model = NULL;
+
+    return 0;  
+}
+
+// Creates a top-level device directory from a name.serial_number.imei string.
+static int provision_device(const char *dir_name, ProvisionMode mode, int *device_handle) {
+    char log_message[512];
+
+    if (mode != PROVISION_RESTORE && mem_over_soft_cap()) {
+        log_debug("ERROR: Memory soft cap reached, device refused.");
+        return -ENOSPC;
+    }
+
+    ParsedInput parsed;
+    int validation_result = validate_and_parse_mkdir_input(dir_name, &parsed);
+    if (validation_result != 0) {
+        return validation_result;  
+    }
+
+    int existing = find_device_handle(parsed.name, "TTConnectWave", -1);
+    if (existing != -1) {
+        log_debug("ERROR: Directory already exists.");
+        if (device_handle != NULL) {
+            *device_handle = existing;
+        }
+        free(parsed.name);
+        return -EEXIST;  
+    }
+    char new_path[512];
+    snprintf(new_path, sizeof(new_path), "/%s", parsed.name);
+
+    time_t registration_date = time(NULL);
+    DeviceEntry *device = create_and_add_device_entry(
+        parsed.name, "TTConnectWave", parsed.serial_number, registration_date, parsed.imei, FOLDER_TYPE, -1);
+
+    if (!device) {
+        log_debug("ERROR: Failed to create device entry.");
+        free(parsed.name);
+        return -ENOMEM;  
+    }
+    add_dir(&dir_list, new_path, device->handle);
+    if (mode != PROVISION_RESTORE) {
+        event_feed_append(EVENT_MKDIR, new_path, 0);
+    }
+
+    char content[64];
+    long long virtual_bytes = 0;
+    for (VirtualFileKind kind = VIRTUAL_IMEI; kind <= VIRTUAL_GYRO; kind++) {
+        virtual_bytes += render_virtual_file(kind, device, content, sizeof(content));
+    }
+    set_device_bytes(device->handle, virtual_bytes);
+    if (mode == PROVISION_PERSIST) {
+        const char *parent_name = "/";  
+        PERSIST(add_device_to_json(device, json_path, parent_name));
+    }
+    if (device_handle != NULL) {
+        *device_handle = device->handle;
+    }
+    snprintf(log_message, sizeof(log_message), "INFO: Directory %s created successfully.", new_path);
+    log_debug(log_message);
+    free(parsed.name);
+    return 0;
+}
+
+static int mkdir_callback(const char *path, mode_t permission_bits) {
+    char log_message[512];
+    snprintf(log_message, sizeof(log_message), "DEBUG: mkdir_callback called with path = %s, permissions = %o", path, permission_bits);
+    log_debug(log_message);
+
+    
+    if (strchr(path + 1, '/') != NULL) {  
+        log_debug("ERROR: Directories can only be created in the root.");
+        return -EPERM;  
+    }
+    
+    return provision_device(extract_directory_name(path), PROVISION_PERSIST, NULL);
+}
+
+// Applies newline-delimited device records in one pass: name.serial.imei
+// creates a device, name.model.serial creates a sub-device in the device of
+// the preceding record (or in parent/name.model.serial). Every line gets a
+// result and the registry is written to JSON once at the end.
+static int apply_import_batch(ControlBuffer *batch, ControlBuffer *results) {
+    char log_message[512];
+    int line_number = 0, applied = 0, failed = 0;
+    int current_parent = -1;
+    char current_parent_dir[512] = "";
+
+    char *line = batch->data;
+    while (line != NULL && *line != '\0') {
+        char *next_line = strchr(line, '\n');
+        if (next_line != NULL) {
+            *next_line++ = '\0';
+        }
+        line_number++;
+
+        size_t length = strlen(line);
+        while (length > 0 && isspace((unsigned char)line[length - 1])) {
+            line[--length] = '\0';
+        }
+        while (isspace((unsigned char)*line)) {
+            line++;
+        }
+        if (*line == '\0' || *line == '#') {
+            line = next_line;
+            continue;
+        }
+
+        int result;
+        char *slash = strchr(line, '/');
+        char *first_dot = strchr(line, '.');
+        char *second_dot = first_dot ? strchr(first_dot + 1, '.') : NULL;
+        int is_device = slash == NULL && first_dot != NULL && second_dot != NULL && second_dot > first_dot + 1;
+        for (char *c = first_dot ? first_dot + 1 : NULL; is_device && c < second_dot; c++) {
+            if (!isdigit((unsigned char)*c)) {
+                is_device = 0;
+            }
+        }
+
+        if (is_device) {
+            int handle = -1;
+            result = provision_device(line, PROVISION_BATCH, &handle);
+            current_parent = (result == 0 || result == -EEXIST) ? handle : -1;
+            snprintf(current_parent_dir, sizeof(current_parent_dir), "/%.*s", (int)(first_dot - line), line);
+        } else if (slash != NULL) {
+            *slash = '\0';
+            char parent_dir[512];
+            snprintf(parent_dir, sizeof(parent_dir), "/%s", line);
+            result = provision_sub_device(find_device_handle(line, "TTConnectWave", -1), parent_dir, slash + 1, PROVISION_BATCH);
+            *slash = '/';
+        } else {
+            result = provision_sub_device(current_parent, current_parent_dir, line, PROVISION_BATCH);
+        }
+
+        if (result == 0) {
+            applied++;
+            control_buffer_printf(results, "%d OK %s\n", line_number, line);
+        } else {
+            failed++;
+            control_buffer_printf(results, "%d ERROR %s: %s\n", line_number, strerror(-result), line);
+        }
+        line = next_line;
+    }
+    control_buffer_printf(results, "applied %d failed %d\n", applied, failed);
+
+    if (applied > 0) {
+        PERSIST(save_registry_to_json(json_path));
+    }
 
-    return 0;  
+    snprintf(log_message, sizeof(log_message), "INFO: Import batch applied %d records, %d failed.", applied, failed);
+    log_debug(log_message);
+    return failed > 0 ? -EIO : 0;
 }
 
-static int mkdir_callback(const char *path, mode_t permission_bits) {
-    char log_message[512];
-    snprintf(log_message, sizeof(log_message), "DEBUG: mkdir_callback called with path = %s, permissions = %o", path, permission_bits);
-    log_debug(log_message);
+static const char *json_string_field(struct json_object *object, const char *key) {
+    struct json_object *value = NULL;
+    return json_object_object_get_ex(object, key, &value) ? json_object_get_string(value) : NULL;
+}
 
-    
-    if (strchr(path + 1, '/') != NULL) {  
-        log_debug("ERROR: Directories can only be created in the root.");
-        return -EPERM;  
-    }
-    
-    const char *dir_name = extract_directory_name(path);
-    char new_path[512];
-    modify_path(path, dir_name, new_path);
+static long long json_int_field(struct json_object *object, const char *key) {
+    struct json_object *value = NULL;
+    return json_object_object_get_ex(object, key, &value) ? json_object_get_int64(value) : 0;
+}
 
-    ParsedInput parsed;
-    int validation_result = validate_and_parse_mkdir_input(dir_name, &parsed);
-    if (validation_result != 0) {
-        return validation_result;  
+static void restore_json_entry(int handle, struct json_object *device_json) {
+    DeviceEntry *device = get_device_entry(handle);
+    if (device != NULL) {
+        restore_device_entry(device, (uint64_t)json_int_field(device_json, "Inode"),
+                             (time_t)json_int_field(device_json, "RegistrationDate"),
+                             json_string_field(device_json, "System id"));
     }
+}
 
-    if (find_dir(&dir_list, new_path) != -1) {
-        log_debug("ERROR: Directory already exists.");
-        free(parsed.name);
-        return -EEXIST;  
+// Rebuilds the registry from the JSON file a previous mount left behind,
+// keeping each node's inode number, system id and registration date, so a
+// remount looks the same to clients that remembered inodes. Runs from init
+// before the sensor and actuator threads start. Nodes that cannot be
+// restored would be missing from the next save, so the file as it was is
+// first kept next to it as <json>.unrestored.
+static void restore_registry_from_json(void) {
+    char log_message[512];
+    struct json_object *root = json_object_from_file(json_path);
+    struct json_object *devices_array = NULL;
+    if (root == NULL || !json_object_object_get_ex(root, "devices", &devices_array)) {
+        json_object_put(root);
+        log_debug("INFO: No registry to restore from the JSON file.");
+        return;
     }
-    add_dir(&dir_list, new_path);
-    time_t registration_date = time(NULL);
-    DeviceEntry *device = create_and_add_device_entry(
-        parsed.name, "TTConnectWave", parsed.serial_number, registration_date, parsed.imei, FOLDER_TYPE);
-
-    if (!device) {
-        log_debug("ERROR: Failed to create device entry.");
-        free(parsed.name);
-        return -ENOMEM;  
+    int restored = 0, failed = 0;
+    for (size_t i = 0; i < json_object_array_length(devices_array); i++) {
+        struct json_object *folder = json_object_array_get_idx(devices_array, i);
+        const char *name = json_string_field(folder, "Name");
+        const char *imei = json_string_field(folder, "IMEI");
+        if (name == NULL || imei == NULL) {
+            failed++;
+            continue;
+        }
+        while (*imei == ' ') {
+            imei++;   // stored right-aligned in 7 characters
+        }
+        char dir_name[256];
+        snprintf(dir_name, sizeof(dir_name), "%s.%lld.%s", name, json_int_field(folder, "SerialNumber"), imei);
+        int handle = -1;
+        if (provision_device(dir_name, PROVISION_RESTORE, &handle) != 0) {
+            snprintf(log_message, sizeof(log_message), "ERROR: Could not restore device %s.", dir_name);
+            log_debug(log_message);
+            failed++;
+            continue;
+        }
+        restore_json_entry(handle, folder);
+        restored++;
+
+        char parent_dir[256];
+        snprintf(parent_dir, sizeof(parent_dir), "/%s", name);
+        struct json_object *children = NULL;
+        if (!json_object_object_get_ex(folder, "Children", &children)) {
+            continue;
+        }
+        for (size_t j = 0; j < json_object_array_length(children); j++) {
+            struct json_object *child = json_object_array_get_idx(children, j);
+            const char *child_name = json_string_field(child, "Name");
+            const char *model = json_string_field(child, "Model");
+            char file_name[256];
+            if (child_name == NULL || model == NULL) {
+                failed++;
+                continue;
+            }
+            snprintf(file_name, sizeof(file_name), "%s.%s.%lld", child_name, model, json_int_field(child, "SerialNumber"));
+            if (provision_sub_device(handle, parent_dir, file_name, PROVISION_RESTORE) != 0) {
+                snprintf(log_message, sizeof(log_message), "ERROR: Could not restore sub-device %s in %s.", file_name, parent_dir);
+                log_debug(log_message);
+                failed++;
+                continue;
+            }
+            restore_json_entry(find_device_handle(child_name, model, handle), child);
+            restored++;
+        }
     }
-    const char *parent_name = "/";  
-    add_device_to_json(device, json_path, parent_name);
-    snprintf(log_message, sizeof(log_message), "INFO: Directory %s created successfully and device added to JSON.", new_path);
-    log_debug(log_message);
-    free(parsed.name);
-    char* helper_string = strdup(new_path);
-    create_callback(strcat(helper_string,"/IMEI"),__S_IFREG,NULL);
-    snprintf(log_message, sizeof(log_message), "INFO: Path is: %s.", helper_string);
-    log_debug(log_message);
-    helper_string = strdup(new_path);
-    create_callback(strcat(helper_string,"/GPS"),__S_IFREG,NULL);
-    snprintf(log_message, sizeof(log_message), "INFO: Path is: %s.", helper_string);
-    log_debug(log_message);
-    helper_string = strdup(new_path);
-    create_callback(strcat(helper_string,"/GYRO"),__S_IFREG,NULL);
-    snprintf(log_message, sizeof(log_message), "INFO: Path is: %s.", helper_string);
+    // Numbers of nodes removed before the last mount stay unused.
+    device_reserve_inodes((uint64_t)json_int_field(root, "NextInode"));
+    if (failed > 0) {
+        char kept_path[PATH_MAX];
+        snprintf(kept_path, sizeof(kept_path), "%s.unrestored", json_path);
+        if (json_object_to_file_ext(kept_path, root, JSON_C_TO_STRING_PRETTY) != 0) {
+            snprintf(log_message, sizeof(log_message), "ERROR: Could not keep the unrestored registry in %s.", kept_path);
+            log_debug(log_message);
+        }
+    }
+    json_object_put(root);
+
+    snprintf(log_message, sizeof(log_message), "INFO: Restored %d devices from the JSON file, %d failed.", restored, failed);
     log_debug(log_message);
-    return 0;
 }
 
 void remove_dir(DirList *list, size_t index) {
     if (index >= list->size) {
         return;  
     }
+    path_index_remove(&list->index, list, dir_list_key, index);
+    mem_account(MEM_LISTS, -(long long)(strlen(list->dirs[index]) + 1));
     free(list->dirs[index]);
 
-    
-    for (size_t i = index; i < list->size - 1; i++) {
-        list->dirs[i] = list->dirs[i + 1];
-        list->stats[i] = list->stats[i + 1];
+    // Order does not matter, so the last entry fills the gap.
+    size_t last = list->size - 1;
+    if (index != last) {
+        path_index_move(&list->index, dir_list_key(list, last), last, index);
+    }
+    list->dirs[index] = list->dirs[last];
+    list->stats[index] = list->stats[last];
+    list->handles[index] = list->handles[last];
+    DeviceEntry *moved = get_device_entry(list->handles[index]);
+    if (moved != NULL) {
+        moved->list_position = (long)index;
     }
 
     
     list->size--;
 }
+
+static void remove_file_at(FileList *file_list, size_t index) {
+    File *file = file_list->files[index];
+    path_index_remove(&file_list->index, file_list, file_list_key, index);
+    size_t last = file_list->size - 1;
+    if (index != last) {
+        path_index_move(&file_list->index, file_list_key(file_list, last), last, index);
+    }
+    mem_account(MEM_FILE_DATA, -file_footprint(file));
+    free(file->name);
+    free(file->directory);
+    free(file->data);
+    free(file);
+
+    file_list->files[index] = file_list->files[last];
+    file_list->size--;
+    if (index != last) {
+        DeviceEntry *moved = get_device_entry(file_list->files[index]->device_handle);
+        if (moved != NULL) {
+            moved->list_position = (long)index;
+        }
+    }
+}
+
 void remove_file(FileList *file_list, const char *path) {
     char log_message[512];
 
@@ -1091,8 +2706,8 @@ void remove_file(FileList *file_list, const char *path) {
     file_name++;  
 
     
-    File *file = find_file(file_list, file_name, parent_dir);
-    if (!file) {
+    long position = find_file_position(file_list, file_name, parent_dir);
+    if (position == -1) {
         snprintf(log_message, sizeof(log_message), "ERROR: File not found: %s in directory: %s", file_name, parent_dir);
         log_debug(log_message);
         return;
@@ -1102,33 +2717,22 @@ void remove_file(FileList *file_list, const char *path) {
     snprintf(log_message, sizeof(log_message), "INFO: Removing file: %s from directory: %s", file_name, parent_dir);
     log_debug(log_message);
 
-    
-    for (size_t i = 0; i < file_list->size; i++) {
-        if (file_list->files[i] == file) {
-            
-            free(file->name);
-            free(file->directory);
-            free(file->data);
-            free(file);
-
-            
-            for (size_t j = i; j < file_list->size - 1; j++) {
-                file_list->files[j] = file_list->files[j + 1];
-            }
-
-            
-            file_list->size--;
+    remove_file_at(file_list, (size_t)position);
 
-            
-            snprintf(log_message, sizeof(log_message), "INFO: File successfully removed: %s", file_name);
-            log_debug(log_message);
-            return;
-        }
-    }
+    snprintf(log_message, sizeof(log_message), "INFO: File successfully removed: %s", file_name);
+    log_debug(log_message);
 }
 
 static int unlink_callback(const char *path) {
     char log_message[512];
+    if (query_file_name(path) != NULL) {
+        QueryFile *query = find_query_file(path);
+        if (query == NULL) {
+            return -ENOENT;
+        }
+        remove_query_file(query);
+        return 0;
+    }
 
     snprintf(log_message, sizeof(log_message), "DEBUG: unlink_callback called with path = %s", path);
     log_debug(log_message);
@@ -1137,53 +2741,159 @@ static int unlink_callback(const char *path) {
     get_parent_directory(path, parent_dir);
     char *file_name = extract_directory_name(path);
 
-    if (find_file(&file_list, file_name, parent_dir) == NULL) {
+    if (virtual_file_kind(file_name) != VIRTUAL_NONE && find_dir_device(parent_dir, NULL) != NULL) {
+        log_debug("ERROR: IMEI, GPS and GYRO are part of the device and cannot be removed.");
+        return -EPERM;
+    }
+
+    File *file = find_file(&file_list, file_name, parent_dir);
+    if (file == NULL) {
         snprintf(log_message, sizeof(log_message), "ERROR: File not found: %s in directory: %s", file_name, parent_dir);
         log_debug(log_message);
         return -ENOENT;  
     }
+    int device_handle = file->device_handle;
 
     remove_file(&file_list, path);
+    remove_device_entry(device_handle);
+    event_feed_append(EVENT_UNLINK, path, 0);
 
-    char* real_file_name = (char*)calloc(20,sizeof(char));
+    char real_file_name[256];
     get_substring_up_to_char(file_name,real_file_name,'.');    
 
-    remove_device_from_json(real_file_name,json_path);
+    PERSIST(remove_device_from_json(real_file_name,json_path));
 
     snprintf(log_message, sizeof(log_message), "INFO: File successfully unlinked: %s", path);
     log_debug(log_message);
-    free(real_file_name);
     return 0;  
 }
 
 
+// Removes a set of top-level devices together with all their sub-devices.
+// The registry links each device to its sub-devices and to its place in the
+// file and directory lists, so the work is proportional to what is removed,
+// and the JSON file is edited once for the whole set. handles is sorted and
+// its duplicates dropped in place. Returns the number of devices removed.
+static int teardown_devices(int *handles, int count) {
+    char log_message[512];
+    qsort(handles, count, sizeof(int), compare_handles);
+    int unique = 0;
+    for (int i = 0; i < count; i++) {
+        DeviceEntry *device = get_device_entry(handles[i]);
+        if (device != NULL && device->type == FOLDER_TYPE && (unique == 0 || handles[unique - 1] != handles[i])) {
+            handles[unique++] = handles[i];
+        }
+    }
+    if (unique == 0) {
+        return 0;
+    }
+    // Entries are matched by name, so this runs while they are registered.
+    PERSIST(remove_folders_from_json(handles, unique, json_path));
+
+    int removed_files = 0;
+    for (int i = 0; i < unique; i++) {
+        DeviceEntry *device = get_device_entry(handles[i]);
+        while (device->first_child != -1) {
+            DeviceEntry *child = get_device_entry(device->first_child);
+            if (child->list_position >= 0) {
+                File *file = file_list.files[child->list_position];
+                char removed_path[PATH_MAX];
+                event_path(removed_path, sizeof(removed_path), file->directory, file->name);
+                event_feed_append(EVENT_UNLINK, removed_path, 0);
+                remove_file_at(&file_list, (size_t)child->list_position);
+            }
+            remove_device_entry(child->handle);
+            removed_files++;
+        }
+        size_t position = (size_t)device->list_position;
+        event_feed_append(EVENT_RMDIR, dir_list.dirs[position], 0);
+        remove_device_entry(device->handle);
+        remove_dir(&dir_list, position);
+    }
+
+    snprintf(log_message, sizeof(log_message), "INFO: Teardown removed %d devices and %d sub-devices.", unique, removed_files);
+    log_debug(log_message);
+    return unique;
+}
+
 static int rmdir_callback(const char *path) {
     
     int dir_index = find_dir(&dir_list, path);
     if (dir_index == -1) {
         return -ENOENT;  
     }
-    char* new_path = strdup(path);
-    unlink_callback(strcat(new_path,"/GPS"));
-    new_path = strdup(path);
-    unlink_callback(strcat(new_path,"/GYRO"));
-    new_path = strdup(path);
-    unlink_callback(strcat(new_path,"/IMEI"));
-    remove_dir(&dir_list, dir_index);
-    log_debug("before removing dir device");
-    remove_device_from_json(extract_directory_name(path),json_path);
-    return 0;  
+    int handle = dir_list.handles[dir_index];
+    teardown_devices(&handle, 1);
+    return 0;
+}
+
+// One device name per line; all named devices are torn down in one go.
+static int apply_remove_batch(ControlBuffer *batch, ControlBuffer *results) {
+    int *handles = (int *)malloc((batch->size / 2 + 1) * sizeof(int));
+    if (handles == NULL) {
+        control_buffer_printf(results, "ERROR %s\n", strerror(ENOMEM));
+        return -ENOMEM;
+    }
+    int count = 0, line_number = 0, failed = 0;
+
+    char *line = batch->data;
+    while (line != NULL && *line != '\0') {
+        char *next_line = strchr(line, '\n');
+        if (next_line != NULL) {
+            *next_line++ = '\0';
+        }
+        line_number++;
+
+        size_t length = strlen(line);
+        while (length > 0 && isspace((unsigned char)line[length - 1])) {
+            line[--length] = '\0';
+        }
+        while (isspace((unsigned char)*line) || *line == '/') {
+            line++;
+        }
+        if (*line == '\0' || *line == '#') {
+            line = next_line;
+            continue;
+        }
+
+        int handle = find_device_handle(line, "TTConnectWave", -1);
+        if (handle == -1) {
+            failed++;
+            control_buffer_printf(results, "%d ERROR %s: %s\n", line_number, strerror(ENOENT), line);
+        } else {
+            handles[count++] = handle;
+            control_buffer_printf(results, "%d OK %s\n", line_number, line);
+        }
+        line = next_line;
+    }
+
+    // A device named twice is removed, and counted, once.
+    int removed = teardown_devices(handles, count);
+    control_buffer_printf(results, "removed %d failed %d\n", removed, failed);
+    free(handles);
+    return failed > 0 ? -EIO : 0;
 }
 
 
+static int is_command(const char *buf, size_t size, const char *command) {
+    return size == strlen(command) && memcmp(buf, command, size) == 0;
+}
+
 static int write_callback(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
     log_debug("Inside write callback function.");
+    if (is_control_file(path)) {
+        return control_buffer_write(&control_handle_from(fi)->batch, buf, size, offset, CONTROL_BATCH_MAX);
+    }
+    if (find_query_file(path) != NULL) {
+        return control_buffer_write(&query_handle_from(fi)->text, buf, size, offset, MAX_QUERY_TEXT);
+    }
     char log_message[512];
     char parent_dir[1024];
     get_parent_directory(path, parent_dir);
     const char *file_name = extract_directory_name(path);
     char* model = strrchr(file_name,'.');
     if(model != NULL && !strcmp(model+1,"SENSOR")) return -EPERM;
+    if(virtual_file_kind(file_name) != VIRTUAL_NONE) return -EPERM;
     size_t required_capacity = offset + size;
     File *file = find_file(&file_list, file_name, parent_dir);
     if (!file) {
@@ -1191,33 +2901,42 @@ static int write_callback(const char *path, const char *buf, size_t size, off_t
         log_debug(log_message);
         return -ENOENT; 
     }
+    // buf is not NUL-terminated, so commands are compared by length.
     char* dev_model = strrchr(file_name,'.') + 1;
     if(!strcmp(dev_model,"ACTUATOR")){
-        snprintf(log_message,sizeof(log_message),"[%s] : %s",file_name,buf);
-        important_log_debug(log_message);
-        file->data = strdup(buf);
-        file->stat.st_size = strlen(buf);
+        // The file keeps the last command accepted; the device applies it
+        // when a worker gets to it.
+        int queued = actuator_queue_submit(file->device_handle, file_name, buf, size,
+                                           fi != NULL && (fi->flags & O_NONBLOCK));
+        if (queued != 0) {
+            return queued;
+        }
+        set_file_data(file, strndup(buf, size), size + 1);
+        set_file_size(file, strlen(file->data));
         file->stat.st_mtime = time(NULL); 
+        event_feed_append(EVENT_WRITE, path, file->stat.st_size);
         return size;
     }
-    else if(!strcmp(buf,"data\n")){
+    else if(is_command(buf, size, "data\n")){
         strcpy(file->read_type,"data");
         char helper_string[128];
         generate_random_string(helper_string,8);
-        file->data = strdup(helper_string);
+        set_file_data(file, strdup(helper_string), strlen(helper_string) + 1);
         snprintf(log_message,sizeof(log_message),"[%s] : data",file_name);
         important_log_debug(log_message);
-        file->stat.st_size = strlen(file->data);
+        set_file_size(file, strlen(file->data));
         file->stat.st_mtime = time(NULL); 
+        sensor_engine_touch(file->device_handle, SENSOR_CHANNEL_VALUE);
+        event_feed_append(EVENT_WRITE, path, file->stat.st_size);
         return size;
     } 
-    else if(!strcmp(buf,"info\n")){
-        free(file->data);
-        file->data = (char*)calloc(512,sizeof(char));
+    else if(is_command(buf, size, "info\n")){
+        set_file_data(file, (char*)calloc(512,sizeof(char)), 512);
         snprintf(log_message,sizeof(log_message),"[%s] : info",file_name);
         important_log_debug(log_message);
         strcpy(file->read_type,"info");
-        struct json_object *device = find_device(file->name, json_path);
+        struct json_object *device;
+        PERSIST(device = find_device(file->name, json_path));
         struct json_object *name_obj;
         struct json_object *ser_num;
         struct json_object *reg_date;
@@ -1243,8 +2962,11 @@ static int write_callback(const char *path, const char *buf, size_t size, off_t
             snprintf(log_message,sizeof(log_message),"Device sys id: %s\n", json_object_get_string(sys_id));
             strcat(file->data,log_message);
         }
-        file->stat.st_size = strlen(file->data);
+        json_object_put(device);
+        set_file_size(file, strlen(file->data));
         file->stat.st_mtime = time(NULL); 
+        sensor_engine_touch(file->device_handle, SENSOR_CHANNEL_VALUE);
+        event_feed_append(EVENT_WRITE, path, file->stat.st_size);
         return size;
     }
     else{
@@ -1255,10 +2977,16 @@ static int write_callback(const char *path, const char *buf, size_t size, off_t
 
 static int truncate_callback(const char *path, off_t size) {
     log_debug("Inside the truncate callback.");
+    if (is_control_file(path) || find_query_file(path) != NULL) {
+        return 0;
+    }
     char log_message[512];
     char parent_dir[1024];
     get_parent_directory(path, parent_dir);
     const char *file_name = extract_directory_name(path);
+    if (virtual_file_kind(file_name) != VIRTUAL_NONE) {
+        return -EPERM;
+    }
 
     
     File *file = find_file(&file_list, file_name, parent_dir);
@@ -1269,65 +2997,495 @@ static int truncate_callback(const char *path, off_t size) {
     }
 
     
+    if (size > file->stat.st_size && mem_over_soft_cap()) {
+        return -ENOSPC;
+    }
+    // Contents are read back with strlen, so keep room for the terminator.
     if (size > file->stat.st_size) {
-        char *new_data = realloc(file->data, size);
+        char *new_data = realloc(file->data, size + 1);
         if (!new_data) {
             log_debug("ERROR: Memory allocation failed during truncate.");
             return -ENOMEM; 
         }
         file->data = new_data;
+        mem_account(MEM_FILE_DATA, (long long)size + 1 - (long long)file->capacity);
+        file->capacity = size + 1;
 
         
-        memset(file->data + file->stat.st_size, 0, size - file->stat.st_size);
+        memset(file->data + file->stat.st_size, 0, size + 1 - file->stat.st_size);
 
         snprintf(log_message, sizeof(log_message), "INFO: File expanded to %ld bytes: %s", size, file_name);
         log_debug(log_message);
     } 
     
     else if (size < file->stat.st_size) {
-        char *new_data = realloc(file->data, size);
-        if (!new_data && size > 0) {
+        char *new_data = realloc(file->data, size + 1);
+        if (!new_data) {
             log_debug("ERROR: Memory allocation failed during truncate.");
             return -ENOMEM; 
         }
         file->data = new_data;
+        file->data[size] = '\0';
+        mem_account(MEM_FILE_DATA, (long long)size + 1 - (long long)file->capacity);
+        file->capacity = size + 1;
 
         snprintf(log_message, sizeof(log_message), "INFO: File truncated to %ld bytes: %s", size, file_name);
         log_debug(log_message);
     }
 
     
-    file->stat.st_size = size;
+    if (size != file->stat.st_size) {
+        set_file_size(file, size);
+        sensor_engine_touch(file->device_handle, SENSOR_CHANNEL_VALUE);
+        event_feed_append(EVENT_TRUNCATE, path, size);
+    }
     log_debug("Outside the truncate callback.");
 
     return 0; 
 }
 
-static struct fuse_operations fuse_example_operations = {
-  .getattr = getattr_callback,
-  .open = open_callback,
-  .create = create_callback,
-  .read = read_callback,
-  .write = write_callback,
-  .readdir = readdir_callback,
-  .init = init_callback,
-  .truncate = truncate_callback,
-  .mkdir = mkdir_callback,
-  .utimens = utimens_callback,
-  .rmdir = rmdir_callback,
-  .unlink = unlink_callback
-};
+// Sent on every close(2) of a descriptor, before it returns.
+static int flush_callback(const char *path, struct fuse_file_info *fi) {
+    ControlFile *control = find_control_file(path);
+    if (control != NULL) {
+        return flush_control_file(control, control_handle_from(fi));
+    }
+    QueryFile *query = find_query_file(path);
+    if (query != NULL && fi->fh != 0 && (fi->flags & O_ACCMODE) == O_WRONLY) {
+        return flush_query_file(query, query_handle_from(fi));
+    }
+    return 0;
+}
+
+static int release_callback(const char *path, struct fuse_file_info *fi) {
+    ControlFile *control = find_control_file(path);
+    if (control != NULL) {
+        // Normally flush applied the batch already; this covers callers
+        // that release without flushing.
+        ControlHandle *handle = control_handle_from(fi);
+        flush_control_file(control, handle);
+        free_control_buffer(&handle->batch);
+        free_control_buffer(&handle->results);
+        free(handle);
+    } else if (find_stats_file(path) != NULL) {
+        ControlBuffer *snapshot = control_buffer_from(fi);
+        free_control_buffer(snapshot);
+        free(snapshot);
+    } else if (find_export_file(path) != NULL) {
+        fleet_export_close((FleetExportCursor *)(uintptr_t)fi->fh);
+    } else if (is_events_path(path) && fi->fh != 0) {
+        EventReader *reader = (EventReader *)(uintptr_t)fi->fh;
+        pthread_mutex_lock(&watch_mutex);
+        disarm_event_reader(reader);
+        pthread_mutex_unlock(&watch_mutex);
+        event_feed_close(reader->cursor);
+        free(reader);
+    } else if (query_file_name(path) != NULL && fi->fh != 0) {
+        QueryHandle *handle = query_handle_from(fi);
+        QueryFile *query = find_query_file(path);
+        if (query != NULL && (fi->flags & O_ACCMODE) == O_WRONLY) {
+            flush_query_file(query, handle);
+        }
+        fleet_export_close(handle->cursor);
+        free_control_buffer(&handle->text);
+        free(handle);
+    } else if (is_history_kind(virtual_file_kind(extract_directory_name(path))) && fi->fh != 0) {
+        ControlBuffer *snapshot = control_buffer_from(fi);
+        free_control_buffer(snapshot);
+        free(snapshot);
+    } else if (sensor_watch_from(path, fi) != NULL) {
+        close_sensor_watch(sensor_watch_from(path, fi));
+    }
+    return 0;
+}
+
+// Files without a watch never block: other special files, IMEI, actuators
+// and write-only opens are always ready.
+static int poll_callback(const char *path, struct fuse_file_info *fi,
+                         struct fuse_pollhandle *ph, unsigned *reventsp) {
+    if (is_events_path(path) && fi->fh != 0) {
+        EventReader *reader = (EventReader *)(uintptr_t)fi->fh;
+        pthread_mutex_lock(&watch_mutex);
+        if (ph != NULL) {
+            if (reader->poll_handle != NULL) {
+                fuse_pollhandle_destroy(reader->poll_handle);
+            } else {
+                reader->next = armed_readers;
+                if (armed_readers != NULL) {
+                    armed_readers->prev = reader;
+                }
+                armed_readers = reader;
+            }
+            reader->poll_handle = ph;
+        }
+        if (event_feed_pending(reader->cursor)) {
+            *reventsp |= POLLIN | POLLRDNORM;
+        }
+        pthread_mutex_unlock(&watch_mutex);
+        return 0;
+    }
+    SensorWatch *watch = sensor_watch_from(path, fi);
+    if (watch == NULL) {
+        if (ph != NULL) {
+            fuse_pollhandle_destroy(ph);
+        }
+        *reventsp |= POLLIN | POLLRDNORM | POLLOUT | POLLWRNORM;
+        return 0;
+    }
+    pthread_mutex_lock(&watch_mutex);
+    if (ph != NULL) {
+        if (watch->poll_handle != NULL) {
+            fuse_pollhandle_destroy(watch->poll_handle);
+        } else {
+            watch->next = armed_watches;
+            if (armed_watches != NULL) {
+                armed_watches->prev = watch;
+            }
+            armed_watches = watch;
+        }
+        watch->poll_handle = ph;
+    }
+    if (sensor_engine_version(watch->handle, watch->channel) != watch->seen_version) {
+        *reventsp |= POLLIN | POLLRDNORM;
+    }
+    pthread_mutex_unlock(&watch_mutex);
+    return 0;
+}
+
+// Device metadata as extended attributes, read straight from the registry:
+// one getxattr instead of an open, an "info" write and a read. Device
+// directories, sub-device files and the IMEI/GPS/GYRO files (which report
+// their device) carry them.
+#define DEVICE_XATTR_PREFIX "user.wave."
+
+static const char *device_xattr_names[] = {"name", "model", "serial", "imei", "system_id", "registered", "parent"};
+
+#define DEVICE_XATTR_COUNT (sizeof(device_xattr_names) / sizeof(device_xattr_names[0]))
+
+static DeviceEntry *device_for_path(const char *path) {
+    DeviceEntry *device = find_dir_device(path, NULL);
+    if (device != NULL) {
+        return device;
+    }
+    char parent_dir[1024];
+    get_parent_directory(path, parent_dir);
+    const char *file_name = extract_directory_name(path);
+    if (virtual_file_kind(file_name) != VIRTUAL_NONE) {
+        return find_dir_device(parent_dir, NULL);
+    }
+    File *file = find_file(&file_list, file_name, parent_dir);
+    return file != NULL ? get_device_entry(file->device_handle) : NULL;
+}
+
+// Renders one attribute (name without the prefix) of device. Returns its
+// length, or -ENODATA when the device does not have it: only top-level
+// devices have an IMEI and only sub-devices have a parent.
+static int render_device_xattr(const DeviceEntry *device, const char *name, char *out, size_t size) {
+    if (strcmp(name, "name") == 0) {
+        return snprintf(out, size, "%s", device->name);
+    }
+    if (strcmp(name, "model") == 0) {
+        return snprintf(out, size, "%s", device->model);
+    }
+    if (strcmp(name, "serial") == 0) {
+        return snprintf(out, size, "%d", device->serial_number);
+    }
+    if (strcmp(name, "imei") == 0 && device->type == FOLDER_TYPE) {
+        return snprintf(out, size, "%s", device->imei);
+    }
+    if (strcmp(name, "system_id") == 0) {
+        return snprintf(out, size, "%s", device->system_id);
+    }
+    if (strcmp(name, "registered") == 0) {
+        return snprintf(out, size, "%lld", (long long)device->registration_date);
+    }
+    if (strcmp(name, "parent") == 0 && device->type == FILE_TYPE) {
+        DeviceEntry *parent = get_device_entry(device->parent_handle);
+        return parent != NULL ? snprintf(out, size, "%s", parent->name) : -ENODATA;
+    }
+    return -ENODATA;
+}
+
+static int getxattr_callback(const char *path, const char *name, char *value, size_t size) {
+    size_t prefix_length = strlen(DEVICE_XATTR_PREFIX);
+    if (strncmp(name, DEVICE_XATTR_PREFIX, prefix_length) != 0) {
+        return -ENODATA;
+    }
+    DeviceEntry *device = device_for_path(path);
+    if (device == NULL) {
+        return -ENODATA;
+    }
+    char text[128];
+    int length = render_device_xattr(device, name + prefix_length, text, sizeof(text));
+    if (length < 0 || size == 0) {
+        return length;
+    }
+    if ((size_t)length > size) {
+        return -ERANGE;
+    }
+    memcpy(value, text, length);
+    return length;
+}
+
+static int listxattr_callback(const char *path, char *list, size_t size) {
+    DeviceEntry *device = device_for_path(path);
+    if (device == NULL) {
+        return 0;
+    }
+    char names[256];
+    char text[128];
+    size_t length = 0;
+    for (size_t i = 0; i < DEVICE_XATTR_COUNT; i++) {
+        if (render_device_xattr(device, device_xattr_names[i], text, sizeof(text)) >= 0) {
+            length += snprintf(names + length, sizeof(names) - length, "%s%s", DEVICE_XATTR_PREFIX,
+                               device_xattr_names[i]) + 1;
+        }
+    }
+    if (size == 0) {
+        return (int)length;
+    }
+    if (length > size) {
+        return -ERANGE;
+    }
+    memcpy(list, names, length);
+    return (int)length;
+}
 
-int main(int argc, char *argv[])
-{
-  init_file_list(&file_list,10);
-  init_dir_list(&dir_list,10);
-  int result = fuse_main(argc, argv, &fuse_example_operations, NULL);
-  
-  free_file_list(&file_list);
-  free_dir_list(&dir_list);
-  if(device_storage != NULL) free(device_storage);
-  return result;
+static void fill_device_record(const DeviceEntry *device, struct wave_device_record *record) {
+    memset(record, 0, sizeof(*record));
+    record->handle = device->handle;
+    record->parent_handle = device->parent_handle;
+    snprintf(record->name, sizeof(record->name), "%s", device->name);
+    snprintf(record->model, sizeof(record->model), "%s", device->model);
+    memcpy(record->imei, device->imei, sizeof(record->imei));
+    memcpy(record->system_id, device->system_id, sizeof(record->system_id));
+    record->serial_number = device->serial_number;
+    record->child_count = device->child_count;
+    record->registration_date = device->registration_date;
+    if (device->type == FOLDER_TYPE) {
+        record->size = device->total_bytes;
+        record->mode = S_IFDIR | 0755;
+        record->nlink = 2 + device->child_count;
+    } else {
+        record->size = device->own_bytes;
+        record->mode = sub_device_file_mode(device->model);
+        record->nlink = 1;
+    }
+}
+
+static int sweep_devices(struct wave_ioctl_sweep *sweep) {
+    sweep->count = 0;
+    if (sweep->next_handle < 0) {
+        return 0;
+    }
+    DeviceFilter all;
+    device_filter_init(&all);
+    int handles[WAVE_BATCH_RECORDS];
+    int next_handle = sweep->next_handle;
+    int count = device_scan(&all, &next_handle, handles, WAVE_BATCH_RECORDS);
+    for (int i = 0; i < count; i++) {
+        fill_device_record(get_device_entry(handles[i]), &sweep->records[i]);
+    }
+    sweep->count = count;
+    sweep->next_handle = count < WAVE_BATCH_RECORDS ? -1 : next_handle;
+    return 0;
+}
+
+static int lookup_devices(struct wave_ioctl_lookup *lookup) {
+    if (lookup->count > WAVE_BATCH_RECORDS) {
+        return -EINVAL;
+    }
+    lookup->found = 0;
+    for (uint32_t i = 0; i < lookup->count; i++) {
+        struct wave_device_record *record = &lookup->records[i];
+        int handle = record->handle;
+        if (handle < 0) {
+            char name[WAVE_RECORD_NAME_SIZE + 1];
+            char model[WAVE_RECORD_MODEL_SIZE + 1];
+            snprintf(name, sizeof(name), "%.*s", WAVE_RECORD_NAME_SIZE, record->name);
+            snprintf(model, sizeof(model), "%.*s", WAVE_RECORD_MODEL_SIZE, record->model);
+            handle = find_device_handle(name, model[0] != '\0' ? model : "TTConnectWave", record->parent_handle);
+        }
+        DeviceEntry *device = get_device_entry(handle);
+        if (device == NULL) {
+            record->status = -ENOENT;
+            continue;
+        }
+        fill_device_record(device, record);
+        lookup->found++;
+    }
+    return 0;
+}
+
+static int ioctl_callback(const char *path, int cmd, void *arg, struct fuse_file_info *fi,
+                          unsigned int flags, void *data) {
+    (void) arg;
+    (void) fi;
+    if (strcmp(path, ioctl_control_path) != 0) {
+        return -ENOTTY;
+    }
+    if (flags & FUSE_IOCTL_COMPAT) {
+        return -ENOSYS;
+    }
+    switch ((unsigned int)cmd) {
+        case WAVE_IOC_SWEEP:
+            return sweep_devices((struct wave_ioctl_sweep *)data);
+        case WAVE_IOC_LOOKUP:
+            return lookup_devices((struct wave_ioctl_lookup *)data);
+        default:
+            return -ENOTTY;
+    }
+}
+
+// Every callback is reached through a metered wrapper that records its
+// latency and result in the per-thread op metrics, logs it when it is slow
+// and, while a trace is being recorded, appends the call and its arguments
+// to the trace.
+#define METERED(op, call, path, size, offset, mode, payload, payload_length)       \
+    do {                                                                           \
+        WAVE_PROBE2(op__entry, op, path);                                          \
+        slow_op_begin();                                                           \
+        uint64_t start_ns = op_clock_ns();                                         \
+        int result = call;                                                         \
+        uint64_t duration_ns = op_clock_ns() - start_ns;                           \
+        WAVE_PROBE4(op__exit, op, path, result, duration_ns);                      \
+        op_metrics_record(op, duration_ns, result);                                \
+        slow_op_end(op, path, duration_ns, result);                                \
+        if (op_trace_active) {                                                     \
+            op_trace_record(op, path, size, offset, mode, payload, payload_length, \
+                            start_ns, duration_ns, result);                        \
+        }                                                                          \
+        return result;                                                             \
+    } while (0)
+
+static int metered_getattr(const char *path, struct stat *stbuf) {
+    METERED(OP_GETATTR, getattr_callback(path, stbuf), path, 0, 0, 0, NULL, 0);
+}
+
+static int metered_open(const char *path, struct fuse_file_info *fi) {
+    METERED(OP_OPEN, open_callback(path, fi), path, 0, 0, fi->flags, NULL, 0);
+}
+
+static int metered_create(const char *path, mode_t mode, struct fuse_file_info *fi) {
+    METERED(OP_CREATE, create_callback(path, mode, fi), path, 0, 0, mode, NULL, 0);
+}
+
+static int metered_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
+    METERED(OP_READ, read_callback(path, buf, size, offset, fi), path, size, offset, 0, NULL, 0);
+}
+
+static int metered_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
+    METERED(OP_WRITE, write_callback(path, buf, size, offset, fi), path, size, offset, 0, buf, size);
+}
+
+static int metered_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi) {
+    METERED(OP_READDIR, readdir_callback(path, buf, filler, offset, fi), path, 0, offset, 0, NULL, 0);
+}
+
+static int metered_truncate(const char *path, off_t size) {
+    METERED(OP_TRUNCATE, truncate_callback(path, size), path, 0, size, 0, NULL, 0);
+}
+
+static int metered_mkdir(const char *path, mode_t mode) {
+    METERED(OP_MKDIR, mkdir_callback(path, mode), path, 0, 0, mode, NULL, 0);
+}
+
+static int metered_utimens(const char *path, const struct timespec tv[2]) {
+    METERED(OP_UTIMENS, utimens_callback(path, tv), path, 0, 0, 0, NULL, 0);
+}
+
+static int metered_rmdir(const char *path) {
+    METERED(OP_RMDIR, rmdir_callback(path), path, 0, 0, 0, NULL, 0);
+}
+
+static int metered_unlink(const char *path) {
+    METERED(OP_UNLINK, unlink_callback(path), path, 0, 0, 0, NULL, 0);
+}
+
+static int metered_getxattr(const char *path, const char *name, char *value, size_t size) {
+    METERED(OP_GETXATTR, getxattr_callback(path, name, value, size), path, size, 0, 0, name, strlen(name));
+}
+
+static int metered_listxattr(const char *path, char *list, size_t size) {
+    METERED(OP_LISTXATTR, listxattr_callback(path, list, size), path, size, 0, 0, NULL, 0);
+}
+
+static int metered_ioctl(const char *path, int cmd, void *arg, struct fuse_file_info *fi,
+                         unsigned int flags, void *data) {
+    METERED(OP_IOCTL, ioctl_callback(path, cmd, arg, fi, flags, data), path, _IOC_SIZE(cmd), 0, (uint32_t)cmd, NULL, 0);
+}
+
+static int metered_poll(const char *path, struct fuse_file_info *fi,
+                        struct fuse_pollhandle *ph, unsigned *reventsp) {
+    METERED(OP_POLL, poll_callback(path, fi, ph, reventsp), path, 0, 0, ph != NULL, NULL, 0);
+}
+
+static int metered_flush(const char *path, struct fuse_file_info *fi) {
+    METERED(OP_FLUSH, flush_callback(path, fi), path, 0, 0, 0, NULL, 0);
+}
+
+static int metered_release(const char *path, struct fuse_file_info *fi) {
+    METERED(OP_RELEASE, release_callback(path, fi), path, 0, 0, fi->flags, NULL, 0);
+}
+
+static void *metered_init(struct fuse_conn_info *conn) {
+    uint64_t start_ns = op_clock_ns();
+    void *private_data = init_callback(conn);
+    op_metrics_record(OP_INIT, op_clock_ns() - start_ns, 0);
+    return private_data;
+}
+
+struct fuse_operations fuse_example_operations = {
+  .getattr = metered_getattr,
+  .open = metered_open,
+  .create = metered_create,
+  .read = metered_read,
+  .write = metered_write,
+  .readdir = metered_readdir,
+  .init = metered_init,
+  .truncate = metered_truncate,
+  .mkdir = metered_mkdir,
+  .utimens = metered_utimens,
+  .rmdir = metered_rmdir,
+  .unlink = metered_unlink,
+  .getxattr = metered_getxattr,
+  .listxattr = metered_listxattr,
+  .ioctl = metered_ioctl,
+  .poll = metered_poll,
+  .flush = metered_flush,
+  .release = metered_release
+};
 
+void fuse_example_setup(void) {
+    configure_paths_from_env();
+    configure_slow_ops_from_env();
+    configure_memory_cap_from_env();
+    const char *trace_path = getenv("FUSE_EXAMPLE_TRACE");
+    if (trace_path != NULL && *trace_path != '\0' && op_trace_open(trace_path) != 0) {
+        fprintf(stderr, "fuse-example: cannot record trace to %s\n", trace_path);
+    }
+    configure_sensors_from_env();
+    configure_events_from_env();
+    configure_actuators_from_env();
+    init_file_list(&file_list, 10);
+    init_dir_list(&dir_list, 10);
 }
 
+void fuse_example_teardown(void) {
+    sensor_engine_stop();
+    actuator_queue_stop();
+    event_feed_free();
+    op_trace_close();
+    slow_ops_close();
+    free_file_list(&file_list);
+    free_dir_list(&dir_list);
+    free_device_registry();
+    for (size_t i = 0; i < CONTROL_FILE_COUNT; i++) {
+        free_control_buffer(&control_files[i].results);
+    }
+    for (int i = 0; i < MAX_QUERY_FILES; i++) {
+        if (query_files[i].in_use) {
+            remove_query_file(&query_files[i]);
+        }
+    }
+}
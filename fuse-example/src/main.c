@@ -0,0 +1,14 @@
+#include "fuse_example.h"
+
+int main(int argc, char *argv[])
+{
+  fuse_example_setup();
+  // Report the persistent inode numbers from getattr instead of letting
+  // libfuse make up new ones on every mount.
+  struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+  fuse_opt_add_arg(&args, "-ouse_ino");
+  int result = fuse_main(args.argc, args.argv, &fuse_example_operations, NULL);
+  fuse_opt_free_args(&args);
+  fuse_example_teardown();
+  return result;
+}
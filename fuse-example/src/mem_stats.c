@@ -0,0 +1,96 @@
+#include "mem_stats.h"
+#include <malloc.h>
+#include <stdatomic.h>
+
+const char *mem_category_names[MEM_CATEGORY_COUNT] = {
+    "file_data", "lists", "registry", "buffers", "metrics", "json", "sensors"
+};
+
+static _Atomic long long live_bytes[MEM_CATEGORY_COUNT];
+static _Atomic long long peak_bytes[MEM_CATEGORY_COUNT];
+static _Atomic long long total_peak_bytes;
+static _Atomic long long soft_cap_bytes;
+static _Atomic long long refused;
+
+static __thread long long json_baseline;
+
+static void raise_peak(_Atomic long long *peak, long long value) {
+    long long current = atomic_load_explicit(peak, memory_order_relaxed);
+    while (value > current &&
+           !atomic_compare_exchange_weak_explicit(peak, &current, value, memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+void mem_account(MemCategory category, long long delta) {
+    long long value = atomic_fetch_add_explicit(&live_bytes[category], delta, memory_order_relaxed) + delta;
+    if (delta > 0) {
+        raise_peak(&peak_bytes[category], value);
+        raise_peak(&total_peak_bytes, mem_total_live());
+    }
+}
+
+long long mem_live(MemCategory category) {
+    return atomic_load_explicit(&live_bytes[category], memory_order_relaxed);
+}
+
+long long mem_peak(MemCategory category) {
+    return atomic_load_explicit(&peak_bytes[category], memory_order_relaxed);
+}
+
+long long mem_total_live(void) {
+    long long total = 0;
+    for (int i = 0; i < MEM_CATEGORY_COUNT; i++) {
+        total += atomic_load_explicit(&live_bytes[i], memory_order_relaxed);
+    }
+    return total;
+}
+
+long long mem_total_peak(void) {
+    return atomic_load_explicit(&total_peak_bytes, memory_order_relaxed);
+}
+
+long long mem_heap_in_use(void) {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 info = mallinfo2();
+    return (long long)info.uordblks + (long long)info.hblkhd;
+#else
+    struct mallinfo info = mallinfo();
+    return (long long)(unsigned)info.uordblks + (long long)(unsigned)info.hblkhd;
+#endif
+}
+
+void mem_json_begin(void) {
+    json_baseline = mem_heap_in_use();
+}
+
+void mem_json_sample(void) {
+    long long grown = mem_heap_in_use() - json_baseline;
+    if (json_baseline != 0 && grown > 0) {
+        raise_peak(&peak_bytes[MEM_JSON], grown);
+    }
+}
+
+void mem_json_end(void) {
+    json_baseline = 0;
+}
+
+void mem_set_soft_cap(long long bytes) {
+    atomic_store(&soft_cap_bytes, bytes);
+}
+
+long long mem_soft_cap(void) {
+    return atomic_load(&soft_cap_bytes);
+}
+
+int mem_over_soft_cap(void) {
+    long long cap = atomic_load_explicit(&soft_cap_bytes, memory_order_relaxed);
+    if (cap == 0 || mem_total_live() < cap) {
+        return 0;
+    }
+    atomic_fetch_add_explicit(&refused, 1, memory_order_relaxed);
+    return 1;
+}
+
+long long mem_refused_count(void) {
+    return atomic_load(&refused);
+}
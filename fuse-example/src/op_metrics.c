@@ -0,0 +1,272 @@
+#include "op_metrics.h"
+#include "mem_stats.h"
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Log-linear (HDR-style) histogram: values below 2^HIST_SUB_BITS get their
+// own bucket, above that every power of two is split into 2^HIST_SUB_BITS
+// buckets, which keeps the relative error around 6%.
+#define HIST_SUB_BITS 4
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_BITS)
+#define HIST_MAGNITUDES 38
+#define HIST_BUCKETS (HIST_SUB_BUCKETS * HIST_MAGNITUDES)
+
+const char *op_names[OP_COUNT] = {
+    "getattr", "readdir", "open", "read", "write", "create", "mkdir",
+    "unlink", "rmdir", "truncate", "utimens", "release", "getxattr", "listxattr", "ioctl", "poll", "init", "flush"
+};
+
+typedef struct ThreadOpMetrics {
+    _Atomic uint64_t count[OP_COUNT];
+    _Atomic uint64_t errors[OP_COUNT];
+    _Atomic uint64_t total_ns[OP_COUNT];
+    _Atomic uint64_t max_ns[OP_COUNT];
+    _Atomic uint32_t buckets[OP_COUNT][HIST_BUCKETS];
+    atomic_int in_use;
+    struct ThreadOpMetrics *next;
+} ThreadOpMetrics;
+
+// Blocks are never freed. A thread that exits hands its block back and the
+// next new thread reuses it, so memory is bounded by the peak thread count.
+static _Atomic(ThreadOpMetrics *) all_metrics = NULL;
+static __thread ThreadOpMetrics *local_metrics = NULL;
+static pthread_key_t release_key;
+static pthread_once_t release_key_once = PTHREAD_ONCE_INIT;
+
+static void release_thread_metrics(void *block) {
+    atomic_store(&((ThreadOpMetrics *)block)->in_use, 0);
+}
+
+static void create_release_key(void) {
+    pthread_key_create(&release_key, release_thread_metrics);
+}
+
+static ThreadOpMetrics *acquire_thread_metrics(void) {
+    pthread_once(&release_key_once, create_release_key);
+
+    ThreadOpMetrics *block = NULL;
+    for (ThreadOpMetrics *it = atomic_load(&all_metrics); it != NULL; it = it->next) {
+        int expected = 0;
+        if (atomic_compare_exchange_strong(&it->in_use, &expected, 1)) {
+            block = it;
+            break;
+        }
+    }
+    if (block == NULL) {
+        block = (ThreadOpMetrics *)calloc(1, sizeof(ThreadOpMetrics));
+        if (block == NULL) {
+            return NULL;
+        }
+        mem_account(MEM_METRICS, sizeof(ThreadOpMetrics));
+        atomic_init(&block->in_use, 1);
+        block->next = atomic_load(&all_metrics);
+        while (!atomic_compare_exchange_weak(&all_metrics, &block->next, block)) {
+        }
+    }
+    pthread_setspecific(release_key, block);
+    return block;
+}
+
+uint64_t op_clock_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int bucket_index(uint64_t value) {
+    if (value < HIST_SUB_BUCKETS) {
+        return (int)value;
+    }
+    int magnitude = 63 - __builtin_clzll(value);
+    int shift = magnitude - HIST_SUB_BITS;
+    int index = (shift + 1) * HIST_SUB_BUCKETS + (int)((value >> shift) & (HIST_SUB_BUCKETS - 1));
+    return index < HIST_BUCKETS ? index : HIST_BUCKETS - 1;
+}
+
+// Upper bound of the values that fall into a bucket.
+static uint64_t bucket_value(int index) {
+    if (index < HIST_SUB_BUCKETS) {
+        return (uint64_t)index;
+    }
+    int shift = index / HIST_SUB_BUCKETS - 1;
+    uint64_t sub = (uint64_t)(index % HIST_SUB_BUCKETS) | HIST_SUB_BUCKETS;
+    return ((sub + 1) << shift) - 1;
+}
+
+// Single writer per block: relaxed load/store pairs are enough and avoid
+// locked read-modify-write instructions on the hot path.
+#define BUMP(field, amount) \
+    atomic_store_explicit(&(field), atomic_load_explicit(&(field), memory_order_relaxed) + (amount), memory_order_relaxed)
+
+void op_metrics_record(OpType op, uint64_t duration_ns, int result) {
+    if (local_metrics == NULL) {
+        local_metrics = acquire_thread_metrics();
+        if (local_metrics == NULL) {
+            return;
+        }
+    }
+    ThreadOpMetrics *block = local_metrics;
+    BUMP(block->count[op], 1);
+    if (result < 0) {
+        BUMP(block->errors[op], 1);
+    }
+    BUMP(block->total_ns[op], duration_ns);
+    if (duration_ns > atomic_load_explicit(&block->max_ns[op], memory_order_relaxed)) {
+        atomic_store_explicit(&block->max_ns[op], duration_ns, memory_order_relaxed);
+    }
+    BUMP(block->buckets[op][bucket_index(duration_ns)], 1);
+}
+
+typedef struct {
+    uint64_t count;
+    uint64_t errors;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t buckets[HIST_BUCKETS];
+} OpSummary;
+
+static void summarize(OpType op, OpSummary *summary) {
+    memset(summary, 0, sizeof(*summary));
+    for (ThreadOpMetrics *it = atomic_load(&all_metrics); it != NULL; it = it->next) {
+        summary->count += atomic_load_explicit(&it->count[op], memory_order_relaxed);
+        summary->errors += atomic_load_explicit(&it->errors[op], memory_order_relaxed);
+        summary->total_ns += atomic_load_explicit(&it->total_ns[op], memory_order_relaxed);
+        uint64_t max_ns = atomic_load_explicit(&it->max_ns[op], memory_order_relaxed);
+        if (max_ns > summary->max_ns) {
+            summary->max_ns = max_ns;
+        }
+        for (int b = 0; b < HIST_BUCKETS; b++) {
+            summary->buckets[b] += atomic_load_explicit(&it->buckets[op][b], memory_order_relaxed);
+        }
+    }
+}
+
+static uint64_t percentile(const OpSummary *summary, double fraction) {
+    uint64_t total = 0;
+    for (int b = 0; b < HIST_BUCKETS; b++) {
+        total += summary->buckets[b];
+    }
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(fraction * (double)total);
+    if (rank >= total) {
+        rank = total - 1;
+    }
+    uint64_t seen = 0;
+    for (int b = 0; b < HIST_BUCKETS; b++) {
+        seen += summary->buckets[b];
+        if (seen > rank) {
+            uint64_t value = bucket_value(b);
+            return value < summary->max_ns ? value : summary->max_ns;
+        }
+    }
+    return summary->max_ns;
+}
+
+char *op_metrics_render(int json, size_t *length) {
+    char *text = NULL;
+    size_t size = 0;
+    FILE *out = open_memstream(&text, &size);
+    if (out == NULL) {
+        return NULL;
+    }
+
+    OpSummary *summary = (OpSummary *)malloc(sizeof(OpSummary));
+    if (summary == NULL) {
+        fclose(out);
+        free(text);
+        return NULL;
+    }
+    if (json) {
+        fprintf(out, "{\"ops\":{");
+    } else {
+        fprintf(out, "%-9s %12s %8s %10s %10s %10s %10s %10s\n",
+                "op", "count", "errors", "mean_us", "p50_us", "p99_us", "p999_us", "max_us");
+    }
+    for (int op = 0; op < OP_COUNT; op++) {
+        summarize((OpType)op, summary);
+        uint64_t mean_ns = summary->count ? summary->total_ns / summary->count : 0;
+        uint64_t p50 = percentile(summary, 0.50);
+        uint64_t p99 = percentile(summary, 0.99);
+        uint64_t p999 = percentile(summary, 0.999);
+        if (json) {
+            fprintf(out, "%s\"%s\":{\"count\":%llu,\"errors\":%llu,\"mean_ns\":%llu,\"p50_ns\":%llu,"
+                         "\"p99_ns\":%llu,\"p999_ns\":%llu,\"max_ns\":%llu}",
+                    op ? "," : "", op_names[op],
+                    (unsigned long long)summary->count, (unsigned long long)summary->errors,
+                    (unsigned long long)mean_ns, (unsigned long long)p50, (unsigned long long)p99,
+                    (unsigned long long)p999, (unsigned long long)summary->max_ns);
+        } else {
+            fprintf(out, "%-9s %12llu %8llu %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+                    op_names[op], (unsigned long long)summary->count, (unsigned long long)summary->errors,
+                    mean_ns / 1000.0, p50 / 1000.0, p99 / 1000.0, p999 / 1000.0, summary->max_ns / 1000.0);
+        }
+    }
+    if (json) {
+        fprintf(out, "}}\n");
+    }
+    free(summary);
+    fclose(out);
+    *length = size;
+    return text;
+}
+
+// SIGUSR1 only writes a byte to a pipe; a helper thread does the dump
+// outside of signal context.
+static int dump_pipe[2] = {-1, -1};
+static const char *dump_file_path = NULL;
+
+static void dump_signal_handler(int signal_number) {
+    (void)signal_number;
+    char byte = 1;
+    ssize_t ignored = write(dump_pipe[1], &byte, 1);
+    (void)ignored;
+}
+
+static void *dump_thread_main(void *arg) {
+    (void)arg;
+    char byte;
+    while (read(dump_pipe[0], &byte, 1) == 1) {
+        size_t length = 0;
+        char *text = op_metrics_render(0, &length);
+        FILE *dump_file = fopen(dump_file_path, "a");
+        if (dump_file != NULL && text != NULL) {
+            fprintf(dump_file, "# %ld\n%s\n", (long)time(NULL), text);
+        }
+        if (dump_file != NULL) {
+            fclose(dump_file);
+        }
+        free(text);
+    }
+    return NULL;
+}
+
+int op_metrics_install_dump_signal(const char *dump_path) {
+    if (dump_pipe[0] != -1) {
+        return 0;
+    }
+    if (pipe(dump_pipe) != 0) {
+        return -1;
+    }
+    dump_file_path = dump_path;
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, dump_thread_main, NULL) != 0) {
+        return -1;
+    }
+    pthread_detach(thread);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = dump_signal_handler;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    return sigaction(SIGUSR1, &action, NULL);
+}
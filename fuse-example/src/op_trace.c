@@ -0,0 +1,136 @@
+#include "op_trace.h"
+#include "mem_stats.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define TRACE_BUFFER_SIZE (1 << 20)
+
+int op_trace_active = 0;
+
+static FILE *trace_file = NULL;
+static uint64_t trace_start_ns = 0;
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+int op_trace_open(const char *trace_path) {
+    FILE *file = fopen(trace_path, "wb");
+    if (file == NULL) {
+        return -1;
+    }
+    setvbuf(file, NULL, _IOFBF, TRACE_BUFFER_SIZE);
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    OpTraceHeader header;
+    memcpy(header.magic, OP_TRACE_MAGIC, sizeof(header.magic));
+    header.start_realtime_ns = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+    if (fwrite(&header, sizeof(header), 1, file) != 1) {
+        fclose(file);
+        return -1;
+    }
+
+    mem_account(MEM_BUFFERS, TRACE_BUFFER_SIZE);
+    pthread_mutex_lock(&trace_mutex);
+    trace_file = file;
+    trace_start_ns = op_clock_ns();
+    op_trace_active = 1;
+    pthread_mutex_unlock(&trace_mutex);
+    return 0;
+}
+
+void op_trace_record(OpType op, const char *path, uint64_t size, uint64_t offset, uint32_t mode,
+                     const char *payload, size_t payload_length,
+                     uint64_t start_ns, uint64_t duration_ns, int result) {
+    size_t path_length = path != NULL ? strlen(path) : 0;
+    if (path_length > UINT16_MAX) {
+        path_length = UINT16_MAX;
+    }
+    if (payload == NULL || payload_length > UINT32_MAX) {
+        payload_length = 0;
+    }
+
+    OpTraceRecordHeader header;
+    memset(&header, 0, sizeof(header));
+    header.duration_ns = duration_ns > UINT32_MAX ? UINT32_MAX : (uint32_t)duration_ns;
+    header.result = result;
+    header.offset = offset;
+    header.size = size > UINT32_MAX ? UINT32_MAX : (uint32_t)size;
+    header.mode = mode;
+    header.op = (uint8_t)op;
+    header.path_length = (uint16_t)path_length;
+    header.payload_length = (uint32_t)payload_length;
+
+    pthread_mutex_lock(&trace_mutex);
+    if (trace_file != NULL) {
+        header.timestamp_ns = start_ns > trace_start_ns ? start_ns - trace_start_ns : 0;
+        fwrite(&header, sizeof(header), 1, trace_file);
+        fwrite(path, 1, path_length, trace_file);
+        fwrite(payload, 1, payload_length, trace_file);
+    }
+    pthread_mutex_unlock(&trace_mutex);
+}
+
+void op_trace_close(void) {
+    pthread_mutex_lock(&trace_mutex);
+    if (trace_file != NULL) {
+        fclose(trace_file);
+        trace_file = NULL;
+        mem_account(MEM_BUFFERS, -TRACE_BUFFER_SIZE);
+    }
+    op_trace_active = 0;
+    pthread_mutex_unlock(&trace_mutex);
+}
+
+int op_trace_reader_open(OpTraceReader *reader, const char *trace_path) {
+    memset(reader, 0, sizeof(*reader));
+    reader->file = fopen(trace_path, "rb");
+    if (reader->file == NULL) {
+        return -1;
+    }
+    if (fread(&reader->header, sizeof(reader->header), 1, reader->file) != 1 ||
+        memcmp(reader->header.magic, OP_TRACE_MAGIC, sizeof(reader->header.magic)) != 0) {
+        fclose(reader->file);
+        reader->file = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+int op_trace_reader_next(OpTraceReader *reader, OpTraceRecord *record) {
+    if (fread(&record->header, sizeof(record->header), 1, reader->file) != 1) {
+        return feof(reader->file) ? 0 : -1;
+    }
+    if (record->header.op >= OP_COUNT) {
+        return -1;
+    }
+    // Path and payload share one buffer, each NUL-terminated.
+    size_t needed = (size_t)record->header.path_length + record->header.payload_length + 2;
+    if (needed > reader->capacity) {
+        char *buffer = realloc(reader->buffer, needed);
+        if (buffer == NULL) {
+            return -1;
+        }
+        reader->buffer = buffer;
+        reader->capacity = needed;
+    }
+    char *path = reader->buffer;
+    char *payload = path + record->header.path_length + 1;
+    if (fread(path, 1, record->header.path_length, reader->file) != record->header.path_length ||
+        fread(payload, 1, record->header.payload_length, reader->file) != record->header.payload_length) {
+        return -1;
+    }
+    path[record->header.path_length] = '\0';
+    payload[record->header.payload_length] = '\0';
+    record->path = path;
+    record->payload = payload;
+    return 1;
+}
+
+void op_trace_reader_close(OpTraceReader *reader) {
+    if (reader->file != NULL) {
+        fclose(reader->file);
+    }
+    free(reader->buffer);
+    memset(reader, 0, sizeof(*reader));
+}
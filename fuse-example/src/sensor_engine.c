@@ -0,0 +1,555 @@
+#include "sensor_engine.h"
+#include "sensor_history.h"
+#include "device_manager.h"
+#include "mem_stats.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <errno.h>
+
+// Same alphabet as generate_random_string, so a SENSOR reading looks like
+// the value a "data" write produces.
+static const char reading_charset[] =
+    "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789,.+-/*?!@#$%^|&";
+#define READING_CHARSET_SIZE (sizeof(reading_charset) - 1)
+#define READING_LENGTH 8
+#define GPS_DIGITS 2
+#define GYRO_DIGITS 3
+
+// Values for one registry chunk, column-wise like the query columns in
+// device_manager.c. Slots that are not tracked have kind -1.
+typedef struct {
+    signed char kind[DEVICE_CHUNK_SIZE];
+    unsigned char gps[GPS_DIGITS][DEVICE_CHUNK_SIZE];
+    unsigned char gyro[GYRO_DIGITS][DEVICE_CHUNK_SIZE];
+    unsigned char reading[READING_LENGTH][DEVICE_CHUNK_SIZE];
+    _Atomic uint64_t version[SENSOR_CHANNEL_COUNT][DEVICE_CHUNK_SIZE];
+    _Atomic int64_t changed_ms[SENSOR_CHANNEL_COUNT][DEVICE_CHUNK_SIZE];   // Unix ms of the last version bump
+    uint64_t rng[2];    // xorshift state for the tick, one per vector lane
+    int tracked;        // slots with kind >= 0
+} SensorColumns;
+
+static SensorColumns *sensor_chunks[MAX_DEVICE_CHUNKS];
+// Chunks allocated, always a prefix. Grown under sensor_mutex; the count is
+// stored with release after the chunk pointer, so lock-free readers that
+// load it with acquire see the chunks below it.
+static _Atomic int sensor_chunk_count = 0;
+static pthread_mutex_t sensor_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static SensorListener sensor_listener = NULL;
+
+static pthread_t tick_thread;
+static int tick_running = 0;
+static int tick_stop = 0;
+static unsigned int tick_interval_ms = 0;
+static pthread_mutex_t tick_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t tick_cond = PTHREAD_COND_INITIALIZER;
+
+// Helpers share the chunks of a tick with the thread that runs it; every
+// thread claims the next chunk until none are left. batch_generation counts
+// ticks and batch_busy the helpers still working on the current one.
+#define MAX_TICK_HELPERS 15
+static pthread_t tick_helpers[MAX_TICK_HELPERS];
+static int tick_helper_count = 0;
+static pthread_mutex_t batch_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t batch_start_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t batch_done_cond = PTHREAD_COND_INITIALIZER;
+static uint64_t batch_generation = 0;
+static int batch_busy = 0;
+static int batch_stop = 0;
+static int64_t batch_now_ms = 0;
+static _Atomic int batch_next_chunk;
+static _Atomic int batch_changed;
+
+void sensor_engine_set_listener(SensorListener listener) {
+    sensor_listener = listener;
+}
+
+// FNV-1a over the system ID, the seed the GPS and GYRO files have always
+// been derived from.
+static unsigned int system_id_seed(const char *system_id) {
+    unsigned int hash = 2166136261u;
+    for (const char *c = system_id; *c != '\0'; c++) {
+        hash = (hash ^ (unsigned char)*c) * 16777619u;
+    }
+    return hash;
+}
+
+static int64_t wall_clock_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static uint64_t xorshift64(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+static SensorColumns *columns_for(int handle, int *slot) {
+    if (handle < 0 || handle / DEVICE_CHUNK_SIZE >= atomic_load_explicit(&sensor_chunk_count, memory_order_acquire)) {
+        return NULL;
+    }
+    *slot = handle % DEVICE_CHUNK_SIZE;
+    return sensor_chunks[handle / DEVICE_CHUNK_SIZE];
+}
+
+static int ensure_sensor_chunk(int chunk) {
+    int count = atomic_load_explicit(&sensor_chunk_count, memory_order_relaxed);
+    while (count <= chunk) {
+        SensorColumns *columns = (SensorColumns *)calloc(1, sizeof(SensorColumns));
+        if (columns == NULL) {
+            return -ENOMEM;
+        }
+        memset(columns->kind, -1, sizeof(columns->kind));
+        columns->rng[0] = 0x9E3779B97F4A7C15ull * (uint64_t)(count + 1);
+        columns->rng[1] = 0xD1B54A32D192ED03ull * (uint64_t)(count + 1);
+        sensor_chunks[count++] = columns;
+        atomic_store_explicit(&sensor_chunk_count, count, memory_order_release);
+        mem_account(MEM_SENSORS, sizeof(SensorColumns));
+    }
+    return 0;
+}
+
+void sensor_engine_track(int handle, SensorKind kind, const char *system_id) {
+    if (handle < 0 || handle / DEVICE_CHUNK_SIZE >= MAX_DEVICE_CHUNKS) {
+        return;
+    }
+    pthread_mutex_lock(&sensor_mutex);
+    if (ensure_sensor_chunk(handle / DEVICE_CHUNK_SIZE) != 0) {
+        pthread_mutex_unlock(&sensor_mutex);
+        return;
+    }
+    int slot;
+    SensorColumns *columns = columns_for(handle, &slot);
+    unsigned int seed = system_id_seed(system_id);
+    if (columns->kind[slot] < 0) {
+        columns->tracked++;
+    }
+    columns->kind[slot] = (signed char)kind;
+    columns->gps[0][slot] = seed % 10;
+    columns->gps[1][slot] = (seed / 10) % 10;
+    columns->gyro[0][slot] = (seed / 100) % 10;
+    columns->gyro[1][slot] = (seed / 1000) % 10;
+    columns->gyro[2][slot] = (seed / 10000) % 10;
+    uint64_t mix = seed | ((uint64_t)seed << 32);
+    for (int i = 0; i < READING_LENGTH; i++) {
+        columns->reading[i][slot] = xorshift64(&mix) % READING_CHARSET_SIZE;
+    }
+    // A handle that is reused must not look unchanged to a reader of the
+    // device that held it before, so versions only ever go up.
+    int64_t now_ms = wall_clock_ms();
+    for (int channel = 0; channel < SENSOR_CHANNEL_COUNT; channel++) {
+        atomic_fetch_add_explicit(&columns->version[channel][slot], 1, memory_order_release);
+        atomic_store_explicit(&columns->changed_ms[channel][slot], now_ms, memory_order_relaxed);
+    }
+    if (kind == SENSOR_KIND_DEVICE) {
+        unsigned char gps[GPS_DIGITS] = {columns->gps[0][slot], columns->gps[1][slot]};
+        unsigned char gyro[GYRO_DIGITS] = {columns->gyro[0][slot], columns->gyro[1][slot], columns->gyro[2][slot]};
+        sensor_history_reset(handle, now_ms, gps, gyro);
+    }
+    pthread_mutex_unlock(&sensor_mutex);
+}
+
+void sensor_engine_untrack(int handle) {
+    pthread_mutex_lock(&sensor_mutex);
+    int slot;
+    SensorColumns *columns = columns_for(handle, &slot);
+    if (columns != NULL && columns->kind[slot] >= 0) {
+        columns->kind[slot] = -1;
+        columns->tracked--;
+    }
+    pthread_mutex_unlock(&sensor_mutex);
+}
+
+void sensor_engine_free(void) {
+    sensor_engine_stop();
+    pthread_mutex_lock(&sensor_mutex);
+    int count = atomic_load_explicit(&sensor_chunk_count, memory_order_relaxed);
+    atomic_store_explicit(&sensor_chunk_count, 0, memory_order_release);
+    for (int i = 0; i < count; i++) {
+        free(sensor_chunks[i]);
+        sensor_chunks[i] = NULL;
+    }
+    mem_account(MEM_SENSORS, -(long long)count * (long long)sizeof(SensorColumns));
+    sensor_history_free();
+    pthread_mutex_unlock(&sensor_mutex);
+}
+
+static int channel_available(signed char kind, SensorChannel channel) {
+    if (kind == SENSOR_KIND_DEVICE) {
+        return channel == SENSOR_CHANNEL_GPS || channel == SENSOR_CHANNEL_GYRO;
+    }
+    return kind >= 0 && channel == SENSOR_CHANNEL_VALUE;
+}
+
+int sensor_engine_render(int handle, SensorChannel channel, char *out, size_t size) {
+    int length = -1;
+    pthread_mutex_lock(&sensor_mutex);
+    int slot;
+    SensorColumns *columns = columns_for(handle, &slot);
+    if (columns != NULL && channel_available(columns->kind[slot], channel)) {
+        if (channel == SENSOR_CHANNEL_GPS) {
+            length = snprintf(out, size, "%u %u\n", columns->gps[0][slot], columns->gps[1][slot]);
+        } else if (channel == SENSOR_CHANNEL_GYRO) {
+            length = snprintf(out, size, "%u %u %u\n", columns->gyro[0][slot],
+                              columns->gyro[1][slot], columns->gyro[2][slot]);
+        } else if (columns->kind[slot] == SENSOR_KIND_READING) {
+            char reading[READING_LENGTH + 1];
+            for (int i = 0; i < READING_LENGTH; i++) {
+                reading[i] = reading_charset[columns->reading[i][slot]];
+            }
+            reading[READING_LENGTH] = '\0';
+            length = snprintf(out, size, "%s\n", reading);
+        }
+    }
+    pthread_mutex_unlock(&sensor_mutex);
+    return length;
+}
+
+void sensor_engine_configure_history(size_t bytes_per_device) {
+    pthread_mutex_lock(&sensor_mutex);
+    sensor_history_configure(bytes_per_device);
+    pthread_mutex_unlock(&sensor_mutex);
+}
+
+int sensor_engine_history(int handle, SensorChannel channel, int64_t from_ms, int64_t to_ms,
+                          SensorSampleFn fn, void *context) {
+    if (channel != SENSOR_CHANNEL_GPS && channel != SENSOR_CHANNEL_GYRO) {
+        return -1;
+    }
+    pthread_mutex_lock(&sensor_mutex);
+    int matched = sensor_history_scan(handle, channel, from_ms, to_ms, fn, context);
+    pthread_mutex_unlock(&sensor_mutex);
+    return matched;
+}
+
+uint64_t sensor_engine_version(int handle, SensorChannel channel) {
+    int slot;
+    SensorColumns *columns = columns_for(handle, &slot);
+    if (columns == NULL) {
+        return 0;
+    }
+    return atomic_load_explicit(&columns->version[channel][slot], memory_order_acquire);
+}
+
+int64_t sensor_engine_changed_ms(int handle, SensorChannel channel) {
+    int slot;
+    SensorColumns *columns = columns_for(handle, &slot);
+    if (columns == NULL) {
+        return 0;
+    }
+    return atomic_load_explicit(&columns->changed_ms[channel][slot], memory_order_relaxed);
+}
+
+void sensor_engine_touch(int handle, SensorChannel channel) {
+    int slot;
+    SensorColumns *columns = columns_for(handle, &slot);
+    if (columns == NULL) {
+        return;
+    }
+    atomic_fetch_add_explicit(&columns->version[channel][slot], 1, memory_order_release);
+    atomic_store_explicit(&columns->changed_ms[channel][slot], wall_clock_ms(), memory_order_relaxed);
+    SensorListener listener = sensor_listener;
+    if (listener != NULL) {
+        listener(handle, channel);
+    }
+}
+
+// The tick works on 16 slots at a time with GCC vector extensions, which
+// compile to SSE2 or NEON without extra -m flags.
+typedef unsigned char u8x16 __attribute__((vector_size(16)));
+typedef uint16_t u16x16 __attribute__((vector_size(32)));
+typedef uint64_t u64x2 __attribute__((vector_size(16)));
+#define TICK_LANES 16
+
+static u8x16 load_lanes(const void *from) {
+    u8x16 lanes;
+    memcpy(&lanes, from, sizeof(lanes));
+    return lanes;
+}
+
+static void store_lanes(void *to, u8x16 lanes) {
+    memcpy(to, &lanes, sizeof(lanes));
+}
+
+static int any_lane(u8x16 mask) {
+    u64x2 halves = (u64x2)mask;
+    return (halves[0] | halves[1]) != 0;
+}
+
+// Fills out with the next bytes of the chunk's two xorshift64 streams.
+static void fill_random(uint64_t *state, unsigned char *out, size_t size) {
+    u64x2 x;
+    memcpy(&x, state, sizeof(x));
+    for (size_t i = 0; i < size; i += sizeof(x)) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        memcpy(out + i, &x, sizeof(x));
+    }
+    memcpy(state, &x, sizeof(x));
+}
+
+// Moves the digits in mask one step, up or down by delta (1 or 9) and
+// wrapping, so the rendered length never changes and st_size stays valid.
+static void step_digits(unsigned char *column, u8x16 delta, u8x16 mask) {
+    u8x16 digits = load_lanes(column);
+    u8x16 stepped = digits + delta;
+    stepped -= 10 & (u8x16)(stepped >= 10);
+    store_lanes(column, digits ^ ((digits ^ stepped) & mask));
+}
+
+// Random bytes for one chunk, one plane per decision.
+typedef struct {
+    unsigned char gps[DEVICE_CHUNK_SIZE];        // bits 0-1 move, 2 digit, 3 direction
+    unsigned char gyro[DEVICE_CHUNK_SIZE];       // bits 0-1 move, 2 direction, 3-7 digit
+    unsigned char position[DEVICE_CHUNK_SIZE];   // bits 0-2 character position
+    unsigned char character[DEVICE_CHUNK_SIZE];  // scaled onto the charset
+} TickRandom;
+
+// One bit per lane of a comparison mask, lane 0 lowest: multiplying bytes
+// that are 0 or 1 by this constant gathers them into the top byte.
+static unsigned int lane_bits(u8x16 mask) {
+    u64x2 halves = (u64x2)(mask & 1);
+    return (unsigned int)((halves[0] * 0x0102040810204080ull) >> 56) |
+           (unsigned int)((halves[1] * 0x0102040810204080ull) >> 56) << 8;
+}
+
+// Only track and the tick change GPS and GYRO, both under sensor_mutex, so
+// their versions need no locked add; VALUE is also bumped by touch.
+static void bump_locked(_Atomic uint64_t *version) {
+    atomic_store_explicit(version, atomic_load_explicit(version, memory_order_relaxed) + 1, memory_order_release);
+}
+
+// Versions and history are per slot, so they are updated one slot at a
+// time, only for the slots that changed.
+static int record_changes(SensorColumns *columns, int chunk, int base, u8x16 gps_moved,
+                          u8x16 gyro_moved, u8x16 value_changed, int64_t now_ms) {
+    int changed = 0;
+    int first_handle = chunk * DEVICE_CHUNK_SIZE;
+    int history = sensor_history_bytes_per_device() > 0;
+    for (unsigned int lanes = lane_bits(gps_moved); lanes != 0; lanes &= lanes - 1, changed++) {
+        int slot = base + __builtin_ctz(lanes);
+        bump_locked(&columns->version[SENSOR_CHANNEL_GPS][slot]);
+        atomic_store_explicit(&columns->changed_ms[SENSOR_CHANNEL_GPS][slot], now_ms, memory_order_relaxed);
+        if (history) {
+            unsigned char gps[GPS_DIGITS] = {columns->gps[0][slot], columns->gps[1][slot]};
+            sensor_history_record(first_handle + slot, SENSOR_CHANNEL_GPS, now_ms, gps);
+        }
+    }
+    for (unsigned int lanes = lane_bits(gyro_moved); lanes != 0; lanes &= lanes - 1, changed++) {
+        int slot = base + __builtin_ctz(lanes);
+        bump_locked(&columns->version[SENSOR_CHANNEL_GYRO][slot]);
+        atomic_store_explicit(&columns->changed_ms[SENSOR_CHANNEL_GYRO][slot], now_ms, memory_order_relaxed);
+        if (history) {
+            unsigned char gyro[GYRO_DIGITS] = {columns->gyro[0][slot], columns->gyro[1][slot], columns->gyro[2][slot]};
+            sensor_history_record(first_handle + slot, SENSOR_CHANNEL_GYRO, now_ms, gyro);
+        }
+    }
+    for (unsigned int lanes = lane_bits(value_changed); lanes != 0; lanes &= lanes - 1, changed++) {
+        int slot = base + __builtin_ctz(lanes);
+        atomic_fetch_add_explicit(&columns->version[SENSOR_CHANNEL_VALUE][slot], 1, memory_order_release);
+        atomic_store_explicit(&columns->changed_ms[SENSOR_CHANNEL_VALUE][slot], now_ms, memory_order_relaxed);
+    }
+    return changed;
+}
+
+// Each GPS or GYRO reading moves one digit with probability 1/4 per tick
+// and each SENSOR reading replaces one character; a channel's version goes
+// up only when its value actually changed. Returns the number of changes.
+static int tick_chunk(int chunk, int64_t now_ms) {
+    SensorColumns *columns = sensor_chunks[chunk];
+    TickRandom random;
+    fill_random(columns->rng, (unsigned char *)&random, sizeof(random));
+    int changed = 0;
+    for (int base = 0; base < DEVICE_CHUNK_SIZE; base += TICK_LANES) {
+        u8x16 kind = load_lanes(columns->kind + base);
+        u8x16 device = (u8x16)(kind == SENSOR_KIND_DEVICE);
+        u8x16 reading = (u8x16)(kind == SENSOR_KIND_READING);
+        if (!any_lane(device | reading)) {
+            continue;
+        }
+
+        u8x16 bits = load_lanes(random.gps + base);
+        u8x16 gps_moved = device & (u8x16)((bits & 3) == 0);
+        u8x16 delta = 9 - (8 & (u8x16)((bits & 8) != 0));
+        for (int digit = 0; digit < GPS_DIGITS; digit++) {
+            step_digits(columns->gps[digit] + base, delta, gps_moved & (u8x16)(((bits >> 2) & 1) == (unsigned char)digit));
+        }
+
+        bits = load_lanes(random.gyro + base);
+        u8x16 gyro_moved = device & (u8x16)((bits & 3) == 0);
+        delta = 9 - (8 & (u8x16)((bits & 4) != 0));
+        u8x16 which = ((bits >> 3) * 3) >> 5;
+        for (int digit = 0; digit < GYRO_DIGITS; digit++) {
+            step_digits(columns->gyro[digit] + base, delta, gyro_moved & (u8x16)(which == (unsigned char)digit));
+        }
+
+        u8x16 position = load_lanes(random.position + base) & (READING_LENGTH - 1);
+        u16x16 scaled = __builtin_convertvector(load_lanes(random.character + base), u16x16);
+        u8x16 next = __builtin_convertvector((scaled * READING_CHARSET_SIZE) >> 8, u8x16);
+        u8x16 value_changed = {0};
+        for (int i = 0; i < READING_LENGTH; i++) {
+            u8x16 current = load_lanes(columns->reading[i] + base);
+            u8x16 replace = reading & (u8x16)(position == (unsigned char)i) & (u8x16)(current != next);
+            store_lanes(columns->reading[i] + base, current ^ ((current ^ next) & replace));
+            value_changed |= replace;
+        }
+
+        if (any_lane(gps_moved | gyro_moved | value_changed)) {
+            changed += record_changes(columns, chunk, base, gps_moved, gyro_moved, value_changed, now_ms);
+        }
+    }
+    return changed;
+}
+
+static void run_batch(void) {
+    int changed = 0;
+    int chunk;
+    int count = atomic_load_explicit(&sensor_chunk_count, memory_order_acquire);
+    while ((chunk = atomic_fetch_add_explicit(&batch_next_chunk, 1, memory_order_relaxed)) < count) {
+        if (sensor_chunks[chunk]->tracked > 0) {
+            changed += tick_chunk(chunk, batch_now_ms);
+        }
+    }
+    atomic_fetch_add_explicit(&batch_changed, changed, memory_order_relaxed);
+}
+
+static void *tick_helper_main(void *arg) {
+    uint64_t seen = (uint64_t)(uintptr_t)arg;
+    pthread_mutex_lock(&batch_mutex);
+    for (;;) {
+        while (!batch_stop && batch_generation == seen) {
+            pthread_cond_wait(&batch_start_cond, &batch_mutex);
+        }
+        if (batch_stop) {
+            break;
+        }
+        seen = batch_generation;
+        pthread_mutex_unlock(&batch_mutex);
+        run_batch();
+        pthread_mutex_lock(&batch_mutex);
+        if (--batch_busy == 0) {
+            pthread_cond_signal(&batch_done_cond);
+        }
+    }
+    pthread_mutex_unlock(&batch_mutex);
+    return NULL;
+}
+
+void sensor_engine_tick(void) {
+    pthread_mutex_lock(&sensor_mutex);
+    batch_now_ms = wall_clock_ms();
+    atomic_store_explicit(&batch_next_chunk, 0, memory_order_relaxed);
+    atomic_store_explicit(&batch_changed, 0, memory_order_relaxed);
+    if (tick_helper_count > 0) {
+        pthread_mutex_lock(&batch_mutex);
+        batch_generation++;
+        batch_busy = tick_helper_count;
+        pthread_cond_broadcast(&batch_start_cond);
+        pthread_mutex_unlock(&batch_mutex);
+    }
+    run_batch();
+    if (tick_helper_count > 0) {
+        pthread_mutex_lock(&batch_mutex);
+        while (batch_busy > 0) {
+            pthread_cond_wait(&batch_done_cond, &batch_mutex);
+        }
+        pthread_mutex_unlock(&batch_mutex);
+    }
+    int changed = atomic_load_explicit(&batch_changed, memory_order_relaxed);
+    pthread_mutex_unlock(&sensor_mutex);
+    SensorListener listener = sensor_listener;
+    if (changed > 0 && listener != NULL) {
+        listener(-1, SENSOR_CHANNEL_COUNT);
+    }
+}
+
+static void *tick_thread_main(void *arg) {
+    (void) arg;
+    pthread_mutex_lock(&tick_mutex);
+    while (!tick_stop) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += tick_interval_ms / 1000;
+        deadline.tv_nsec += (long)(tick_interval_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        if (pthread_cond_timedwait(&tick_cond, &tick_mutex, &deadline) == ETIMEDOUT && !tick_stop) {
+            pthread_mutex_unlock(&tick_mutex);
+            sensor_engine_tick();
+            pthread_mutex_lock(&tick_mutex);
+        }
+    }
+    pthread_mutex_unlock(&tick_mutex);
+    return NULL;
+}
+
+// Called with sensor_mutex held, so no tick is running.
+static void start_tick_helpers(unsigned int threads) {
+    int helpers = threads > 1 ? (int)threads - 1 : 0;
+    if (helpers > MAX_TICK_HELPERS) {
+        helpers = MAX_TICK_HELPERS;
+    }
+    batch_stop = 0;
+    while (tick_helper_count < helpers) {
+        if (pthread_create(&tick_helpers[tick_helper_count], NULL, tick_helper_main,
+                           (void *)(uintptr_t)batch_generation) != 0) {
+            break;
+        }
+        tick_helper_count++;
+    }
+}
+
+static void stop_tick_helpers(void) {
+    pthread_mutex_lock(&batch_mutex);
+    batch_stop = 1;
+    pthread_cond_broadcast(&batch_start_cond);
+    pthread_mutex_unlock(&batch_mutex);
+    for (int i = 0; i < tick_helper_count; i++) {
+        pthread_join(tick_helpers[i], NULL);
+    }
+    tick_helper_count = 0;
+}
+
+int sensor_engine_start(unsigned int tick_ms, unsigned int threads) {
+    pthread_mutex_lock(&sensor_mutex);
+    if (tick_helper_count == 0) {
+        start_tick_helpers(threads);
+    }
+    pthread_mutex_unlock(&sensor_mutex);
+    if (tick_ms == 0 || tick_running) {
+        return 0;
+    }
+    tick_interval_ms = tick_ms;
+    tick_stop = 0;
+    if (pthread_create(&tick_thread, NULL, tick_thread_main, NULL) != 0) {
+        return -1;
+    }
+    tick_running = 1;
+    return 0;
+}
+
+void sensor_engine_stop(void) {
+    if (tick_running) {
+        pthread_mutex_lock(&tick_mutex);
+        tick_stop = 1;
+        pthread_cond_signal(&tick_cond);
+        pthread_mutex_unlock(&tick_mutex);
+        pthread_join(tick_thread, NULL);
+        tick_running = 0;
+    }
+    pthread_mutex_lock(&sensor_mutex);
+    stop_tick_helpers();
+    pthread_mutex_unlock(&sensor_mutex);
+}
@@ -0,0 +1,206 @@
+#include "sensor_history.h"
+#include "device_manager.h"
+#include "mem_stats.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define HISTORY_BLOCK_SIZE 32
+#define HISTORY_CHANNELS 2
+#define MAX_SAMPLE_BYTES (10 + 2 * SENSOR_HISTORY_MAX_VALUES)
+
+static const int channel_values[HISTORY_CHANNELS] = {2, 3};
+
+// Ring state of one channel. Byte 0 of every block is its used length.
+typedef struct {
+    uint64_t last_ms;           // time of the last sample, since base_ms
+    uint16_t head;              // oldest block
+    uint16_t blocks;            // blocks in use
+    unsigned char last[SENSOR_HISTORY_MAX_VALUES];
+} HistoryRing;
+
+typedef struct {
+    int64_t base_ms;            // 0 when the handle has no history
+    HistoryRing rings[HISTORY_CHANNELS];
+    // followed by blocks_per_ring blocks for each channel
+} HistoryHeader;
+
+static unsigned char *history_chunks[MAX_DEVICE_CHUNKS];
+static size_t blocks_per_ring = 0;
+static size_t history_stride = 0;        // bytes per handle
+
+void sensor_history_free(void) {
+    for (int i = 0; i < MAX_DEVICE_CHUNKS; i++) {
+        if (history_chunks[i] != NULL) {
+            free(history_chunks[i]);
+            history_chunks[i] = NULL;
+            mem_account(MEM_SENSORS, -(long long)(history_stride * DEVICE_CHUNK_SIZE));
+        }
+    }
+}
+
+void sensor_history_configure(size_t bytes_per_device) {
+    sensor_history_free();
+    blocks_per_ring = bytes_per_device / (HISTORY_CHANNELS * HISTORY_BLOCK_SIZE);
+    if (bytes_per_device > 0 && blocks_per_ring < 2) {
+        blocks_per_ring = 2;
+    }
+    history_stride = blocks_per_ring > 0 ? sizeof(HistoryHeader) + HISTORY_CHANNELS * blocks_per_ring * HISTORY_BLOCK_SIZE : 0;
+}
+
+size_t sensor_history_bytes_per_device(void) {
+    return history_stride;
+}
+
+static HistoryHeader *history_for(int handle, int create) {
+    if (history_stride == 0 || handle < 0 || handle / DEVICE_CHUNK_SIZE >= MAX_DEVICE_CHUNKS) {
+        return NULL;
+    }
+    unsigned char *chunk = history_chunks[handle / DEVICE_CHUNK_SIZE];
+    if (chunk == NULL) {
+        if (!create) {
+            return NULL;
+        }
+        chunk = (unsigned char *)calloc(DEVICE_CHUNK_SIZE, history_stride);
+        if (chunk == NULL) {
+            return NULL;
+        }
+        history_chunks[handle / DEVICE_CHUNK_SIZE] = chunk;
+        mem_account(MEM_SENSORS, (long long)(history_stride * DEVICE_CHUNK_SIZE));
+    }
+    return (HistoryHeader *)(chunk + (size_t)(handle % DEVICE_CHUNK_SIZE) * history_stride);
+}
+
+static unsigned char *ring_block(HistoryHeader *header, int channel, size_t block) {
+    return (unsigned char *)(header + 1) + (channel * blocks_per_ring + block) * HISTORY_BLOCK_SIZE;
+}
+
+static size_t put_varint(unsigned char *out, uint64_t value) {
+    size_t length = 0;
+    while (value >= 0x80) {
+        out[length++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    out[length++] = (unsigned char)value;
+    return length;
+}
+
+static size_t get_varint(const unsigned char *in, size_t length, uint64_t *value) {
+    uint64_t result = 0;
+    size_t position = 0;
+    for (int shift = 0; position < length && shift < 64; shift += 7) {
+        unsigned char byte = in[position++];
+        result |= (uint64_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            *value = result;
+            return position;
+        }
+    }
+    return 0;
+}
+
+static uint64_t zigzag(int value) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(int64_t)(value >> 31);
+}
+
+static int unzigzag(uint64_t value) {
+    return (int)(value >> 1) ^ -(int)(value & 1);
+}
+
+void sensor_history_record(int handle, int channel, int64_t now_ms, const unsigned char *values) {
+    HistoryHeader *header = history_for(handle, 0);
+    if (header == NULL || header->base_ms == 0) {
+        return;
+    }
+    HistoryRing *ring = &header->rings[channel];
+    int count = channel_values[channel];
+    uint64_t time = now_ms > header->base_ms ? (uint64_t)(now_ms - header->base_ms) : 0;
+    if (time < ring->last_ms) {
+        time = ring->last_ms;   // the clock stepped back; keep the ring ordered
+    }
+
+    unsigned char sample[MAX_SAMPLE_BYTES];
+    size_t length = put_varint(sample, time - ring->last_ms);
+    for (int i = 0; i < count; i++) {
+        length += put_varint(sample + length, zigzag((int)values[i] - (int)ring->last[i]));
+    }
+
+    unsigned char *block = ring->blocks > 0 ? ring_block(header, channel, (ring->head + ring->blocks - 1) % blocks_per_ring) : NULL;
+    if (block == NULL || block[0] + length > HISTORY_BLOCK_SIZE) {
+        // Open a new block with a keyframe, dropping the oldest when full.
+        if (ring->blocks == blocks_per_ring) {
+            ring->head = (ring->head + 1) % blocks_per_ring;
+            ring->blocks--;
+        }
+        block = ring_block(header, channel, (ring->head + ring->blocks) % blocks_per_ring);
+        ring->blocks++;
+        length = put_varint(sample, time);
+        memcpy(sample + length, values, count);
+        length += count;
+        block[0] = 1;
+    }
+    memcpy(block + block[0], sample, length);
+    block[0] += length;
+    ring->last_ms = time;
+    memcpy(ring->last, values, count);
+}
+
+void sensor_history_reset(int handle, int64_t now_ms, const unsigned char *gps, const unsigned char *gyro) {
+    HistoryHeader *header = history_for(handle, 1);
+    if (header == NULL) {
+        return;
+    }
+    memset(header, 0, history_stride);
+    header->base_ms = now_ms > 0 ? now_ms : 1;
+    sensor_history_record(handle, 0, now_ms, gps);
+    sensor_history_record(handle, 1, now_ms, gyro);
+}
+
+int sensor_history_scan(int handle, int channel, int64_t from_ms, int64_t to_ms,
+                        SensorSampleFn fn, void *context) {
+    HistoryHeader *header = history_for(handle, 0);
+    if (header == NULL || header->base_ms == 0) {
+        return -1;
+    }
+    HistoryRing *ring = &header->rings[channel];
+    int count = channel_values[channel];
+    int matched = 0;
+    for (size_t i = 0; i < ring->blocks; i++) {
+        const unsigned char *block = ring_block(header, channel, (ring->head + i) % blocks_per_ring);
+        size_t length = block[0];
+        size_t position = 1;
+        uint64_t time = 0;
+        unsigned char values[SENSOR_HISTORY_MAX_VALUES];
+        int keyframe = 1;
+        while (position < length) {
+            uint64_t field;
+            size_t used = get_varint(block + position, length - position, &field);
+            if (used == 0) {
+                break;
+            }
+            position += used;
+            time = keyframe ? field : time + field;
+            for (int v = 0; v < count && position < length; v++) {
+                if (keyframe) {
+                    values[v] = block[position++];
+                } else {
+                    used = get_varint(block + position, length - position, &field);
+                    if (used == 0) {
+                        return matched;
+                    }
+                    position += used;
+                    values[v] = (unsigned char)((int)values[v] + unzigzag(field));
+                }
+            }
+            keyframe = 0;
+            int64_t sample_ms = header->base_ms + (int64_t)time;
+            if (sample_ms > to_ms) {
+                return matched;
+            }
+            if (sample_ms >= from_ms) {
+                fn(context, sample_ms, values, count);
+                matched++;
+            }
+        }
+    }
+    return matched;
+}
@@ -0,0 +1,149 @@
+#include "slow_ops.h"
+#include <execinfo.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_STACK_FRAMES 24
+
+static const char *phase_names[SLOW_PHASE_COUNT] = {"other", "lookup", "persist", "log"};
+
+static uint64_t threshold_ns = 0;
+static char *slow_log_path = NULL;
+static size_t slow_log_max_bytes = 0;
+static unsigned slow_stack_every = 0;
+static _Atomic unsigned long slow_op_counter = 0;   // written under slow_log_mutex
+static FILE *slow_log = NULL;
+static pthread_mutex_t slow_log_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Per-thread breakdown of the callback in progress.
+static __thread uint64_t phase_ns[SLOW_PHASE_COUNT];
+static __thread SlowOpPhase current_phase = SLOW_PHASE_OTHER;
+static __thread uint64_t phase_start_ns;
+static __thread uint64_t longest_region_ns;
+static __thread void *stack_frames[MAX_STACK_FRAMES];
+static __thread int stack_depth;
+
+int slow_ops_configure(const char *log_path, uint64_t threshold_us, size_t max_bytes, unsigned stack_every) {
+    slow_ops_close();
+    if (threshold_us == 0 || log_path == NULL) {
+        return 0;
+    }
+    pthread_mutex_lock(&slow_log_mutex);
+    slow_log_path = strdup(log_path);
+    slow_log = slow_log_path ? fopen(slow_log_path, "a") : NULL;
+    if (slow_log != NULL) {
+        setvbuf(slow_log, NULL, _IOLBF, 0);
+        slow_log_max_bytes = max_bytes;
+        slow_stack_every = stack_every;
+        threshold_ns = threshold_us * 1000;
+    }
+    pthread_mutex_unlock(&slow_log_mutex);
+    return slow_log != NULL ? 0 : -1;
+}
+
+void slow_ops_close(void) {
+    pthread_mutex_lock(&slow_log_mutex);
+    threshold_ns = 0;
+    if (slow_log != NULL) {
+        fclose(slow_log);
+        slow_log = NULL;
+    }
+    free(slow_log_path);
+    slow_log_path = NULL;
+    pthread_mutex_unlock(&slow_log_mutex);
+}
+
+void slow_op_begin(void) {
+    if (threshold_ns == 0) {
+        return;
+    }
+    memset(phase_ns, 0, sizeof(phase_ns));
+    current_phase = SLOW_PHASE_OTHER;
+    longest_region_ns = 0;
+    stack_depth = 0;
+    phase_start_ns = op_clock_ns();
+}
+
+SlowOpPhase slow_op_phase_enter(SlowOpPhase phase) {
+    SlowOpPhase previous = current_phase;
+    if (threshold_ns == 0) {
+        return previous;
+    }
+    uint64_t now = op_clock_ns();
+    phase_ns[current_phase] += now - phase_start_ns;
+    phase_start_ns = now;
+    current_phase = phase;
+    return previous;
+}
+
+void slow_op_phase_exit(SlowOpPhase previous) {
+    if (threshold_ns == 0) {
+        return;
+    }
+    uint64_t now = op_clock_ns();
+    uint64_t elapsed = now - phase_start_ns;
+    phase_ns[current_phase] += elapsed;
+    // Keep the stack of the longest region that alone takes half the
+    // threshold; it points at the code that made the operation slow, unlike
+    // a stack taken when the callback returns. Only the entries that get a
+    // stack pay for backtrace(): the counter says whether the next one does.
+    if (slow_stack_every != 0 && elapsed >= threshold_ns / 2 && elapsed > longest_region_ns &&
+        atomic_load_explicit(&slow_op_counter, memory_order_relaxed) % slow_stack_every == 0) {
+        longest_region_ns = elapsed;
+        stack_depth = backtrace(stack_frames, MAX_STACK_FRAMES);
+    }
+    phase_start_ns = op_clock_ns();
+    current_phase = previous;
+}
+
+// Called with slow_log_mutex held.
+static void rotate_if_full(void) {
+    if (slow_log_max_bytes == 0 || ftell(slow_log) < (long)slow_log_max_bytes) {
+        return;
+    }
+    char rotated[4096];
+    snprintf(rotated, sizeof(rotated), "%s.1", slow_log_path);
+    fclose(slow_log);
+    rename(slow_log_path, rotated);
+    slow_log = fopen(slow_log_path, "a");
+    if (slow_log != NULL) {
+        setvbuf(slow_log, NULL, _IOLBF, 0);
+    }
+}
+
+void slow_op_end(OpType op, const char *path, uint64_t duration_ns, int result) {
+    if (threshold_ns == 0 || duration_ns < threshold_ns) {
+        return;
+    }
+    phase_ns[current_phase] += op_clock_ns() - phase_start_ns;
+
+    time_t now = time(NULL);
+    struct tm utc;
+    char timestamp[32];
+    gmtime_r(&now, &utc);
+    strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", &utc);
+
+    pthread_mutex_lock(&slow_log_mutex);
+    if (slow_log != NULL) {
+        fprintf(slow_log, "%s %s %s duration_us=%llu result=%d", timestamp, op_names[op], path ? path : "",
+                (unsigned long long)(duration_ns / 1000), result);
+        for (int i = 0; i < SLOW_PHASE_COUNT; i++) {
+            fprintf(slow_log, " %s_us=%llu", phase_names[i], (unsigned long long)(phase_ns[i] / 1000));
+        }
+        fputc('\n', slow_log);
+        unsigned long counter = atomic_load_explicit(&slow_op_counter, memory_order_relaxed);
+        if (slow_stack_every != 0 && stack_depth > 0 && counter % slow_stack_every == 0) {
+            fflush(slow_log);
+            backtrace_symbols_fd(stack_frames, stack_depth, fileno(slow_log));
+        }
+        atomic_store_explicit(&slow_op_counter, counter + 1, memory_order_relaxed);
+        rotate_if_full();
+    }
+    pthread_mutex_unlock(&slow_log_mutex);
+}